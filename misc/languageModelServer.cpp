@@ -0,0 +1,177 @@
+/*
+ *  languageModelServer.cpp
+ *  Moses
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ *  Serves an ARPA or binary language model to the Remote LM implementation (lmodel-file type 6, host:port)
+ *  with the batch protocol described in LanguageModelRemote.h. Each connection is served on its own thread.
+ *
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "NGramTrie.h"
+#include "UserMessage.h"
+#include "Util.h"
+
+using namespace std;
+using namespace Moses;
+
+NGramTrie trie;
+map<string, NGramTrie::WordId> vocabulary;
+
+void printHelp(){
+	cerr << "Usage:" << endl <<
+	"options: " << endl <<
+	"\t-lm   string -- ARPA (may be gzipped) or binary language model" << endl <<
+	"\t-port int    -- port to listen on" << endl <<
+	endl;
+}
+
+// Reads the lines of the requests from a connection
+class LineReader {
+	int socket;
+	string buffer;
+	size_t position;
+public:
+	LineReader(int s) : socket(s), position(0) {}
+	bool getLine(string& line) {
+		while (true) {
+			size_t end = buffer.find('\n', position);
+			if (end != string::npos) {
+				line.assign(buffer, position, end - position);
+				position = end + 1;
+				return true;
+			}
+			buffer.erase(0, position);
+			position = 0;
+			char data[1 << 16];
+			ssize_t r = read(socket, data, sizeof(data));
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r <= 0)
+				return false;
+			buffer.append(data, r);
+		}
+	}
+};
+
+bool writeAll(int socket, const char* data, size_t size) {
+	while (size > 0) {
+		ssize_t w = write(socket, data, size);
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w <= 0)
+			return false;
+		data += w;
+		size -= w;
+	}
+	return true;
+}
+
+// log10 probability of the first word of the query given the following ones
+float score(const string& query) {
+	vector<string> words = Tokenize(query);
+	NGramTrie::WordId reversedWords[NGramTrie::MaxOrder];
+	size_t count = min(words.size(), trie.GetOrder());
+	for (size_t i = 0; i < count; ++i) {
+		map<string, NGramTrie::WordId>::const_iterator found = vocabulary.find(words[i]);
+		reversedWords[i] = (found == vocabulary.end()) ? trie.GetUnknownId() : found->second;
+	}
+	size_t matchedLength;
+	UINT64 state;
+	return UntransformLMScore(trie.GetProb(reversedWords, count, matchedLength, state));
+}
+
+void* serve(void* data) {
+	int connection = (int)(size_t)data;
+	LineReader reader(connection);
+	string line;
+	vector<float> answers;
+	while (reader.getLine(line)) {
+		if (line.compare(0, 6, "probs ") != 0) {
+			cerr << "Unknown request: " << line << endl;
+			break;
+		}
+		size_t count = Scan<size_t>(line.substr(6));
+		answers.resize(count);
+		size_t i = 0;
+		for (; i < count && reader.getLine(line); ++i)
+			answers[i] = score(line);
+		if (i < count)
+			break;
+		// an empty batch has no answers to send
+		if (count > 0 && !writeAll(connection, reinterpret_cast<const char*>(&answers[0]), count * sizeof(float)))
+			break;
+	}
+	close(connection);
+	return NULL;
+}
+
+int main(int argc, char** argv){
+	string lmFilePath;
+	int port = 0;
+	for (int i = 1; i < argc; ++i)
+		if ((string)argv[i] == "-lm" && i+1 < argc)
+			lmFilePath = argv[++i];
+		else if ((string)argv[i] == "-port" && i+1 < argc)
+			port = atoi(argv[++i]);
+		else {
+			printHelp();
+			exit(1);
+		}
+	if (lmFilePath.empty() || port <= 0) {
+		printHelp();
+		exit(1);
+	}
+
+	if (!(NGramTrie::IsBinary(lmFilePath) ? trie.Load(lmFilePath) : trie.ReadARPA(lmFilePath)))
+		exit(2);
+	for (NGramTrie::WordId id = 0; id < trie.GetVocabularySize(); ++id)
+		vocabulary[trie.GetWord(id)] = id;
+	cerr << "serving a " << trie.GetOrder() << "-gram model with " << trie.GetVocabularySize() << " words on port " << port << endl;
+
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	int reuse = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if (bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listener, 16) < 0) {
+		perror("Error: could not listen on the port");
+		exit(3);
+	}
+
+	while (true) {
+		int connection = accept(listener, NULL, NULL);
+		if (connection < 0) {
+			if (errno != EINTR)
+				perror("Error: accept()");
+			continue;
+		}
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, serve, (void*)(size_t)connection) != 0) {
+			cerr << "Error: could not start a thread for a connection" << endl;
+			close(connection);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+
+	return 0;
+}
@@ -0,0 +1,60 @@
+/*
+ *  processLanguageModel.cpp
+ *  Moses
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ *  Converts an ARPA language model to the binary format of the Trie LM implementation (lmodel-file type 8),
+ *  which is mapped into memory by the decoder instead of being parsed at startup.
+ *
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "NGramTrie.h"
+#include "UserMessage.h"
+#include "Util.h"
+
+using namespace std;
+using namespace Moses;
+
+void printHelp(){
+	cerr << "Usage:" << endl <<
+	"options: " << endl <<
+	"\t-in  string -- ARPA language model (may be gzipped)" << endl <<
+	"\t-out string -- binary language model" << endl <<
+	"\t-quantise int -- store the scores of each order as 2^int values (1-16) instead of floats" << endl <<
+	endl;
+}
+
+int main(int argc, char** argv){
+	string inFilePath, outFilePath;
+	size_t quantisationBits = 0;
+	for (int i = 1; i < argc; ++i)
+		if ((string)argv[i] == "-in" && i+1 < argc)
+			inFilePath = argv[++i];
+		else if ((string)argv[i] == "-out" && i+1 < argc)
+			outFilePath = argv[++i];
+		else if ((string)argv[i] == "-quantise" && i+1 < argc)
+			quantisationBits = Scan<size_t>(argv[++i]);
+		else {
+			printHelp();
+			exit(1);
+		}
+	if (inFilePath.empty() || outFilePath.empty() || quantisationBits > 16) {
+		printHelp();
+		exit(1);
+	}
+
+	cerr << "processing " << inFilePath << " to " << outFilePath << endl;
+	NGramTrie trie;
+	if (!trie.ReadARPA(inFilePath, quantisationBits))
+		exit(2);
+	cerr << trie.GetOrder() << "-gram model with " << trie.GetVocabularySize() << " words" << endl;
+	if (!trie.Save(outFilePath))
+		exit(3);
+
+	return 0;
+}
@@ -4,6 +4,11 @@
  *			© 2011 Autodesk Development Sàrl
  *			Last modified by Ventsislav Zhechev on 15 Mar 2011
  *
+ *			© 2012 Autodesk Development Sàrl
+ *			The direct and indirect tables written by score can be binarised straight away (-consolidate),
+ *			without writing and reading back a consolidated ascii table;
+ *			the source trees of the binary table are built on several threads (-threads)
+ *
  */
 
 #include <iostream>
@@ -23,6 +28,9 @@
 #include "InputFileStream.h"
 #include "Timer.h"
 
+#include "FieldSplitter.h"
+#include "PhraseTableMerger.h"
+
 using namespace std;
 using namespace Moses;
 
@@ -46,8 +54,57 @@ inline bool existsFile(const std::string& filename) {
   return existsFile(filename.c_str());
 }
 
+// the scores of a field are appended to the vector
+void appendScores(const bg_zhechev_ventsislav::StringPiece& field, std::vector<float>& scores) {
+	bg_zhechev_ventsislav::TokenIterator tokens(field);
+	bg_zhechev_ventsislav::StringPiece token;
+	std::string number;
+	while (tokens.next(token)) {
+		token.copyTo(number);
+		scores.push_back(atof(number.c_str()));
+	}
+}
+
+// Merge-joins the direct and indirect tables written by score just as consolidate does,
+// and hands the consolidated phrase pairs straight over to the binary table
+void createFromScoreTables(PhraseDictionaryTree& pdt, const std::string& fileNameDirect, const std::string& fileNameIndirect,
+													 const std::string& fto, size_t noScoreComponent, unsigned threads, bool logProb) {
+	bg_zhechev_ventsislav::PhraseTableMerger merger(fileNameDirect, fileNameIndirect, threads);
+	pdt.BeginCreate(fto, threads);
+	
+	bg_zhechev_ventsislav::StringPiece directLine, indirectLine;
+	bg_zhechev_ventsislav::StringPiece itemDirect[5], itemIndirect[5];
+	std::string source, target;
+	std::vector<float> scores;
+	while (merger.next(directLine, indirectLine)) {
+		// direct: source target probabilities count; indirect: source target probabilities count
+		if (splitFields(directLine, itemDirect, 5) != 4 || splitFields(indirectLine, itemIndirect, 5) != 4) {
+			std::cerr << "ERROR: wrong number of fields for the phrase pair (hierarchical tables cannot be binarised here): " << directLine << std::endl;
+			exit(1);
+		}
+		
+		// the scores of the consolidated table: indirect probabilities, direct probabilities and the phrase count feature
+		scores.clear();
+		appendScores(itemIndirect[2], scores);
+		appendScores(itemDirect[2], scores);
+		scores.push_back(logProb ? 1.0f : 2.718f);
+		if (scores.size() != noScoreComponent) {
+			std::cerr << "ERROR: " << scores.size() << " scores instead of " << noScoreComponent << " for the phrase pair: " << itemDirect[0] << " ||| " << itemDirect[1] << std::endl;
+			exit(1);
+		}
+		
+		itemDirect[0].copyTo(source);
+		itemDirect[1].copyTo(target);
+		pdt.AddPhrasePair(source, target, scores);
+	}
+	
+	merger.reportSkipped();
+	pdt.EndCreate();
+}
+
 int main(int argc,char **argv) {
 	std::string fto;size_t noScoreComponent=5;int cn=0;
+	std::string fdirect, findirect;unsigned threads=1;bool logProb=false;
 	bool aligninfo=false;
 	std::vector<std::pair<std::string,std::pair<char*,char*> > > ftts;
 	int verb=0;
@@ -61,6 +118,12 @@ int main(int argc,char **argv) {
 		}
 		else if(s=="-nscores") noScoreComponent=atoi(argv[++i]);
 		else if(s=="-out") fto=std::string(argv[++i]);
+		else if(s=="-consolidate") {
+			fdirect=argv[++i];
+			findirect=argv[++i];
+		}
+		else if(s=="-threads") threads=atoi(argv[++i]);
+		else if(s=="-logprob") logProb=true;
 		else if(s=="-cn") cn=1;
 		else if(s=="-irst") cn=2;
 		else if(s=="-alignment-info") aligninfo=true;
@@ -73,6 +136,12 @@ int main(int argc,char **argv) {
 					"\t-out string      -- output file name prefix for binary ttable\n"
 					"\t-nscores int     -- number of scores in ttable\n"
 					"\t-alignment-info  -- include alignment info in the binary ttable (suffix \".wa\")\n"
+					"\t-consolidate string string -- direct and indirect tables written by score, to be\n"
+					"\t                    consolidated straight into the binary ttable\n"
+					"\t-logprob         -- the score tables hold log probabilities (score --LogProb),\n"
+					"\t                    so the phrase count feature is written as 1, as consolidate --LogProb does\n"
+					"\t-threads int     -- threads for building the binary ttable (and for the\n"
+					"\t                    decompression of the score tables)\n"
 			"\nfunctions:\n"
 					"\t - convert ascii ttable in binary format\n"
 					"\t - if ttable is not read from stdin:\n"
@@ -88,6 +157,17 @@ int main(int argc,char **argv) {
 	}
 	
 	
+	if(!fdirect.empty()) {
+		if(fto.empty()) {
+			std::cerr<<"ERROR: no output file name prefix given with -out\n";
+			return 1;
+		}
+		std::cerr<<"consolidating "<<fdirect<<" and "<<findirect<<" into a ptree\n";
+		PhraseDictionaryTree pdt(noScoreComponent);
+		createFromScoreTables(pdt,fdirect,findirect,fto,noScoreComponent,threads,logProb);
+		return 0;
+	}
+	
 	if(ftts.size()) {
 		
 		if(ftts.size()==1){
@@ -98,12 +178,12 @@ int main(int argc,char **argv) {
 
 			if (ftts[0].first=="-") {
 				std::cerr<< "stdin\n";
-				pdt.Create(std::cin,fto);
+				pdt.Create(std::cin,fto,threads);
 			}
 			else{
 				std::cerr<< ftts[0].first << "\n";
 				InputFileStream in(ftts[0].first);
-				pdt.Create(in,fto);
+				pdt.Create(in,fto,threads);
 			}
 		}
 		else 
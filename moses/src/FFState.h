@@ -2,6 +2,7 @@
 #define moses_FFState_h
 
 #include <cassert>
+#include <cstddef>
 #include <vector>
 
 
@@ -11,6 +12,8 @@ class FFState {
  public:
   virtual ~FFState();
   virtual int Compare(const FFState& other) const = 0;
+  //! equal for states that Compare() as equal, so that hypotheses can be told apart by hash; 0 if not implemented
+  virtual size_t GetHash() const { return 0; }
 };
 
 }
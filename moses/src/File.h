@@ -9,6 +9,7 @@
 
 #include <cstdio>
 #include <iostream>
+#include <string>
 #include <vector>
 #include <cassert>
 #include "UserMessage.h"
@@ -90,6 +91,30 @@ inline size_t fWriteStringVector(FILE* f,const std::vector<std::string>& v) {
   return totrv;
 }
 
+// the same layouts as fWrite(), fWriteVector() and fWriteStringVector(), appended to a memory buffer
+template<typename T> inline size_t bWrite(std::string& b,const T& t) {
+  b.append(reinterpret_cast<const char*>(&t),sizeof(t));
+  return sizeof(t);
+}
+
+template<typename C> inline size_t bWriteVector(std::string& b,const C& v) {
+  UINT32 s=v.size();
+  size_t rv=bWrite(b,s);
+  if(s) b.append(reinterpret_cast<const char*>(&v[0]),sizeof(typename C::value_type)*s);
+  return rv+sizeof(typename C::value_type)*s;
+}
+
+inline size_t bWriteStringVector(std::string& b,const std::vector<std::string>& v) {
+  UINT32 s=v.size();
+  size_t totrv=bWrite(b,s);
+	for (size_t i=0;i<s;i++) {
+		totrv+=bWrite(b,(UINT32)v[i].size());
+		b.append(v[i]);
+		totrv+=v[i].size();
+	}
+  return totrv;
+}
+
 inline void fReadStringVector(FILE* f, std::vector<std::string>& v) {
   UINT32 s;fRead(f,s);v.resize(s);
 	
@@ -60,6 +60,7 @@ Hypothesis::Hypothesis(Manager& manager, InputType const& source, const TargetPh
 	, m_currTargetWordsRange(0, emptyTarget.GetSize()-1)
 	, m_wordDeleted(false)
 	, m_ffStates(StaticData::Instance().GetScoreIndexManager().GetStatefulFeatureFunctions().size())
+	, m_recombinationHash(0)
 	, m_arcList(NULL)
   , m_transOpt(NULL)
   , m_manager(manager)
@@ -73,6 +74,7 @@ Hypothesis::Hypothesis(Manager& manager, InputType const& source, const TargetPh
 	const vector<const StatefulFeatureFunction*>& ffs = StaticData::Instance().GetScoreIndexManager().GetStatefulFeatureFunctions();
 	for (unsigned i = 0; i < ffs.size(); ++i)
 	  m_ffStates[i] = ffs[i]->EmptyHypothesisState(source);
+	CalcRecombinationHash();
     m_manager.GetSentenceStats().AddCreated();
 }
 
@@ -93,6 +95,7 @@ Hypothesis::Hypothesis(const Hypothesis &prevHypo, const TranslationOption &tran
 	,	m_futureScore(0.0f)
 	, m_scoreBreakdown				(prevHypo.m_scoreBreakdown)
   , m_ffStates(prevHypo.m_ffStates.size())
+	, m_recombinationHash(0)
 	, m_arcList(NULL)
   , m_transOpt(&transOpt)
   , m_manager(prevHypo.GetManager())
@@ -241,10 +244,24 @@ Hypothesis* Hypothesis::Create(Manager& manager, InputType const& m_source, cons
     keep an ordered list of hypotheses. This makes recombination
     much quicker. 
 */
+void Hypothesis::CalcRecombinationHash()
+{
+	UINT64 hash = m_sourceCompleted.GetID();
+	for (unsigned i = 0; i < m_ffStates.size(); ++i) {
+		hash = (hash ^ (m_ffStates[i] ? m_ffStates[i]->GetHash() : 0)) * 0x9e3779b97f4a7c15ULL;
+		hash ^= hash >> 29;
+	}
+	m_recombinationHash = (size_t) hash;
+}
+
 int Hypothesis::RecombineCompare(const Hypothesis &compare) const
 { // -1 = this < compare
 	// +1 = this > compare
 	// 0	= this ==compare
+	// hypotheses with different hashes differ, so most comparisons stop here
+	if (m_recombinationHash != compare.m_recombinationHash)
+		return (m_recombinationHash < compare.m_recombinationHash) ? -1 : 1;
+
 	int comp = m_sourceCompleted.Compare(compare.m_sourceCompleted);
 	if (comp != 0)
 		return comp;
@@ -297,6 +314,7 @@ void Hypothesis::CalcScore(const SquareMatrix &futureScore)
 			m_prevHypo ? m_prevHypo->m_ffStates[i] : NULL,
 			&m_scoreBreakdown);
 	}
+	CalcRecombinationHash();
 
 	IFVERBOSE(2) { t = clock(); } // track time excluding LM
 
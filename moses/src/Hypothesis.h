@@ -81,6 +81,7 @@ protected:
 	float							m_futureScore; /*! estimated future cost to translate rest of sentence */
 	ScoreComponentCollection m_scoreBreakdown; /*! detailed score break-down by components (for instance language model, word penalty, etc) */
 	std::vector<const FFState*> m_ffStates;
+	size_t m_recombinationHash; /*! hash of the coverage and the feature function states, to tell hypotheses apart before comparing them */
 	const Hypothesis 	*m_winningHypo;
 	ArcList 					*m_arcList; /*! all arcs that end at the same trellis point as this hypothesis */
 	const TranslationOption *m_transOpt;
@@ -93,6 +94,8 @@ protected:
 	/*! used when creating a new hypothesis using a translation option (phrase translation) */
 	Hypothesis(const Hypothesis &prevHypo, const TranslationOption &transOpt);
 
+	void CalcRecombinationHash();
+
 public:
 	static ObjectPool<Hypothesis> &GetObjectPool()
 	{
@@ -303,6 +306,8 @@ struct CompareHypothesisTotalScore
 * Directly using RecombineCompare is unreliable because the Compare methods
 * of some states are based on archictecture-dependent pointer comparisons.
 * That's why we use the hypothesis IDs instead.
+* RecombineCompare first compares hashes of the states, which most of the
+* hypotheses in a stack differ in.
 */
 class HypothesisRecombinationOrderer
 {
@@ -34,10 +34,21 @@ LMList::~LMList()
 	RemoveAllInColl(m_coll);
 }
 	
-void LMList::CalcScore(const Phrase &phrase, float &retFullScore, float &retNGramScore, ScoreComponentCollection* breakdown) const
+void LMList::CalcScore(const Phrase &phrase, float &retFullScore, float &retNGramScore, ScoreComponentCollection* breakdown
+											, const PhraseScores *precalculated) const
 { 
+	const vector< pair<float, float> > *phraseScores = NULL;
+	if (precalculated != NULL)
+	{
+		pair<PhraseScores::const_iterator, PhraseScores::const_iterator> found = precalculated->equal_range(Hash(phrase));
+		for (; found.first != found.second && phraseScores == NULL; ++found.first)
+			if (found.first->second.phrase->Compare(phrase) == 0)
+				phraseScores = &found.first->second.scores;
+	}
+
 	const_iterator lmIter;
-	for (lmIter = begin(); lmIter != end(); ++lmIter)
+	size_t lmIndex = 0;
+	for (lmIter = begin(); lmIter != end(); ++lmIter, ++lmIndex)
 	{
 		const LanguageModel &lm = **lmIter;
 		const float weightLM = lm.GetWeight();
@@ -48,7 +59,13 @@ void LMList::CalcScore(const Phrase &phrase, float &retFullScore, float &retNGra
 		if (!lm.Useable(phrase))
 			continue;
 
-		lm.CalcScore(phrase, fullScore, nGramScore);
+		if (phraseScores != NULL)
+		{
+			fullScore = (*phraseScores)[lmIndex].first;
+			nGramScore = (*phraseScores)[lmIndex].second;
+		}
+		else
+			lm.CalcScore(phrase, fullScore, nGramScore);
 
 		breakdown->Assign(&lm, nGramScore);  // I'm not sure why += doesn't work here- it should be 0.0 right?
 		retFullScore   += fullScore * weightLM;
@@ -56,6 +73,65 @@ void LMList::CalcScore(const Phrase &phrase, float &retFullScore, float &retNGra
 	}	
 }
 
+size_t LMList::Hash(const Phrase &phrase)
+{
+	UINT64 hash = phrase.GetSize();
+	for (size_t pos = 0 ; pos < phrase.GetSize() ; ++pos)
+	{
+		const Word &word = phrase.GetWord(pos);
+		for (size_t factorType = 0 ; factorType < MAX_NUM_FACTORS ; ++factorType)
+		{
+			hash = (hash ^ (UINT64) (size_t) word[factorType]) * 1099511628211ULL;
+			hash ^= hash >> 32;
+		}
+	}
+	return (size_t) hash;
+}
+
+void LMList::CalcScores(const vector<const Phrase*> &phrases, PhraseScores &scores) const
+{
+	// the phrases that are not in scores yet, once each
+	vector<PhraseScores::iterator> newPhrases;
+	for (size_t currPhrase = 0 ; currPhrase < phrases.size() ; ++currPhrase)
+	{
+		const Phrase &phrase = *phrases[currPhrase];
+		const size_t hash = Hash(phrase);
+		pair<PhraseScores::iterator, PhraseScores::iterator> found = scores.equal_range(hash);
+		while (found.first != found.second && found.first->second.phrase->Compare(phrase) != 0)
+			++found.first;
+		if (found.first != found.second)
+			continue;
+
+		PhraseScores::iterator inserted = scores.insert(found.second, make_pair(hash, PhraseScore()));
+		inserted->second.phrase = &phrase;
+		inserted->second.scores.resize(size(), pair<float, float>(0, 0));
+		newPhrases.push_back(inserted);
+	}
+
+	const_iterator lmIter;
+	size_t lmIndex = 0;
+	for (lmIter = begin(); lmIter != end(); ++lmIter, ++lmIndex)
+	{
+		const LanguageModel &lm = **lmIter;
+		vector<const Phrase*> useablePhrases;
+		vector<PhraseScores::iterator> useableScores;
+		for (size_t currPhrase = 0 ; currPhrase < newPhrases.size() ; ++currPhrase)
+		{
+			const Phrase &phrase = *newPhrases[currPhrase]->second.phrase;
+			if (lm.Useable(phrase))
+			{
+				useablePhrases.push_back(&phrase);
+				useableScores.push_back(newPhrases[currPhrase]);
+			}
+		}
+
+		vector<float> fullScores, ngramScores;
+		lm.CalcScores(useablePhrases, fullScores, ngramScores);
+		for (size_t currPhrase = 0 ; currPhrase < useableScores.size() ; ++currPhrase)
+			useableScores[currPhrase]->second.scores[lmIndex] = make_pair(fullScores[currPhrase], ngramScores[currPhrase]);
+	}
+}
+
 void LMList::CalcAllLMScores(const Phrase &phrase
 											 , ScoreComponentCollection &nGramOnly
 											 , ScoreComponentCollection *beginningBitsOnly) const
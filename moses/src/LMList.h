@@ -2,12 +2,13 @@
 #define moses_LMList_h
 
 #include <list>
+#include <map>
 #include "LanguageModel.h"
+#include "Phrase.h"
 
 namespace Moses
 {
 
-class Phrase;
 class ScoreColl;
 class ScoreComponentCollection;
 
@@ -36,7 +37,22 @@ public:
 	{}
 	~LMList();
 	
-	void CalcScore(const Phrase &phrase, float &retFullScore, float &retNGramScore, ScoreComponentCollection* breakdown) const;
+	//! full and n-gram score of a phrase for each LM of the list, in its order
+	struct PhraseScore
+	{
+		const Phrase *phrase; //! not owned, it must outlive the scores
+		std::vector<std::pair<float, float> > scores;
+	};
+	//! scores of phrases by the hash of their words, without copying the phrases
+	typedef std::multimap<size_t, PhraseScore> PhraseScores;
+
+	static size_t Hash(const Phrase &phrase);
+
+	//! the scores of the phrase are taken from precalculated if it contains them
+	void CalcScore(const Phrase &phrase, float &retFullScore, float &retNGramScore, ScoreComponentCollection* breakdown
+								, const PhraseScores *precalculated = NULL) const;
+	//! adds the scores of the phrases to scores, with one call to LanguageModel::GetValues() for each LM
+	void CalcScores(const std::vector<const Phrase*> &phrases, PhraseScores &scores) const;
 
 	void CalcAllLMScores(const Phrase &phrase
 								 , ScoreComponentCollection &nGramOnly
@@ -24,6 +24,10 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <iostream>
 #include <sstream>
 
+#ifdef WITH_THREADS
+#include <boost/thread/tss.hpp>
+#endif
+
 #include "FFState.h"
 #include "LanguageModel.h"
 #include "TypeDef.h"
@@ -94,6 +98,75 @@ void LanguageModel::CalcScore(const Phrase &phrase
 	}	
 }
 
+void LanguageModel::GetValues(const vector<const Word*> &words
+														, const vector<WordSpan> &ngrams
+														, vector<float> &values
+														, unsigned int* lastLen) const
+{
+	values.resize(ngrams.size());
+	vector<const Word*> contextFactor;
+	contextFactor.reserve(m_nGramOrder);
+	State finalState;
+	for (size_t i = 0 ; i < ngrams.size() ; ++i)
+	{
+		contextFactor.assign(words.begin() + ngrams[i].first, words.begin() + ngrams[i].second);
+		if (lastLen != NULL && i + 1 == ngrams.size())
+			values[i] = GetValue(contextFactor, &finalState, lastLen);
+		else
+			values[i] = GetValue(contextFactor);
+	}
+}
+
+void LanguageModel::CalcScores(const vector<const Phrase*> &phrases
+														, vector<float> &fullScores
+														, vector<float> &ngramScores) const
+{
+	// the n-grams that CalcScore() scores, as spans of the words of all the phrases
+	vector<const Word*> words;
+	vector<WordSpan> ngrams;
+	vector<size_t> firstNGram(phrases.size() + 1);
+	for (size_t currPhrase = 0 ; currPhrase < phrases.size() ; currPhrase++)
+	{
+		firstNGram[currPhrase] = ngrams.size();
+		const Phrase &phrase = *phrases[currPhrase];
+		size_t contextStart = words.size();
+		for (size_t currPos = 0 ; currPos < phrase.GetSize() ; currPos++)
+		{
+			const Word &word = phrase.GetWord(currPos);
+			if (word.IsNonTerminal())
+			{ // reset ngram, as in CalcScore()
+				contextStart = words.size();
+				continue;
+			}
+			words.push_back(&word);
+			if (words.size() - contextStart > m_nGramOrder)
+				contextStart++;
+			if (word == GetSentenceStartArray())
+			{ // don't include prob for <s> unigram
+				assert(currPos == 0);
+			}
+			else
+				ngrams.push_back(WordSpan(contextStart, words.size()));
+		}
+	}
+	firstNGram[phrases.size()] = ngrams.size();
+
+	vector<float> values;
+	GetValues(words, ngrams, values);
+
+	fullScores.assign(phrases.size(), 0);
+	ngramScores.assign(phrases.size(), 0);
+	for (size_t currPhrase = 0 ; currPhrase < phrases.size() ; currPhrase++)
+	{
+		for (size_t i = firstNGram[currPhrase] ; i < firstNGram[currPhrase + 1] ; i++)
+		{
+			fullScores[currPhrase] += values[i];
+			if (ngrams[i].second - ngrams[i].first == m_nGramOrder)
+				ngramScores[currPhrase] += values[i];
+		}
+	}
+}
+
 void LanguageModel::CalcScoreChart(const Phrase &phrase
 								, float &beginningBitsOnly
 								, float &ngramScore) const
@@ -160,19 +233,76 @@ LanguageModel::State LanguageModel::GetState(const std::vector<const Word*> &con
   return state;
 }
 
+const size_t LanguageModel::MaxNGramOrder;
+
+/** The last n-1 words of a hypothesis, from the oldest to the most recent, padded with <s> at the start of the sentence.
+ *  The words are kept to build the n-grams that cross into the next phrase without walking back the hypotheses.
+ *  Hypotheses are recombined if the IDs of the last words that the LM still looks at are the same,
+ *  which are hashed once when the state is created, and the LM finds the words themselves equal.
+ */
 struct LMState : public FFState {
-	const void* lmstate;
-	LMState(const void* lms) { lmstate = lms; }
+	const LanguageModel *m_lm;
+	const Word *m_words[LanguageModel::MaxNGramOrder - 1];
+	size_t m_ids[LanguageModel::MaxNGramOrder - 1];
+	size_t m_length;
+	size_t m_compareFrom; //! the words before are not used by the following n-grams
+	size_t m_hash;
+
+	LMState(const LanguageModel *lm) : m_lm(lm) {}
+
+	void CalcHash() {
+		UINT64 hash = m_compareFrom;
+		for (size_t i = m_compareFrom; i < m_length; ++i) {
+			hash = (hash ^ m_ids[i]) * 1099511628211ULL;
+			hash ^= hash >> 32;
+		}
+		m_hash = (size_t) hash;
+	}
 	virtual int Compare(const FFState& o) const {
 		const LMState& other = static_cast<const LMState&>(o);
-		if (other.lmstate > lmstate) return 1;
-		else if (other.lmstate < lmstate) return -1;
+		if (m_hash != other.m_hash) return (m_hash < other.m_hash) ? -1 : 1;
+		if (m_compareFrom != other.m_compareFrom) return (m_compareFrom < other.m_compareFrom) ? -1 : 1;
+		for (size_t i = m_compareFrom; i < m_length; ++i)
+			if (m_ids[i] != other.m_ids[i]) return (m_ids[i] < other.m_ids[i]) ? -1 : 1;
+		for (size_t i = m_compareFrom; i < m_length; ++i)
+			if (int comparison = m_lm->CompareContextWords(*m_words[i], *other.m_words[i])) return comparison;
 		return 0;
 	}
+	virtual size_t GetHash() const {
+		return m_hash;
+	}
 };
 
+//! the n-grams that Evaluate() passes to GetValues(), one set for each decoding thread so that they are allocated only once
+struct EvaluateBuffers {
+	vector<const Word*> words;
+	vector<LanguageModel::WordSpan> ngrams;
+	vector<float> values;
+};
+#ifdef WITH_THREADS
+static boost::thread_specific_ptr<EvaluateBuffers> s_evaluateBuffers;
+static EvaluateBuffers &GetEvaluateBuffers() {
+	if (s_evaluateBuffers.get() == NULL)
+		s_evaluateBuffers.reset(new EvaluateBuffers());
+	return *s_evaluateBuffers;
+}
+#else
+static EvaluateBuffers &GetEvaluateBuffers() {
+	static EvaluateBuffers buffers;
+	return buffers;
+}
+#endif
+
 const FFState* LanguageModel::EmptyHypothesisState(const InputType &/*input*/) const {
-	return new LMState(NULL);
+	LMState *state = new LMState(this);
+	state->m_length = (m_nGramOrder > 1) ? m_nGramOrder - 1 : 0;
+	state->m_compareFrom = 0;
+	for (size_t i = 0; i < state->m_length; ++i) {
+		state->m_words[i] = &GetSentenceStartArray();
+		state->m_ids[i] = GetContextId(GetSentenceStartArray());
+	}
+	state->CalcHash();
+	return state;
 }
 
 FFState* LanguageModel::Evaluate(
@@ -188,64 +318,91 @@ FFState* LanguageModel::Evaluate(
 
 	clock_t t=0;
 	IFVERBOSE(2) { t  = clock(); } // track time
-	const void* prevlm = ps ? (static_cast<const LMState *>(ps)->lmstate) : NULL;
-	LMState* res = new LMState(prevlm);
-	if (hypo.GetCurrTargetLength() == 0)
-		return res;
-	const size_t currEndPos = hypo.GetCurrTargetWordsRange().GetEndPos();
-	const size_t startPos = hypo.GetCurrTargetWordsRange().GetStartPos();
-
-	// 1st n-gram
-	vector<const Word*> contextFactor(m_nGramOrder);
-	size_t index = 0;
-	for (int currPos = (int) startPos - (int) m_nGramOrder + 1 ; currPos <= (int) startPos ; currPos++)
+	assert(ps != NULL);
+	const LMState &prev = *static_cast<const LMState *>(ps);
+	const size_t currLength = hypo.GetCurrTargetLength();
+	if (currLength == 0)
+		return new LMState(prev);
+
+	// all the n-grams are looked up with one call to GetValues(), so that a remote LM is asked once per hypothesis
+	const size_t contextLength = m_nGramOrder - 1;
+	EvaluateBuffers &buffers = GetEvaluateBuffers();
+	vector<const Word*> &words = buffers.words;
+	vector<WordSpan> &ngrams = buffers.ngrams;
+	words.clear();
+	ngrams.clear();
+
+	// the n-grams ending in the first n-1 words of the phrase, each made of the context of the previous
+	// hypothesis followed by the words of the phrase, from position i on
+	const size_t scoredLength = std::min(currLength, contextLength);
+	for (size_t j = 0 ; j < contextLength ; j++)
+		words.push_back(prev.m_words[j]);
+	for (size_t i = 0 ; i < scoredLength ; i++)
 	{
-		if (currPos >= 0)
-			contextFactor[index++] = &hypo.GetWord(currPos);
-		else			
-			contextFactor[index++] = &GetSentenceStartArray();
+		words.push_back(&hypo.GetCurrWord(i));
+		ngrams.push_back(WordSpan(i, i + m_nGramOrder));
 	}
-	float lmScore	= GetValue(contextFactor);
-	//cout<<"context factor: "<<GetValue(contextFactor)<<endl;
 
-	// main loop
-	size_t endPos = std::min(startPos + m_nGramOrder - 2
-			, currEndPos);
-	for (size_t currPos = startPos + 1 ; currPos <= endPos ; currPos++)
+	// the last n-1 words, reusing the IDs of those from the previous state
+	LMState* res = new LMState(this);
+	res->m_length = contextLength;
+	for (size_t j = 0 ; j < contextLength ; j++)
 	{
-		// shift all args down 1 place
-		for (size_t i = 0 ; i < m_nGramOrder - 1 ; i++)
-			contextFactor[i] = contextFactor[i + 1];
-
-		// add last factor
-		contextFactor.back() = &hypo.GetWord(currPos);
-
-		lmScore	+= GetValue(contextFactor);
+		size_t i = currLength + j;
+		if (i < contextLength)
+		{
+			res->m_words[j] = prev.m_words[i];
+			res->m_ids[j] = prev.m_ids[i];
+		}
+		else
+		{
+			res->m_words[j] = &hypo.GetCurrWord(i - contextLength);
+			res->m_ids[j] = GetContextId(*res->m_words[j]);
+		}
 	}
 
-	// end of sentence
-	if (hypo.IsSourceCompleted())
+	// the last n-gram gives the len of the new state: the end of sentence,
+	// or else the n-gram ending the phrase if it is longer than the context, which was scored with the translation option
+	const bool endOfSentence = hypo.IsSourceCompleted();
+	if (endOfSentence)
 	{
-		const size_t size = hypo.GetSize();
-		contextFactor.back() = &GetSentenceEndArray();
+		ngrams.push_back(WordSpan(words.size(), words.size() + m_nGramOrder));
+		for (size_t j = 0 ; j < contextLength ; j++)
+			words.push_back(res->m_words[j]);
+		words.push_back(&GetSentenceEndArray());
+	}
+	else if (currLength > contextLength)
+	{
+		ngrams.push_back(WordSpan(words.size(), words.size() + m_nGramOrder));
+		for (size_t i = currLength - m_nGramOrder ; i < currLength ; i++)
+			words.push_back(&hypo.GetCurrWord(i));
+	}
 
-		for (size_t i = 0 ; i < m_nGramOrder - 1 ; i ++)
-		{
-			int currPos = (int)(size - m_nGramOrder + i + 1);
-			if (currPos < 0)
-				contextFactor[i] = &GetSentenceStartArray();
-			else
-				contextFactor[i] = &hypo.GetWord((size_t)currPos);
-		}
-		lmScore	+= GetValue(contextFactor, &res->lmstate);
-	} else {
-		for (size_t currPos = endPos+1; currPos <= currEndPos; currPos++) {
-			for (size_t i = 0 ; i < m_nGramOrder - 1 ; i++)
-				contextFactor[i] = contextFactor[i + 1];
-			contextFactor.back() = &hypo.GetWord(currPos);
+	unsigned int len = m_nGramOrder;
+	vector<float> &values = buffers.values;
+	GetValues(words, ngrams, values, &len);
+	float lmScore = 0;
+	const size_t scoredNGrams = (endOfSentence || currLength <= contextLength) ? ngrams.size() : ngrams.size() - 1;
+	for (size_t i = 0 ; i < scoredNGrams ; i++)
+		lmScore	+= values[i];
+
+	if (endOfSentence)
+	{
+		if (contextLength > 0)
+		{ // a unigram LM keeps no context
+			for (size_t j = 0 ; j + 1 < contextLength ; j++)
+			{
+				res->m_words[j] = res->m_words[j + 1];
+				res->m_ids[j] = res->m_ids[j + 1];
+			}
+			res->m_words[contextLength - 1] = &GetSentenceEndArray();
+			res->m_ids[contextLength - 1] = GetContextId(GetSentenceEndArray());
 		}
-		res->lmstate = GetState(contextFactor);
 	}
+	// only the last len words matter for the following n-grams
+	res->m_compareFrom = (len < contextLength) ? contextLength - len : 0;
+	res->CalcHash();
+
 	out->PlusEquals(this, lmScore);
   IFVERBOSE(2) { hypo.GetManager().GetSentenceStats().AddTimeCalcLM( clock()-t ); }
 	return res;
@@ -62,6 +62,9 @@ public:
 	 */
   typedef const void* State;
 
+	//! highest order whose contexts fit in the states kept with the hypotheses
+	static const size_t MaxNGramOrder = 16;
+
 	virtual ~LanguageModel();
 
 	//! see ScoreProducer.h
@@ -94,7 +97,8 @@ public:
 	 * Specific implementation can return State and len data to be used in hypothesis pruning
 	 * \param contextFactor n-gram to be scored
 	 * \param finalState state used by LM. Return arg
-	 * \param len ???
+	 * \param len number of words at the end of the n-gram that the scores of the following words depend on.
+	 * 			Return arg, left as it is by implementations that don't know it
 	 */
 	virtual float GetValue(const std::vector<const Word*> &contextFactor
 												, State* finalState = 0
@@ -102,6 +106,38 @@ public:
 	//! get State for a particular n-gram
 	State GetState(const std::vector<const Word*> &contextFactor, unsigned int* len = 0) const;
 
+	/* identifies a word by the factors that this LM reads.
+	 * Hypotheses whose last n-1 words have the same IDs are recombined if CompareContextWords() finds them equal too
+	 */
+	virtual size_t GetContextId(const Word &word) const = 0;
+	/* orders two words with the same context ID by the factors that this LM reads.
+	 * The default is for LMs whose context IDs tell the words apart
+	 */
+	virtual int CompareContextWords(const Word &/*word1*/, const Word &/*word2*/) const
+	{
+		return 0;
+	}
+
+	//! the words [first, second) of a batch of n-grams
+	typedef std::pair<size_t, size_t> WordSpan;
+
+	/* scores of many n-grams at once, each given by a span of words like the context of GetValue().
+	 * If lastLen isn't NULL, it gets the len of GetValue() for the last n-gram.
+	 * The default calls GetValue() for each of them. Implementations override it to look the n-grams up
+	 * with less overhead, or to fetch them together
+	 */
+	virtual void GetValues(const std::vector<const Word*> &words
+												, const std::vector<WordSpan> &ngrams
+												, std::vector<float> &values
+												, unsigned int* lastLen = NULL) const;
+
+	/* CalcScore() of many phrases, with all their n-grams scored by one call to GetValues().
+	 * Useable() should be true for all the phrases
+	 */
+	void CalcScores(const std::vector<const Phrase*> &phrases
+								, std::vector<float> &fullScores
+								, std::vector<float> &ngramScores) const;
+
 	//! max n-gram order of LM
 	size_t GetNGramOrder() const
 	{
@@ -42,6 +42,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #endif
 
 #include "LanguageModelInternal.h"
+#include "LanguageModelTrie.h"
 #include "LanguageModelSkip.h"
 #include "LanguageModelJoint.h"
 
@@ -120,6 +121,9 @@ namespace LanguageModelFactory
 					lm = new LanguageModelInternal(true, scoreIndexManager);
 			  #endif
 			  break;
+			case Trie:
+				lm = new LanguageModelTrie(true, scoreIndexManager);
+				break;
 	  }
 
 	  if (lm == NULL)
@@ -147,6 +151,12 @@ namespace LanguageModelFactory
 				}
   			break;
 	  	}
+	  	if (lm != NULL && lm->GetNGramOrder() > LanguageModel::MaxNGramOrder)
+	  	{
+	  		UserMessage::Add("Language models of order above " + SPrint(LanguageModel::MaxNGramOrder) + " are not supported");
+	  		delete lm;
+	  		lm = NULL;
+	  	}
 	  }
 
 	  return lm;
@@ -209,8 +209,7 @@ float LanguageModelIRST::GetValue(const vector<const Word*> &contextFactor, Stat
   
 	if (finalState){        
 		*finalState=(State *)m_lmtb->cmaxsuffptr(*m_lmtb_ng);	
-		// back off stats not currently available
-		*len = 0;	
+		// back off stats not currently available, so len is left as it is
 	}
 
 	float prob = m_lmtb->clprob(*m_lmtb_ng);
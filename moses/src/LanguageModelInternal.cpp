@@ -119,24 +119,47 @@ bool LanguageModelInternal::Load(const std::string &filePath
 
 float LanguageModelInternal::GetValue(const std::vector<const Word*> &contextFactor
 												, State* finalState
-												, unsigned int* /*len*/) const
+												, unsigned int* len) const
 {
 	const size_t ngram = contextFactor.size();
 	switch (ngram)
 	{
-	case 1: return GetValue((*contextFactor[0])[m_factorType], finalState); break;
+	case 1: return GetValue((*contextFactor[0])[m_factorType], finalState, len); break;
 	case 2: return GetValue((*contextFactor[0])[m_factorType]
-												, (*contextFactor[1])[m_factorType], finalState); break;
+												, (*contextFactor[1])[m_factorType], finalState, len); break;
 	case 3: return GetValue((*contextFactor[0])[m_factorType]
 												, (*contextFactor[1])[m_factorType]
-												, (*contextFactor[2])[m_factorType], finalState); break;
+												, (*contextFactor[2])[m_factorType], finalState, len); break;
 	}
 
 	assert (false);
 	return 0;
 }
 
-float LanguageModelInternal::GetValue(const Factor *factor0, State* finalState) const
+void LanguageModelInternal::GetValues(const std::vector<const Word*> &words
+												, const std::vector<WordSpan> &ngrams
+												, std::vector<float> &values
+												, unsigned int* lastLen) const
+{
+	values.resize(ngrams.size());
+	for (size_t i = 0 ; i < ngrams.size() ; ++i)
+	{
+		const Word * const *ngram = &words[ngrams[i].first];
+		unsigned int* len = (i + 1 == ngrams.size()) ? lastLen : NULL;
+		switch (ngrams[i].second - ngrams[i].first)
+		{
+		case 1: values[i] = GetValue((*ngram[0])[m_factorType], NULL, len); break;
+		case 2: values[i] = GetValue((*ngram[0])[m_factorType]
+														, (*ngram[1])[m_factorType], NULL, len); break;
+		case 3: values[i] = GetValue((*ngram[0])[m_factorType]
+														, (*ngram[1])[m_factorType]
+														, (*ngram[2])[m_factorType], NULL, len); break;
+		default: assert (false);
+		}
+	}
+}
+
+float LanguageModelInternal::GetValue(const Factor *factor0, State* finalState, unsigned int* len) const
 {
 	float prob;
 	const NGramNode *nGram		= GetLmID(factor0);
@@ -144,17 +167,21 @@ float LanguageModelInternal::GetValue(const Factor *factor0, State* finalState)
 	{
 		if (finalState != NULL)
 			*finalState = NULL;
+		if (len != NULL)
+			*len = 0;
 		prob = -numeric_limits<float>::infinity();
 	}
 	else
 	{
 		if (finalState != NULL)
 			*finalState = static_cast<const void*>(nGram);
+		if (len != NULL)
+			*len = 1;
 		prob = nGram->GetScore();
 	}
 	return FloorScore(prob);
 }
-float LanguageModelInternal::GetValue(const Factor *factor0, const Factor *factor1, State* finalState) const
+float LanguageModelInternal::GetValue(const Factor *factor0, const Factor *factor1, State* finalState, unsigned int* len) const
 {
 	float score;
 	const NGramNode *nGram[2];
@@ -164,6 +191,8 @@ float LanguageModelInternal::GetValue(const Factor *factor0, const Factor *facto
 	{
 		if (finalState != NULL)
 			*finalState = NULL;
+		if (len != NULL)
+			*len = 0;
 		score = -numeric_limits<float>::infinity();
 	}
 	else
@@ -173,6 +202,8 @@ float LanguageModelInternal::GetValue(const Factor *factor0, const Factor *facto
 		{ // something unigram
 			if (finalState != NULL)
 				*finalState = static_cast<const void*>(nGram[1]);
+			if (len != NULL)
+				*len = 1;
 			
 			nGram[0]	= GetLmID(factor0);
 			if (nGram[0] == NULL)
@@ -188,6 +219,8 @@ float LanguageModelInternal::GetValue(const Factor *factor0, const Factor *facto
 		{ // bigram
 			if (finalState != NULL)
 				*finalState = static_cast<const void*>(nGram[0]);
+			if (len != NULL)
+				*len = 2;
 			score			= nGram[0]->GetScore();
 		}
 	}
@@ -196,7 +229,7 @@ float LanguageModelInternal::GetValue(const Factor *factor0, const Factor *facto
 
 }
 
-float LanguageModelInternal::GetValue(const Factor *factor0, const Factor *factor1, const Factor *factor2, State* finalState) const
+float LanguageModelInternal::GetValue(const Factor *factor0, const Factor *factor1, const Factor *factor2, State* finalState, unsigned int* len) const
 {
 	float score;
 	const NGramNode *nGram[3];
@@ -206,6 +239,8 @@ float LanguageModelInternal::GetValue(const Factor *factor0, const Factor *facto
 	{
 		if (finalState != NULL)
 			*finalState = NULL;
+		if (len != NULL)
+			*len = 0;
 		score = -numeric_limits<float>::infinity();
 	}
 	else
@@ -215,6 +250,8 @@ float LanguageModelInternal::GetValue(const Factor *factor0, const Factor *facto
 		{ // something unigram
 			if (finalState != NULL)
 				*finalState = static_cast<const void*>(nGram[2]);
+			if (len != NULL)
+				*len = 1;
 			
 			nGram[1]	= GetLmID(factor1);
 			if (nGram[1] == NULL)
@@ -241,12 +278,16 @@ float LanguageModelInternal::GetValue(const Factor *factor0, const Factor *facto
 			{ // trigram
 				if (finalState != NULL)
 					*finalState = static_cast<const void*>(nGram[0]);
+				if (len != NULL)
+					*len = 3;
 				score = nGram[0]->GetScore();
 			}
 			else
 			{
 				if (finalState != NULL)
 					*finalState = static_cast<const void*>(nGram[1]);
+				if (len != NULL)
+					*len = 2;
 				
 				score			= nGram[1]->GetScore();
 				nGram[1]	= nGram[1]->GetRootNGram();
@@ -21,9 +21,10 @@ protected:
 		return ( factorId >= m_lmIdLookup.size()) ? NULL : m_lmIdLookup[factorId];        
   };
 
-	float GetValue(const Factor *factor0, State* finalState) const;
-	float GetValue(const Factor *factor0, const Factor *factor1, State* finalState) const;
-	float GetValue(const Factor *factor0, const Factor *factor1, const Factor *factor2, State* finalState) const;
+	//! len gets the order of the n-gram returned as finalState, 0 for an unknown last word
+	float GetValue(const Factor *factor0, State* finalState, unsigned int* len = NULL) const;
+	float GetValue(const Factor *factor0, const Factor *factor1, State* finalState, unsigned int* len = NULL) const;
+	float GetValue(const Factor *factor0, const Factor *factor1, const Factor *factor2, State* finalState, unsigned int* len = NULL) const;
 
 public:
 	LanguageModelInternal(bool registerScore, ScoreIndexManager &scoreIndexManager);
@@ -34,6 +35,10 @@ public:
 	float GetValue(const std::vector<const Word*> &contextFactor
 												, State* finalState = 0
 												, unsigned int* len = 0) const;
+	void GetValues(const std::vector<const Word*> &words
+												, const std::vector<WordSpan> &ngrams
+												, std::vector<float> &values
+												, unsigned int* lastLen = NULL) const;
 };
 
 }
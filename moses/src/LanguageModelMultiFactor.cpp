@@ -52,5 +52,37 @@ bool LanguageModelMultiFactor::Useable(const Phrase &phrase) const
 
 }
 
+size_t LanguageModelMultiFactor::GetContextId(const Word &word) const
+{
+	// the IDs of the factors, mixed into one
+	UINT64 id = 0;
+	for (size_t currFactor = 0 ; currFactor < MAX_NUM_FACTORS ; ++currFactor)
+	{
+		if (m_factorTypes[currFactor])
+		{
+			const Factor *factor = word[currFactor];
+			id = (id + (factor == NULL ? 0 : factor->GetId() + 1)) * 0x9e3779b97f4a7c15ULL;
+			id ^= id >> 29;
+		}
+	}
+	return (size_t) id;
+}
+
+int LanguageModelMultiFactor::CompareContextWords(const Word &word1, const Word &word2) const
+{
+	// the IDs of several factors mixed into one can collide
+	for (size_t currFactor = 0 ; currFactor < MAX_NUM_FACTORS ; ++currFactor)
+	{
+		if (m_factorTypes[currFactor])
+		{
+			const Factor *factor1 = word1[currFactor]
+									,*factor2 = word2[currFactor];
+			if (factor1 != factor2)
+				return (factor1 < factor2) ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
 }
 
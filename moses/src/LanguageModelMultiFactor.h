@@ -54,6 +54,8 @@ public:
 
 	std::string GetScoreProducerDescription() const;	
 	bool Useable(const Phrase &phrase) const;	
+	size_t GetContextId(const Word &word) const;
+	int CompareContextWords(const Word &word1, const Word &word2) const;
 };
 
 }
@@ -6,16 +6,28 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <errno.h>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <sstream>
 #include "LanguageModelRemote.h"
 #include "Factor.h"
+#include "FactorCollection.h"
+#include "StaticData.h"
+#include "Util.h"
 
 namespace Moses {
 
 const Factor* LanguageModelRemote::BOS = NULL;
 const Factor* LanguageModelRemote::EOS = (LanguageModelRemote::BOS + 1);
+const size_t LanguageModelRemote::BatchSize;
+const size_t LanguageModelRemote::MaxPendingBatches;
+const size_t LanguageModelRemote::DefaultCacheMegabytes;
 
 LanguageModelRemote::LanguageModelRemote(bool registerScore, ScoreIndexManager &scoreIndexManager) 
 :LanguageModelSingleFactor(registerScore, scoreIndexManager)
+,m_cache(DefaultCacheMegabytes << 20)
 {
 }
 
@@ -32,11 +44,21 @@ bool LanguageModelRemote::Load(const std::string &filePath
 	std::string host = filePath.substr(0,cutAt);
         //std::cerr << "port string = '" << filePath.substr(cutAt+1,filePath.size()-cutAt) << "'\n";
 	int port = atoi(filePath.substr(cutAt+1,filePath.size()-cutAt).c_str());
+	size_t cutCacheAt = filePath.find(':',cutAt+1);
+	if (cutCacheAt != std::string::npos)
+		m_cache.SetMaxBytes(Scan<size_t>(filePath.substr(cutCacheAt+1)) << 20);
+
+	// make sure start & end tags in factor collection, so that they don't match every word
+	FactorCollection &factorCollection = FactorCollection::Instance();
+	m_sentenceStart	= factorCollection.AddFactor(Output, m_factorType, BOS_);
+	m_sentenceStartArray[m_factorType] = m_sentenceStart;
+	m_sentenceEnd		= factorCollection.AddFactor(Output, m_factorType, EOS_);
+	m_sentenceEndArray[m_factorType] = m_sentenceEnd;
+
 	bool good = start(host,port);
 	if (!good) {
 		std::cerr << "failed to connect to lm server on " << host << " on port " << port << std::endl;
 	}
-	ClearSentenceCache();
 	return good;
 }
 
@@ -62,76 +84,159 @@ bool LanguageModelRemote::start(const std::string& host, int port) {
   return true;
 }
 
-float LanguageModelRemote::GetValue(const std::vector<const Word*> &contextFactor, State* finalState, unsigned int* len) const {
-  size_t count = contextFactor.size();
-  if (count == 0) {
-    if (finalState) *finalState = NULL;
-    return 0;
-  }
-  //std::cerr << "contextFactor.size() = " << count << "\n";
-  size_t max = m_nGramOrder;
+void LanguageModelRemote::GetKey(const Word* const* contextFactor, size_t count, NGramCache::Key &key) const {
   const FactorType factor = GetFactorType();
-  if (max > count) max = count;
- 
-  Cache* cur = &m_cache;
-  int pc = static_cast<int>(count) - 1;
-  for (int i = 0; i < pc; ++i) {
+  size_t begin = (count > m_nGramOrder) ? count - m_nGramOrder : 0;
+  key.clear();
+  for (size_t i = begin; i < count - 1; ++i) {
     const Factor* f = contextFactor[i]->GetFactor(factor);
-    cur = &cur->tree[f ? f : BOS];
-  }
-  const Factor* event_word = contextFactor[pc]->GetFactor(factor);
-  cur = &cur->tree[event_word ? event_word : EOS];
-  if (cur->prob) {
-    if (finalState) *finalState = cur->boState;
-    if (len) *len = m_nGramOrder;
-    return cur->prob;
-  }
-  cur->boState = *reinterpret_cast<const State*>(&m_curId);
-  ++m_curId;
-
-  std::ostringstream os;
-  os << "prob ";
-  if (event_word == NULL) {
-	os << "</s>";
-  } else {
-	os << event_word->GetString();
+    key.push_back(f ? f : BOS);
   }
+  const Factor* event_word = contextFactor[count-1]->GetFactor(factor);
+  key.push_back(event_word ? event_word : EOS);
+}
+
+LanguageModelSingleFactor::State LanguageModelRemote::GetState(const std::vector<const Word*> &contextFactor) const {
+  NGramCache::Key key;
+  GetKey(&contextFactor[0], contextFactor.size(), key);
+  if (key.size() >= m_nGramOrder)
+    key.erase(key.begin());
+  size_t hash = NGramCache::Hash(key);
+  return reinterpret_cast<State>(hash ? hash : 1);
+}
+
+void LanguageModelRemote::MakeQuery(const Word* const* contextFactor, size_t count, Query &query) const {
+  const FactorType factor = GetFactorType();
+  size_t max = query.key.size();
+
+  std::string &ngram = query.ngram;
+  const Factor* event_word = contextFactor[count-1]->GetFactor(factor);
+  ngram = (event_word == NULL) ? "</s>" : event_word->GetString();
   for (size_t i=1; i<max; i++) {
-        const Factor* f = contextFactor[count-1-i]->GetFactor(factor);
-	if (f == NULL) {
-		os << " <s>";
-	} else {
-		os << ' ' << f->GetString();
-	}
+    const Factor* f = contextFactor[count-1-i]->GetFactor(factor);
+    ngram += ' ';
+    ngram += (f == NULL) ? "<s>" : f->GetString();
   }
-  os << std::endl;
-  std::string out = os.str();
-  write(sock, out.c_str(), out.size());
-  char res[6];
-  int r = read(sock, res, 6);
-  int errors = 0;
-  int cnt = 0;
-  while (1) {
-      if (r < 0) {
-        errors++; sleep(1);
-        //std::cerr << "Error: read()\n";
-        if (errors > 5) exit(1);
-        } else if (r==0 || res[cnt] == '\n') { break; }
-      else {
-        cnt += r;
-        if (cnt==6) break;
-        read(sock, &res[cnt], 6-cnt);
+  ngram += '\n';
+  query.hash = NGramCache::Hash(query.key);
+}
+
+void LanguageModelRemote::SendQueries(const std::vector<Query> &queries, std::vector<float> &answers) const {
+  answers.resize(queries.size());
+  if (queries.empty()) return;
+#ifdef WITH_THREADS
+  boost::mutex::scoped_lock lock(m_socketMutex);
+#endif
+  const size_t batches = (queries.size() + BatchSize - 1) / BatchSize;
+  size_t sent = 0, answered = 0;
+  while (answered < batches) {
+    if (sent < batches && sent - answered < MaxPendingBatches) {
+      size_t begin = sent * BatchSize, end = std::min(begin + BatchSize, queries.size());
+      std::ostringstream os;
+      os << "probs " << end - begin << '\n';
+      for (size_t i = begin; i < end; ++i)
+        os << queries[i].ngram;
+      std::string out = os.str();
+      WriteAll(out.c_str(), out.size());
+      ++sent;
+    } else {
+      size_t begin = answered * BatchSize, end = std::min(begin + BatchSize, queries.size());
+      ReadAll(reinterpret_cast<char*>(&answers[begin]), (end - begin) * sizeof(float));
+      for (size_t i = begin; i < end; ++i) {
+        answers[i] = FloorScore(TransformLMScore(answers[i]));
+        m_cache.Insert(queries[i].key, queries[i].hash, answers[i]);
       }
+      ++answered;
+    }
+  }
+}
+
+void LanguageModelRemote::WriteAll(const char* data, size_t size) const {
+  while (size > 0) {
+    ssize_t w = write(sock, data, size);
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) {
+      perror("Error: write() to the lm server");
+      exit(1);
+    }
+    data += w;
+    size -= w;
+  }
+}
+
+void LanguageModelRemote::ReadAll(char* data, size_t size) const {
+  while (size > 0) {
+    ssize_t r = read(sock, data, size);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) {
+      if (r == 0) std::cerr << "Error: the lm server closed the connection\n";
+      else perror("Error: read() from the lm server");
+      exit(1);
+    }
+    data += r;
+    size -= r;
+  }
+}
+
+float LanguageModelRemote::GetValue(const std::vector<const Word*> &contextFactor, State* finalState, unsigned int* len) const {
+  size_t count = contextFactor.size();
+  if (count == 0) {
+    if (finalState) *finalState = NULL;
+    return 0;
+  }
+  std::vector<Query> queries(1);
+  Query &query = queries.back();
+  GetKey(&contextFactor[0], count, query.key);
+  query.hash = NGramCache::Hash(query.key);
+  float prob;
+  if (!m_cache.Find(query.key, query.hash, prob)) {
+    MakeQuery(&contextFactor[0], count, query);
+    std::vector<float> answers;
+    SendQueries(queries, answers);
+    prob = answers[0];
   }
-  cur->prob = FloorScore(TransformLMScore(*reinterpret_cast<float*>(res)));
   if (finalState) {
-    *finalState = cur->boState;
+    *finalState = GetState(contextFactor);
     if (len) *len = m_nGramOrder;
   }
-  return cur->prob;
+  return prob;
+}
+
+void LanguageModelRemote::GetValues(const std::vector<const Word*> &words, const std::vector<WordSpan> &ngrams, std::vector<float> &values, unsigned int* lastLen) const {
+  // the server doesn't tell how much of the context it used, as in GetValue()
+  if (lastLen) *lastLen = m_nGramOrder;
+  // the n-grams that are not in the cache are requested once each
+  std::vector<Query> queries;
+  std::map<NGramCache::Key, size_t> queried;
+  std::vector<size_t> queryIndex(ngrams.size(), NOT_FOUND);
+  values.assign(ngrams.size(), 0);
+  Query query;
+  for (size_t i = 0; i < ngrams.size(); ++i) {
+    const size_t count = ngrams[i].second - ngrams[i].first;
+    if (count == 0) continue;
+    GetKey(&words[ngrams[i].first], count, query.key);
+    query.hash = NGramCache::Hash(query.key);
+    if (m_cache.Find(query.key, query.hash, values[i])) continue;
+    std::map<NGramCache::Key, size_t>::const_iterator found = queried.find(query.key);
+    if (found != queried.end()) {
+      queryIndex[i] = found->second;
+      continue;
+    }
+    queryIndex[i] = queries.size();
+    queried[query.key] = queries.size();
+    MakeQuery(&words[ngrams[i].first], count, query);
+    queries.push_back(query);
+  }
+  std::vector<float> answers;
+  SendQueries(queries, answers);
+  for (size_t i = 0; i < ngrams.size(); ++i)
+    if (queryIndex[i] != NOT_FOUND)
+      values[i] = answers[queryIndex[i]];
 }
 
 LanguageModelRemote::~LanguageModelRemote() {
+  VERBOSE(1, "Remote LM cache: " << m_cache.GetHits() << " hits, " << m_cache.GetMisses() << " misses, "
+          << m_cache.GetEvictions() << " evictions, " << m_cache.GetSize() << " n-grams in " << m_cache.GetBytes() << " bytes" << std::endl);
   // Step 8 When finished send all lingering transmissions and close the connection
   close(sock); 
 }
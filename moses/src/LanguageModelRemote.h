@@ -4,6 +4,7 @@
 #include "LanguageModelSingleFactor.h"
 #include "TypeDef.h"
 #include "Factor.h"
+#include "NGramCache.h"
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
@@ -11,28 +12,54 @@
 namespace Moses
 {
 
+/** LM queried over TCP from a server given as host:port, e.g. misc/languageModelServer.
+ *  The queries are sent in batches: "probs N\n", followed by N lines with the words of an n-gram,
+ *  starting with the predicted word and followed by its context from the closest word backwards.
+ *  The server answers each batch with the N log10 probabilities as 4-byte floats, in the same order.
+ *  Several batches are sent before their answers are read.
+ *  The scores are kept in a cache shared by all decoder threads, limited by default to 256 MB;
+ *  another limit can be given in megabytes after the port, as in host:port:megabytes.
+ */
 class LanguageModelRemote : public LanguageModelSingleFactor {
 	private:
-		struct Cache {
-			std::map<const Factor*, Cache> tree;
-			float prob;
-			State boState;
-			Cache() : prob(0) {}
+		//! an n-gram as sent to the server, and where its score goes in the cache
+		struct Query {
+			std::string ngram;
+			NGramCache::Key key;
+			size_t hash;
 		};
+		static const size_t BatchSize = 256; //! n-grams per request
+		static const size_t MaxPendingBatches = 4; //! requests sent before their answers are read
+		static const size_t DefaultCacheMegabytes = 256;
 
 		int sock, port;
 		struct hostent *hp;
 		struct sockaddr_in server;
-		mutable size_t m_curId;
-		mutable Cache m_cache;
+		mutable NGramCache m_cache;
+#ifdef WITH_THREADS
+		mutable boost::mutex m_socketMutex; //! one request and its answer at a time
+#endif
                 bool start(const std::string& host, int port);
 		static const Factor* BOS;
 		static const Factor* EOS;
+
+		//! the last words of the n-gram that the server looks at
+		void GetKey(const Word* const* contextFactor, size_t count, NGramCache::Key &key) const;
+		//! the context that the n-gram leaves for the next word, as a non-NULL hash
+		State GetState(const std::vector<const Word*> &contextFactor) const;
+		//! the query of the n-gram, whose key is already set
+		void MakeQuery(const Word* const* contextFactor, size_t count, Query &query) const;
+		//! sends the queries in pipelined batches, returns their scores and stores them in the cache
+		void SendQueries(const std::vector<Query> &queries, std::vector<float> &answers) const;
+		void WriteAll(const char* data, size_t size) const;
+		void ReadAll(char* data, size_t size) const;
 	public:
 		LanguageModelRemote(bool registerScore, ScoreIndexManager &scoreIndexManager);
 		~LanguageModelRemote();
-		void ClearSentenceCache() { m_cache.tree.clear(); m_curId = 1000; }
+		const NGramCache& GetCache() const { return m_cache; }
 		virtual float GetValue(const std::vector<const Word*> &contextFactor, State* finalState = 0, unsigned int* len = 0) const;
+		//! requests the n-grams that are not in the cache, with one round trip for each BatchSize of them
+		void GetValues(const std::vector<const Word*> &words, const std::vector<WordSpan> &ngrams, std::vector<float> &values, unsigned int* lastLen = NULL) const;
         	bool Load(const std::string &filePath
                                         , FactorType factorType
                                         , float weight
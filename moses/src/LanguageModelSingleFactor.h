@@ -71,6 +71,11 @@ public:
 	{
 		return m_factorType;
 	}
+	size_t GetContextId(const Word &word) const
+	{
+		const Factor *factor = word[m_factorType];
+		return (factor == NULL) ? 0 : factor->GetId() + 1;
+	}
 	float GetWeight() const
 	{
 		return m_weight;
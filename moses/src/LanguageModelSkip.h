@@ -114,8 +114,8 @@ public:
 		// create context factor the right way round
 		std::reverse(chunkContext.begin(), chunkContext.end());
 
-		// calc score on chunked phrase
-		float ret = m_lmImpl->GetValue(chunkContext, finalState, len);
+		// calc score on chunked phrase. The length of the context used by the chunked LM isn't known in words of the phrase
+		float ret = m_lmImpl->GetValue(chunkContext, finalState);
 
 		RemoveAllInColl(chunkContext);
 
@@ -0,0 +1,108 @@
+/*
+ *  LanguageModelTrie.cpp
+ *  Moses
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ */
+
+#include "LanguageModelTrie.h"
+#include "FactorCollection.h"
+#include "StaticData.h"
+#include "UserMessage.h"
+
+using namespace std;
+
+namespace Moses
+{
+LanguageModelTrie::LanguageModelTrie(bool registerScore, ScoreIndexManager &scoreIndexManager)
+:LanguageModelSingleFactor(registerScore, scoreIndexManager)
+{
+}
+
+bool LanguageModelTrie::Load(const std::string &filePath
+															, FactorType factorType
+															, float weight
+															, size_t nGramOrder)
+{
+	m_filePath		= filePath;
+	m_factorType	= factorType;
+	m_weight			= weight;
+	m_nGramOrder	= nGramOrder;
+
+	if (NGramTrie::IsBinary(filePath))
+	{
+		VERBOSE(1, "Mapping binary LM: " << filePath << endl);
+		if (!m_trie.Load(filePath))
+			return false;
+	}
+	else
+	{
+		VERBOSE(1, "Loading ARPA LM: " << filePath << endl);
+		if (!m_trie.ReadARPA(filePath))
+			return false;
+	}
+	if (m_trie.GetOrder() < m_nGramOrder)
+		VERBOSE(1, "The LM is a " << m_trie.GetOrder() << "-gram model" << endl);
+
+	FactorCollection &factorCollection = FactorCollection::Instance();
+
+	// make sure start & end tags in factor collection
+	m_sentenceStart	= factorCollection.AddFactor(Output, m_factorType, BOS_);
+	m_sentenceStartArray[m_factorType] = m_sentenceStart;
+
+	m_sentenceEnd		= factorCollection.AddFactor(Output, m_factorType, EOS_);
+	m_sentenceEndArray[m_factorType] = m_sentenceEnd;
+
+	// the words that are not in the LM are <unk>
+	for (NGramTrie::WordId id = 0; id < m_trie.GetVocabularySize(); ++id)
+	{
+		size_t factorId = factorCollection.AddFactor(Output, m_factorType, m_trie.GetWord(id))->GetId();
+		if (factorId >= m_lmIdLookup.size())
+			m_lmIdLookup.resize(factorId + 1, m_trie.GetUnknownId());
+		m_lmIdLookup[factorId] = id;
+	}
+
+	return true;
+}
+
+float LanguageModelTrie::GetValue(const std::vector<const Word*> &contextFactor
+																		, State* finalState
+																		, unsigned int* len) const
+{
+	const size_t count = min(contextFactor.size(), m_trie.GetOrder());
+	NGramTrie::WordId reversedWords[NGramTrie::MaxOrder];
+	for (size_t i = 0 ; i < count ; ++i)
+		reversedWords[i] = GetLmID((*contextFactor[contextFactor.size() - 1 - i])[m_factorType]);
+
+	size_t matchedLength;
+	UINT64 state;
+	float prob = m_trie.GetProb(reversedWords, count, matchedLength, state);
+	if (finalState != NULL)
+		*finalState = reinterpret_cast<State>(static_cast<size_t>(state));
+	if (len != NULL)
+		*len = matchedLength;
+	return FloorScore(prob);
+}
+
+void LanguageModelTrie::GetValues(const std::vector<const Word*> &words
+																		, const std::vector<WordSpan> &ngrams
+																		, std::vector<float> &values
+																		, unsigned int* lastLen) const
+{
+	values.resize(ngrams.size());
+	NGramTrie::WordId reversedWords[NGramTrie::MaxOrder];
+	size_t matchedLength;
+	UINT64 state;
+	for (size_t i = 0 ; i < ngrams.size() ; ++i)
+	{
+		const size_t count = min(ngrams[i].second - ngrams[i].first, m_trie.GetOrder());
+		for (size_t j = 0 ; j < count ; ++j)
+			reversedWords[j] = GetLmID((*words[ngrams[i].second - 1 - j])[m_factorType]);
+		values[i] = FloorScore(m_trie.GetProb(reversedWords, count, matchedLength, state));
+	}
+	if (lastLen != NULL && !ngrams.empty())
+		*lastLen = matchedLength;
+}
+
+}
@@ -0,0 +1,54 @@
+/*
+ *  LanguageModelTrie.h
+ *  Moses
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ */
+
+#ifndef moses_LanguageModelTrie_h
+#define moses_LanguageModelTrie_h
+
+#include <vector>
+
+#include "LanguageModelSingleFactor.h"
+#include "NGramTrie.h"
+
+namespace Moses
+{
+
+/** LM of any order that needs neither SRI nor IRST. Reads ARPA files, or binary files written by processLanguageModel,
+ *  which are mapped into memory instead of being parsed.
+ */
+class LanguageModelTrie : public LanguageModelSingleFactor
+{
+protected:
+	NGramTrie m_trie;
+	std::vector<NGramTrie::WordId> m_lmIdLookup;
+
+	NGramTrie::WordId GetLmID(const Factor *factor) const
+	{
+		if (factor == NULL)
+			return NGramTrie::NotFound;
+		size_t factorId = factor->GetId();
+		return (factorId >= m_lmIdLookup.size()) ? m_trie.GetUnknownId() : m_lmIdLookup[factorId];
+	}
+
+public:
+	LanguageModelTrie(bool registerScore, ScoreIndexManager &scoreIndexManager);
+	bool Load(const std::string &filePath
+					, FactorType factorType
+					, float weight
+					, size_t nGramOrder);
+	float GetValue(const std::vector<const Word*> &contextFactor
+												, State* finalState = 0
+												, unsigned int* len = 0) const;
+	void GetValues(const std::vector<const Word*> &words
+												, const std::vector<WordSpan> &ngrams
+												, std::vector<float> &values
+												, unsigned int* lastLen = NULL) const;
+};
+
+}
+
+#endif
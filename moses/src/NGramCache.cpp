@@ -0,0 +1,215 @@
+/*
+ *  NGramCache.cpp
+ *  Moses
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ */
+
+#include "NGramCache.h"
+
+#ifdef WITH_THREADS
+#define LOCK_SHARD(shard) boost::mutex::scoped_lock lock((shard).mutex)
+#else
+#define LOCK_SHARD(shard)
+#endif
+
+namespace Moses
+{
+
+const size_t NGramCache::ShardCount;
+
+size_t NGramCache::Hash(const Key &key)
+{
+	// FNV-1a over the factor pointers, with a final mix so that the low bits used for the shards depend on all of them
+	UINT64 hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < key.size(); ++i)
+	{
+		hash ^= (UINT64) (size_t) key[i];
+		hash *= 1099511628211ULL;
+	}
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	return (size_t) hash;
+}
+
+NGramCache::NGramCache(size_t maxBytes)
+{
+	SetMaxBytes(maxBytes);
+}
+
+NGramCache::~NGramCache()
+{
+	for (size_t i = 0; i < ShardCount; ++i)
+		ClearShard(m_shards[i]);
+}
+
+void NGramCache::Unlink(Shard &shard, Entry *entry)
+{
+	(entry->newer ? entry->newer->older : shard.newest) = entry->older;
+	(entry->older ? entry->older->newer : shard.oldest) = entry->newer;
+}
+
+void NGramCache::PushNewest(Shard &shard, Entry *entry)
+{
+	entry->newer = NULL;
+	entry->older = shard.newest;
+	(shard.newest ? shard.newest->newer : shard.oldest) = entry;
+	shard.newest = entry;
+}
+
+void NGramCache::Remove(Shard &shard, Entry *entry)
+{
+	Entry **link = &GetBucket(shard, entry->hash);
+	while (*link != entry)
+		link = &(*link)->nextInBucket;
+	*link = entry->nextInBucket;
+	Unlink(shard, entry);
+	--shard.size;
+	shard.bytes -= EntryBytes(entry);
+	delete entry;
+}
+
+void NGramCache::Grow(Shard &shard)
+{
+	std::vector<Entry*> buckets(shard.buckets.size() * 2, static_cast<Entry*>(NULL));
+	buckets.swap(shard.buckets);
+	for (size_t i = 0; i < buckets.size(); ++i)
+		for (Entry *entry = buckets[i], *next; entry != NULL; entry = next)
+		{
+			next = entry->nextInBucket;
+			Entry *&bucket = GetBucket(shard, entry->hash);
+			entry->nextInBucket = bucket;
+			bucket = entry;
+		}
+}
+
+void NGramCache::ClearShard(Shard &shard)
+{
+	for (Entry *entry = shard.newest, *older; entry != NULL; entry = older)
+	{
+		older = entry->older;
+		delete entry;
+	}
+	std::vector<Entry*>(16, static_cast<Entry*>(NULL)).swap(shard.buckets);
+	shard.newest = shard.oldest = NULL;
+	shard.size = shard.bytes = 0;
+}
+
+bool NGramCache::Find(const Key &key, size_t hash, float &value)
+{
+	Shard &shard = GetShard(m_shards, hash);
+	LOCK_SHARD(shard);
+	for (Entry *entry = GetBucket(shard, hash); entry != NULL; entry = entry->nextInBucket)
+		if (entry->hash == hash && entry->key == key)
+		{
+			Unlink(shard, entry);
+			PushNewest(shard, entry);
+			value = entry->value;
+			++shard.hits;
+			return true;
+		}
+	++shard.misses;
+	return false;
+}
+
+void NGramCache::Insert(const Key &key, size_t hash, float value)
+{
+	Shard &shard = GetShard(m_shards, hash);
+	LOCK_SHARD(shard);
+	Entry *&bucket = GetBucket(shard, hash);
+	for (Entry *entry = bucket; entry != NULL; entry = entry->nextInBucket)
+		if (entry->hash == hash && entry->key == key)
+		{
+			// another thread has requested the same n-gram
+			entry->value = value;
+			Unlink(shard, entry);
+			PushNewest(shard, entry);
+			return;
+		}
+
+	Entry *entry = new Entry;
+	entry->key = key;
+	entry->hash = hash;
+	entry->value = value;
+	entry->nextInBucket = bucket;
+	bucket = entry;
+	PushNewest(shard, entry);
+	++shard.size;
+	shard.bytes += EntryBytes(entry);
+
+	while (shard.bytes > m_maxShardBytes && shard.oldest != entry)
+	{
+		Remove(shard, shard.oldest);
+		++shard.evictions;
+	}
+	if (shard.size > shard.buckets.size())
+		Grow(shard);
+}
+
+void NGramCache::Clear()
+{
+	for (size_t i = 0; i < ShardCount; ++i)
+	{
+		LOCK_SHARD(m_shards[i]);
+		ClearShard(m_shards[i]);
+	}
+}
+
+UINT64 NGramCache::GetHits() const
+{
+	UINT64 total = 0;
+	for (size_t i = 0; i < ShardCount; ++i)
+	{
+		LOCK_SHARD(m_shards[i]);
+		total += m_shards[i].hits;
+	}
+	return total;
+}
+
+UINT64 NGramCache::GetMisses() const
+{
+	UINT64 total = 0;
+	for (size_t i = 0; i < ShardCount; ++i)
+	{
+		LOCK_SHARD(m_shards[i]);
+		total += m_shards[i].misses;
+	}
+	return total;
+}
+
+UINT64 NGramCache::GetEvictions() const
+{
+	UINT64 total = 0;
+	for (size_t i = 0; i < ShardCount; ++i)
+	{
+		LOCK_SHARD(m_shards[i]);
+		total += m_shards[i].evictions;
+	}
+	return total;
+}
+
+size_t NGramCache::GetSize() const
+{
+	size_t total = 0;
+	for (size_t i = 0; i < ShardCount; ++i)
+	{
+		LOCK_SHARD(m_shards[i]);
+		total += m_shards[i].size;
+	}
+	return total;
+}
+
+size_t NGramCache::GetBytes() const
+{
+	size_t total = 0;
+	for (size_t i = 0; i < ShardCount; ++i)
+	{
+		LOCK_SHARD(m_shards[i]);
+		total += m_shards[i].bytes;
+	}
+	return total;
+}
+
+}
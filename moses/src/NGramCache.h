@@ -0,0 +1,109 @@
+/*
+ *  NGramCache.h
+ *  Moses
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ */
+
+#ifndef moses_NGramCache_h
+#define moses_NGramCache_h
+
+#include <vector>
+
+#ifdef WITH_THREADS
+#include <boost/thread/mutex.hpp>
+#endif
+
+#include "TypeDef.h"
+
+namespace Moses
+{
+
+class Factor;
+
+/** Scores of n-grams, limited to about a given number of bytes by dropping the least recently used n-grams.
+ *  The n-grams are spread by their hash over shards, each with its own hash table, LRU list and lock,
+ *  so that decoder threads sharing the cache rarely wait for each other.
+ */
+class NGramCache
+{
+public:
+	typedef std::vector<const Factor*> Key;
+
+	//! hash of the n-gram, to be passed to Find() and Insert()
+	static size_t Hash(const Key &key);
+
+	NGramCache(size_t maxBytes);
+	~NGramCache();
+
+	//! changes the memory limit; n-grams are dropped by the next insertions if the cache is above it
+	void SetMaxBytes(size_t maxBytes)
+	{
+		m_maxShardBytes = maxBytes / ShardCount;
+	}
+	//! looks up the score of the n-gram and marks it as recently used
+	bool Find(const Key &key, size_t hash, float &value);
+	//! adds the score of the n-gram, or replaces it, dropping the least recently used n-grams of its shard if needed
+	void Insert(const Key &key, size_t hash, float value);
+	void Clear();
+
+	UINT64 GetHits() const;
+	UINT64 GetMisses() const;
+	UINT64 GetEvictions() const;
+	size_t GetSize() const;
+	//! approximate memory used by the n-grams
+	size_t GetBytes() const;
+
+protected:
+	static const size_t ShardCount = 64;
+
+	struct Entry
+	{
+		Key key;
+		size_t hash;
+		float value;
+		Entry *nextInBucket;
+		Entry *newer, *older; //! neighbours in the LRU list of the shard
+	};
+	struct Shard
+	{
+#ifdef WITH_THREADS
+		mutable boost::mutex mutex;
+#endif
+		std::vector<Entry*> buckets; //! a power of 2 long
+		Entry *newest, *oldest;
+		size_t size, bytes;
+		UINT64 hits, misses, evictions;
+		Shard() : buckets(16, static_cast<Entry*>(NULL)), newest(NULL), oldest(NULL), size(0), bytes(0), hits(0), misses(0), evictions(0) {}
+	};
+
+	Shard m_shards[ShardCount];
+	size_t m_maxShardBytes;
+
+	static size_t EntryBytes(const Entry *entry)
+	{
+		return sizeof(Entry) + entry->key.capacity() * sizeof(const Factor*) + sizeof(Entry*);
+	}
+	static Shard &GetShard(Shard *shards, size_t hash)
+	{
+		return shards[hash % ShardCount];
+	}
+	static Entry *&GetBucket(Shard &shard, size_t hash)
+	{
+		return shard.buckets[(hash / ShardCount) & (shard.buckets.size() - 1)];
+	}
+	static void Unlink(Shard &shard, Entry *entry);
+	static void PushNewest(Shard &shard, Entry *entry);
+	static void Remove(Shard &shard, Entry *entry);
+	static void Grow(Shard &shard);
+	static void ClearShard(Shard &shard);
+
+private:
+	NGramCache(const NGramCache&);
+	NGramCache &operator=(const NGramCache&);
+};
+
+}
+
+#endif
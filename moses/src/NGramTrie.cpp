@@ -0,0 +1,685 @@
+/*
+ *  NGramTrie.cpp
+ *  Moses
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "NGramTrie.h"
+#include "InputFileStream.h"
+#include "UserMessage.h"
+#include "Util.h"
+
+using namespace std;
+
+namespace Moses
+{
+
+const NGramTrie::WordId NGramTrie::NotFound = 0xFFFFFFFF;
+const UINT64 NGramTrie::NoRecord = ~UINT64(0);
+const size_t NGramTrie::MaxOrder;
+
+static const char BinaryMagic[8] = {'M', 'o', 's', 'e', 's', 'L', 'M', '\0'};
+static const UINT64 BinaryVersion = 1;
+
+////////////////////////////////////////////////////////////
+//
+// building the arrays from an ARPA file
+//
+////////////////////////////////////////////////////////////
+
+// The n-grams of one order while building, with their words from the last to the first
+struct NGramLevel
+{
+	size_t n;
+	vector<NGramTrie::WordId> words;
+	vector<float> probs, backoffs;
+
+	NGramLevel(size_t order) : n(order) {}
+
+	size_t Size() const
+	{
+		return probs.size();
+	}
+	const NGramTrie::WordId *Key(size_t i) const
+	{
+		return &words[i * n];
+	}
+	void Add(const NGramTrie::WordId *key, float prob, float backoff)
+	{
+		words.insert(words.end(), key, key + n);
+		probs.push_back(prob);
+		backoffs.push_back(backoff);
+	}
+	//! the n-gram with the given key of length n among the first size ones, or size if there is none
+	size_t Find(const NGramTrie::WordId *key, size_t size) const;
+	//! sorts the n-grams by their keys and keeps only the first one of several with the same key
+	void Sort();
+};
+
+struct NGramKeyLess
+{
+	const NGramLevel &level;
+	NGramKeyLess(const NGramLevel &l) : level(l) {}
+	bool operator()(size_t a, size_t b) const
+	{
+		return lexicographical_compare(level.Key(a), level.Key(a) + level.n, level.Key(b), level.Key(b) + level.n);
+	}
+};
+
+size_t NGramLevel::Find(const NGramTrie::WordId *key, size_t size) const
+{
+	size_t begin = 0, end = size;
+	while (begin < end)
+	{
+		size_t middle = (begin + end) / 2;
+		if (lexicographical_compare(Key(middle), Key(middle) + n, key, key + n))
+			begin = middle + 1;
+		else
+			end = middle;
+	}
+	return (begin < size && equal(key, key + n, Key(begin))) ? begin : size;
+}
+
+void NGramLevel::Sort()
+{
+	vector<size_t> index(Size());
+	for (size_t i = 0; i < index.size(); ++i)
+		index[i] = i;
+	stable_sort(index.begin(), index.end(), NGramKeyLess(*this));
+
+	vector<NGramTrie::WordId> sortedWords;
+	vector<float> sortedProbs, sortedBackoffs;
+	sortedWords.reserve(words.size());
+	sortedProbs.reserve(probs.size());
+	sortedBackoffs.reserve(backoffs.size());
+	size_t duplicates = 0;
+	for (size_t i = 0; i < index.size(); ++i)
+	{
+		const NGramTrie::WordId *key = Key(index[i]);
+		if (!sortedProbs.empty() && equal(key, key + n, sortedWords.end() - n))
+		{
+			// missing suffixes are added once for every n-gram that needs them, so only real n-grams count
+			if (!isnan(probs[index[i]]))
+				++duplicates;
+			continue;
+		}
+		sortedWords.insert(sortedWords.end(), key, key + n);
+		sortedProbs.push_back(probs[index[i]]);
+		sortedBackoffs.push_back(backoffs[index[i]]);
+	}
+	if (duplicates > 0)
+	{
+		stringstream msg;
+		msg << "Ignoring " << duplicates << " repeated " << n << "-grams";
+		UserMessage::Add(msg.str());
+	}
+	words.swap(sortedWords);
+	probs.swap(sortedProbs);
+	backoffs.swap(sortedBackoffs);
+}
+
+// natural log probability of key[0] given key[1..length-1], backing off in the levels up to length
+static float BackedOffProb(const vector<NGramLevel> &levels, const NGramTrie::WordId *key, size_t length)
+{
+	size_t matched = length, record;
+	while ((record = levels[matched - 1].Find(key, levels[matched - 1].Size())) == levels[matched - 1].Size())
+		--matched;
+	float prob = levels[matched - 1].probs[record];
+	for (size_t context = matched; context < length; ++context)
+	{
+		const NGramLevel &level = levels[context - 1];
+		size_t found = level.Find(key + 1, level.Size());
+		if (found < level.Size())
+			prob += level.backoffs[found];
+	}
+	return prob;
+}
+
+static UINT64 BitsFor(UINT64 maxValue)
+{
+	UINT64 bits = 1;
+	while (bits < 64 && (maxValue >> bits) != 0)
+		++bits;
+	return bits;
+}
+
+static inline void WriteBits(char *base, UINT64 bit, UINT64 value)
+{
+	UINT64 word;
+	memcpy(&word, base + (bit >> 3), sizeof(UINT64));
+	word |= value << (bit & 7);
+	memcpy(base + (bit >> 3), &word, sizeof(UINT64));
+}
+
+static inline size_t Align(size_t offset)
+{
+	return (offset + sizeof(UINT64) - 1) & ~(sizeof(UINT64) - 1);
+}
+
+// 2^bits values, each standing for the same number of the given values; with keepZero 0 is one of them
+static void MakeCodebook(vector<float> values, size_t bits, bool keepZero, float *codebook)
+{
+	const size_t size = size_t(1) << bits;
+	if (keepZero)
+		values.erase(remove(values.begin(), values.end(), 0.0f), values.end());
+	sort(values.begin(), values.end());
+
+	size_t first = 0;
+	if (keepZero)
+		codebook[first++] = 0.0f;
+	const size_t bins = size - first;
+	float last = values.empty() ? 0.0f : values.front();
+	for (size_t bin = 0; bin < bins; ++bin)
+	{
+		size_t begin = values.size() * bin / bins, end = values.size() * (bin + 1) / bins;
+		if (begin < end)
+		{
+			double sum = 0;
+			for (size_t i = begin; i < end; ++i)
+				sum += values[i];
+			last = (float) (sum / (end - begin));
+		}
+		codebook[first + bin] = last;
+	}
+	sort(codebook, codebook + size);
+}
+
+static inline UINT64 Encode(const float *codebook, size_t size, float value)
+{
+	const float *found = lower_bound(codebook, codebook + size, value);
+	if (found == codebook + size)
+		return size - 1;
+	if (found != codebook && value - *(found - 1) < *found - value)
+		--found;
+	return found - codebook;
+}
+
+bool NGramTrie::ReadARPA(const std::string &filePath, size_t quantisationBits)
+{
+	if (quantisationBits > 16)
+	{
+		UserMessage::Add("Scores can be quantised to at most 16 bits");
+		return false;
+	}
+
+	InputFileStream inFile(filePath);
+	string line;
+
+	// the counts in the \data\ section
+	while (getline(inFile, line) && line != "\\data\\")
+		;
+	vector<UINT64> counts;
+	while (getline(inFile, line))
+	{
+		if (line.empty())
+			continue;
+		if (line.compare(0, 6, "ngram ") != 0)
+			break;
+		size_t equals = line.find('=');
+		if (equals == string::npos || Scan<size_t>(line.substr(6, equals - 6)) != counts.size() + 1)
+		{
+			UserMessage::Add("Malformed \\data\\ section in " + filePath + ": " + line);
+			return false;
+		}
+		counts.push_back(Scan<UINT64>(line.substr(equals + 1)));
+	}
+	if (counts.empty())
+	{
+		UserMessage::Add("No \\data\\ section in " + filePath);
+		return false;
+	}
+	if (counts.size() > MaxOrder)
+	{
+		UserMessage::Add("Language models of order higher than " + SPrint(MaxOrder) + " are not supported: " + filePath);
+		return false;
+	}
+	const size_t order = counts.size();
+
+	map<string, WordId> vocabulary;
+	vector<string> words;
+	vector<NGramLevel> levels;
+	for (size_t n = 1; n <= order; ++n)
+		levels.push_back(NGramLevel(n));
+	size_t missingWords = 0;
+
+	// the n-grams of each order, with the words in reverse
+	vector<WordId> key(order);
+	for (size_t n = 1; n <= order; ++n)
+	{
+		stringstream section;
+		section << "\\" << n << "-grams:";
+		if (line != section.str())
+		{
+			UserMessage::Add("Expected " + section.str() + " in " + filePath + " instead of " + line);
+			return false;
+		}
+		NGramLevel &level = levels[n - 1];
+		level.words.reserve(counts[n - 1] * n);
+		level.probs.reserve(counts[n - 1]);
+		level.backoffs.reserve(counts[n - 1]);
+
+		while (getline(inFile, line) && (line.empty() || line[0] != '\\'))
+		{
+			vector<string> tokens = Tokenize(line);
+			if (tokens.empty())
+				continue;
+			if (tokens.size() != n + 1 && tokens.size() != n + 2)
+			{
+				UserMessage::Add("Malformed " + section.str() + " line in " + filePath + ": " + line);
+				return false;
+			}
+			for (size_t i = 0; i < n; ++i)
+			{
+				map<string, WordId>::iterator found = vocabulary.find(tokens[n - i]);
+				if (found == vocabulary.end())
+				{
+					if (n > 1)
+						++missingWords;
+					found = vocabulary.insert(make_pair(tokens[n - i], (WordId) words.size())).first;
+					words.push_back(tokens[n - i]);
+				}
+				key[i] = found->second;
+			}
+			float prob = TransformLMScore(Scan<float>(tokens[0]));
+			float backoff = (tokens.size() == n + 2) ? TransformLMScore(Scan<float>(tokens[n + 1])) : 0.0f;
+			if (n == 1)
+			{
+				// the unigrams are indexed by word ID
+				if (key[0] >= level.Size())
+				{
+					level.probs.resize(key[0] + 1, LOWEST_SCORE);
+					level.backoffs.resize(key[0] + 1, 0.0f);
+				}
+				level.probs[key[0]] = prob;
+				level.backoffs[key[0]] = backoff;
+			}
+			else
+				level.Add(&key[0], prob, backoff);
+		}
+	}
+	if (line != "\\end\\")
+	{
+		UserMessage::Add("Expected \\end\\ in " + filePath + " instead of " + line);
+		return false;
+	}
+	if (missingWords > 0)
+	{
+		stringstream msg;
+		msg << missingWords << " words in the n-grams of " << filePath << " have no unigram and get the lowest score";
+		UserMessage::Add(msg.str());
+	}
+
+	// every word is a unigram, including the ones that only appear in longer n-grams
+	NGramLevel &unigrams = levels[0];
+	unigrams.probs.resize(words.size(), LOWEST_SCORE);
+	unigrams.backoffs.resize(words.size(), 0.0f);
+	unigrams.words.resize(words.size());
+	for (size_t i = 0; i < words.size(); ++i)
+		unigrams.words[i] = i;
+
+	// the trie needs the suffix of each n-gram; the missing ones are added with the probability they get by backing off
+	for (size_t n = order; n >= 2; --n)
+	{
+		levels[n - 1].Sort();
+		if (n == 2)
+			break;
+		NGramLevel &level = levels[n - 1], &lower = levels[n - 2];
+		lower.Sort();
+		const size_t lowerSize = lower.Size();
+		for (size_t i = 0; i < level.Size(); ++i)
+			if (lower.Find(level.Key(i), lowerSize) == lowerSize)
+				lower.Add(level.Key(i), NAN, 0.0f);
+	}
+	for (size_t n = 2; n < order; ++n)
+	{
+		NGramLevel &level = levels[n - 1];
+		const NGramLevel &context = levels[n - 2];
+		for (size_t i = 0; i < level.Size(); ++i)
+			if (isnan(level.probs[i]))
+			{
+				level.probs[i] = BackedOffProb(levels, level.Key(i), n - 1);
+				size_t found = context.Find(level.Key(i) + 1, context.Size());
+				if (found < context.Size())
+					level.probs[i] += context.backoffs[found];
+			}
+	}
+
+	// the layout of the binary image
+	map<string, WordId>::const_iterator unknown = vocabulary.find("<unk>");
+	const UINT64 valueBits = (quantisationBits > 0) ? quantisationBits : 32;
+	const size_t codebookSize = size_t(1) << quantisationBits;
+	vector<Level> layout(order);
+	size_t offset = sizeof(Header) + order * sizeof(Level);
+	for (size_t l = 0; l < order; ++l)
+	{
+		Level &level = layout[l];
+		level.count = levels[l].Size();
+		level.wordBits = (l > 0) ? BitsFor(words.size() - 1) : 0;
+		level.probBits = valueBits;
+		level.backoffBits = (l + 1 < order) ? valueBits : 0;
+		level.pointerBits = (l + 1 < order) ? BitsFor(levels[l + 1].Size()) : 0;
+		level.recordBits = level.wordBits + level.probBits + level.backoffBits + level.pointerBits;
+		level.codebookOffset = 0;
+		if (quantisationBits > 0)
+		{
+			level.codebookOffset = offset;
+			offset = Align(offset + 2 * codebookSize * sizeof(float));
+		}
+	}
+	const size_t vocabularyOffset = offset;
+	for (size_t i = 0; i < words.size(); ++i)
+		offset += words[i].size() + 1;
+	offset = Align(offset);
+	for (size_t l = 0; l < order; ++l)
+	{
+		// the records of the lower orders are followed by one that closes the range of the last one
+		UINT64 records = layout[l].count + ((l + 1 < order) ? 1 : 0);
+		layout[l].dataOffset = offset;
+		offset = Align(offset + (records * layout[l].recordBits + 7) / 8 + sizeof(UINT64));
+	}
+
+	Release();
+	m_buffer.assign(offset / sizeof(UINT64), 0);
+	char *data = reinterpret_cast<char*>(&m_buffer[0]);
+
+	Header header;
+	memcpy(header.magic, BinaryMagic, sizeof(BinaryMagic));
+	header.version = BinaryVersion;
+	header.order = order;
+	header.vocabularySize = words.size();
+	header.unknownId = (unknown != vocabulary.end()) ? unknown->second : NotFound;
+	header.quantisationBits = quantisationBits;
+	header.vocabularyOffset = vocabularyOffset;
+	memcpy(data, &header, sizeof(Header));
+	memcpy(data + sizeof(Header), &layout[0], order * sizeof(Level));
+
+	char *word = data + vocabularyOffset;
+	for (size_t i = 0; i < words.size(); ++i)
+	{
+		memcpy(word, words[i].c_str(), words[i].size() + 1);
+		word += words[i].size() + 1;
+	}
+
+	for (size_t l = 0; l < order; ++l)
+	{
+		const NGramLevel &level = levels[l];
+		const Level &packing = layout[l];
+		char *records = data + packing.dataOffset;
+
+		float *codebook = reinterpret_cast<float*>(data + packing.codebookOffset);
+		if (quantisationBits > 0)
+		{
+			MakeCodebook(level.probs, quantisationBits, false, codebook);
+			if (packing.backoffBits > 0)
+				MakeCodebook(level.backoffs, quantisationBits, true, codebook + codebookSize);
+		}
+
+		size_t child = 0;
+		for (size_t i = 0; i <= level.Size(); ++i)
+		{
+			UINT64 bit = i * packing.recordBits;
+			if (i < level.Size())
+			{
+				if (packing.wordBits > 0)
+					WriteBits(records, bit, level.Key(i)[l]);
+				bit += packing.wordBits;
+				UINT64 value;
+				if (quantisationBits > 0)
+					value = Encode(codebook, codebookSize, level.probs[i]);
+				else
+				{
+					UINT32 raw;
+					memcpy(&raw, &level.probs[i], sizeof(UINT32));
+					value = raw;
+				}
+				WriteBits(records, bit, value);
+				bit += packing.probBits;
+				if (packing.backoffBits > 0)
+				{
+					if (quantisationBits > 0)
+						value = Encode(codebook + codebookSize, codebookSize, level.backoffs[i]);
+					else
+					{
+						UINT32 raw;
+						memcpy(&raw, &level.backoffs[i], sizeof(UINT32));
+						value = raw;
+					}
+					WriteBits(records, bit, value);
+				}
+				bit += packing.backoffBits;
+			}
+			else
+			{
+				if (packing.pointerBits == 0)
+					break;
+				bit += packing.wordBits + packing.probBits + packing.backoffBits;
+			}
+			if (packing.pointerBits > 0)
+			{
+				// the first of the longer n-grams that are not sorted before this one
+				const NGramLevel &higher = levels[l + 1];
+				while (child < higher.Size()
+							 && (i == level.Size() || lexicographical_compare(higher.Key(child), higher.Key(child) + level.n, level.Key(i), level.Key(i) + level.n)))
+					++child;
+				WriteBits(records, bit, child);
+			}
+		}
+	}
+
+	m_data = data;
+	m_size = offset;
+	return Attach();
+}
+
+////////////////////////////////////////////////////////////
+//
+// binary files
+//
+////////////////////////////////////////////////////////////
+
+NGramTrie::NGramTrie()
+: m_data(NULL)
+, m_size(0)
+, m_mapping(NULL)
+, m_header(NULL)
+, m_levels(NULL)
+{
+}
+
+NGramTrie::~NGramTrie()
+{
+	Release();
+}
+
+void NGramTrie::Release()
+{
+	if (m_mapping != NULL)
+		munmap(m_mapping, m_size);
+	m_mapping = NULL;
+	vector<UINT64>().swap(m_buffer);
+	m_data = NULL;
+	m_size = 0;
+	m_header = NULL;
+	m_levels = NULL;
+}
+
+bool NGramTrie::Attach()
+{
+	m_header = reinterpret_cast<const Header*>(m_data);
+	if (m_size < sizeof(Header) || memcmp(m_header->magic, BinaryMagic, sizeof(BinaryMagic)) != 0)
+	{
+		UserMessage::Add("Not a binary language model");
+		return false;
+	}
+	if (m_header->version != BinaryVersion || m_header->order > MaxOrder)
+	{
+		UserMessage::Add("Unsupported version of the binary language model");
+		return false;
+	}
+	m_levels = reinterpret_cast<const Level*>(m_data + sizeof(Header));
+
+	m_stateOffset.resize(m_header->order);
+	UINT64 states = 0;
+	for (size_t l = 0; l < m_header->order; ++l)
+	{
+		m_stateOffset[l] = states;
+		states += m_levels[l].count + 1;
+	}
+
+	m_words.resize(m_header->vocabularySize);
+	const char *word = m_data + m_header->vocabularyOffset;
+	for (size_t i = 0; i < m_words.size(); ++i)
+	{
+		m_words[i] = word;
+		word += strlen(word) + 1;
+	}
+	return true;
+}
+
+bool NGramTrie::Load(const std::string &filePath)
+{
+	Release();
+	int file = open(filePath.c_str(), O_RDONLY);
+	if (file < 0)
+	{
+		UserMessage::Add("Can't read " + filePath);
+		return false;
+	}
+	struct stat info;
+	if (fstat(file, &info) != 0 || info.st_size < (off_t) sizeof(Header))
+	{
+		close(file);
+		UserMessage::Add("Not a binary language model: " + filePath);
+		return false;
+	}
+	void *mapping = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, file, 0);
+	close(file);
+	if (mapping == MAP_FAILED)
+	{
+		UserMessage::Add("Can't map " + filePath + " into memory");
+		return false;
+	}
+	m_mapping = mapping;
+	m_data = static_cast<const char*>(mapping);
+	m_size = info.st_size;
+	return Attach();
+}
+
+bool NGramTrie::Save(const std::string &filePath) const
+{
+	FILE *file = fopen(filePath.c_str(), "wb");
+	if (file == NULL)
+	{
+		UserMessage::Add("Can't write " + filePath);
+		return false;
+	}
+	bool written = fwrite(m_data, 1, m_size, file) == m_size;
+	if (fclose(file) != 0 || !written)
+	{
+		UserMessage::Add("Error writing " + filePath);
+		return false;
+	}
+	return true;
+}
+
+bool NGramTrie::IsBinary(const std::string &filePath)
+{
+	char magic[sizeof(BinaryMagic)];
+	FILE *file = fopen(filePath.c_str(), "rb");
+	if (file == NULL)
+		return false;
+	bool binary = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, BinaryMagic, sizeof(magic)) == 0;
+	fclose(file);
+	return binary;
+}
+
+////////////////////////////////////////////////////////////
+//
+// queries
+//
+////////////////////////////////////////////////////////////
+
+UINT64 NGramTrie::FindChild(size_t level, UINT64 record, WordId word) const
+{
+	UINT64 begin = GetPointer(level, record), end = GetPointer(level, record + 1);
+	++level;
+	// the words of the records in the range are sorted and distinct
+	while (begin < end)
+	{
+		WordId first = GetWordId(level, begin), last = GetWordId(level, end - 1);
+		if (word < first || word > last)
+			return NoRecord;
+		UINT64 pivot = begin;
+		if (last > first)
+			pivot += (UINT64) ((double) (word - first) / (last - first) * (end - 1 - begin));
+		WordId found = GetWordId(level, pivot);
+		if (found == word)
+			return pivot;
+		if (found < word)
+			begin = pivot + 1;
+		else
+			end = pivot;
+	}
+	return NoRecord;
+}
+
+float NGramTrie::GetProb(const WordId *reversedWords, size_t count, size_t &matchedLength, UINT64 &state) const
+{
+	if (count == 0 || reversedWords[0] == NotFound)
+	{
+		matchedLength = 0;
+		state = 0;
+		return LOWEST_SCORE;
+	}
+	if (count > m_header->order)
+		count = m_header->order;
+
+	// the longest n-gram ending with the word
+	UINT64 record = reversedWords[0];
+	size_t length = 1;
+	while (length < count && reversedWords[length] != NotFound)
+	{
+		UINT64 child = FindChild(length - 1, record, reversedWords[length]);
+		if (child == NoRecord)
+			break;
+		record = child;
+		++length;
+	}
+	float prob = GetProb(length - 1, record);
+	matchedLength = length;
+	state = m_stateOffset[length - 1] + record + 1;
+
+	// the back-off weights of the contexts that are longer than the one that was found
+	if (length < count && reversedWords[1] != NotFound)
+	{
+		record = reversedWords[1];
+		size_t contextLength = 1;
+		while (true)
+		{
+			if (contextLength >= length)
+				prob += GetBackoff(contextLength - 1, record);
+			if (contextLength + 1 >= count || reversedWords[contextLength + 1] == NotFound)
+				break;
+			UINT64 child = FindChild(contextLength - 1, record, reversedWords[contextLength + 1]);
+			if (child == NoRecord)
+				break;
+			record = child;
+			++contextLength;
+		}
+	}
+	return prob;
+}
+
+}
@@ -0,0 +1,156 @@
+/*
+ *  NGramTrie.h
+ *  Moses
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ *  Back-off n-gram model of any order, stored as a reverse trie in sorted, bit-packed arrays.
+ *  The arrays are built once from an ARPA file and can be saved as a binary file that is mapped into memory when loaded,
+ *  so that loading does not depend on the size of the model.
+ *
+ */
+
+#ifndef moses_NGramTrie_h
+#define moses_NGramTrie_h
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "TypeDef.h"
+
+namespace Moses
+{
+
+/** The n-grams of each order are kept in one array, sorted by their words from the last to the first.
+ *  The records of an order are bit-packed: the word that extends the (n-1)-gram suffix, the log probability,
+ *  the log back-off weight and the offset of the first (n+1)-gram that extends the n-gram.
+ *  The unigrams are indexed directly by word ID, and the (n+1)-grams extending an n-gram are found with
+ *  interpolation search in the range between the offset of its record and the next.
+ *  The probabilities and back-off weights are either stored as floats, or quantised to 2^bits values per order.
+ *  The binary files use the byte order of the machine that wrote them.
+ */
+class NGramTrie
+{
+public:
+	typedef UINT32 WordId;
+	static const WordId NotFound;
+	//! highest order that can be read, so that queries can be kept on the stack
+	static const size_t MaxOrder = 16;
+
+protected:
+	static const UINT64 NoRecord;
+
+	struct Header
+	{
+		char magic[8];
+		UINT64 version;
+		UINT64 order;
+		UINT64 vocabularySize;
+		UINT64 unknownId;
+		UINT64 quantisationBits;
+		UINT64 vocabularyOffset;
+	};
+	struct Level
+	{
+		UINT64 count; // records, without the closing record of the lower orders
+		UINT64 dataOffset;
+		UINT64 codebookOffset; // 2^bits probabilities, followed by 2^bits back-off weights
+		UINT64 wordBits, probBits, backoffBits, pointerBits, recordBits;
+	};
+
+	const char *m_data;
+	size_t m_size;
+	void *m_mapping; //! non-NULL if m_data is a mapped file
+	std::vector<UINT64> m_buffer; //! holds m_data when built from an ARPA file
+
+	const Header *m_header;
+	const Level *m_levels;
+	std::vector<UINT64> m_stateOffset; //! to make the states of all orders distinct
+	std::vector<const char*> m_words;
+
+	bool Attach();
+	void Release();
+
+	static inline UINT64 ReadBits(const char *base, UINT64 bit, UINT64 bits)
+	{
+		UINT64 value;
+		memcpy(&value, base + (bit >> 3), sizeof(UINT64));
+		return (value >> (bit & 7)) & ((UINT64(1) << bits) - 1);
+	}
+	inline WordId GetWordId(size_t level, UINT64 record) const
+	{
+		const Level &l = m_levels[level];
+		return (WordId) ReadBits(m_data + l.dataOffset, record * l.recordBits, l.wordBits);
+	}
+	inline float GetFloat(size_t level, UINT64 record, UINT64 shift, UINT64 bits, size_t codebook) const
+	{
+		const Level &l = m_levels[level];
+		UINT64 value = ReadBits(m_data + l.dataOffset, record * l.recordBits + shift, bits);
+		if (m_header->quantisationBits == 0)
+		{
+			UINT32 raw = (UINT32) value;
+			float f;
+			memcpy(&f, &raw, sizeof(float));
+			return f;
+		}
+		return reinterpret_cast<const float*>(m_data + l.codebookOffset)[(codebook << m_header->quantisationBits) + value];
+	}
+	inline float GetProb(size_t level, UINT64 record) const
+	{
+		const Level &l = m_levels[level];
+		return GetFloat(level, record, l.wordBits, l.probBits, 0);
+	}
+	inline float GetBackoff(size_t level, UINT64 record) const
+	{
+		const Level &l = m_levels[level];
+		return GetFloat(level, record, l.wordBits + l.probBits, l.backoffBits, 1);
+	}
+	inline UINT64 GetPointer(size_t level, UINT64 record) const
+	{
+		const Level &l = m_levels[level];
+		return ReadBits(m_data + l.dataOffset, record * l.recordBits + l.wordBits + l.probBits + l.backoffBits, l.pointerBits);
+	}
+	//! the record of the (level+1)-gram extending the record of the level-gram with word, or NoRecord
+	UINT64 FindChild(size_t level, UINT64 record, WordId word) const;
+
+public:
+	NGramTrie();
+	~NGramTrie();
+
+	//! reads an ARPA file (possibly gzipped); with quantisationBits > 0 the scores of each order are quantised
+	bool ReadARPA(const std::string &filePath, size_t quantisationBits = 0);
+	//! maps a binary file written by Save into memory
+	bool Load(const std::string &filePath);
+	bool Save(const std::string &filePath) const;
+	//! whether the file starts like the binary files written by Save
+	static bool IsBinary(const std::string &filePath);
+
+	size_t GetOrder() const
+	{
+		return m_header->order;
+	}
+	WordId GetVocabularySize() const
+	{
+		return m_header->vocabularySize;
+	}
+	const char *GetWord(WordId id) const
+	{
+		return m_words[id];
+	}
+	//! ID of <unk>, or NotFound if the model has none
+	WordId GetUnknownId() const
+	{
+		return m_header->unknownId;
+	}
+
+	/** Natural log probability of the first word given the following ones, i.e. the words of the n-gram from the last one backwards.
+	 *  A word that is NotFound ends the context. Returns the length of the longest n-gram found, and a state that identifies it (>0),
+	 *  or 0 and LOWEST_SCORE if the first word is NotFound.
+	 */
+	float GetProb(const WordId *reversedWords, size_t count, size_t &matchedLength, UINT64 &state) const;
+};
+
+}
+
+#endif
@@ -25,7 +25,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 namespace Moses
 {
 /** constructor, intializes counters and thresholds */
-PartialTranslOptColl::PartialTranslOptColl()
+PartialTranslOptColl::PartialTranslOptColl(const LMList::PhraseScores *lmScores)
+	: m_lmScores(lmScores)
 {
 	m_bestScore = -std::numeric_limits<float>::infinity();
 	m_worstScore = -std::numeric_limits<float>::infinity();
@@ -37,7 +38,7 @@ PartialTranslOptColl::PartialTranslOptColl()
 /** add a partial translation option to the collection (without pruning) */
 void PartialTranslOptColl::AddNoPrune(TranslationOption *partialTranslOpt)
 {
-	partialTranslOpt->CalcScore();
+	partialTranslOpt->CalcScore(m_lmScores);
 	if (partialTranslOpt->GetFutureScore() >= m_worstScore) 
 	{
 		m_list.push_back(partialTranslOpt);
@@ -49,9 +49,10 @@ class PartialTranslOptColl
 	float m_worstScore; /**< score of the worse translation option */
 	size_t m_maxSize; /**< maximum number of translation options allowed */
 	size_t m_totalPruned; /**< number of options pruned */
+	const LMList::PhraseScores *m_lmScores; /**< precalculated LM scores of target phrases, or NULL */
 
 public:
-  PartialTranslOptColl();
+  PartialTranslOptColl(const LMList::PhraseScores *lmScores = NULL);
 
 	/** destructor, cleans out list */
 	~PartialTranslOptColl()
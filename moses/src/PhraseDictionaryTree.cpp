@@ -1,8 +1,10 @@
 // $Id: PhraseDictionaryTree.cpp 3258 2010-05-16 19:13:32Z chardmeier $
 // vim:tabstop=2
 #include "PhraseDictionaryTree.h"
+#include "../../scripts/training/phrase-extract/Threading.h" // header-only, shared with the training tools
 #include <map>
 #include <cassert>
+#include <cstring>
 #include <sstream>
 #include <iostream>
 #include <fstream>
@@ -53,6 +55,20 @@ public:
 		fReadVector(f,e);
 		fReadVector(f,sc);
 	} 
+
+	void appendBin(std::string& b) const 
+	{
+		bWriteVector(b,e);
+		bWriteVector(b,sc);
+	}
+	
+	void appendBinWithAlignment(std::string& b) const 
+	{
+		bWriteVector(b,e);
+		bWriteVector(b,sc);
+		bWriteStringVector(b, m_sourceAlignment);
+		bWriteStringVector(b, m_targetAlignment);
+	}
 	
 	void writeBinWithAlignment(FILE* f) const 
 	{
@@ -96,6 +112,15 @@ public:
 		for(size_t i=0;i<s;++i) MyBase::operator[](i).writeBinWithAlignment(f);
 	}
 	
+	void appendBin(std::string& b,bool withAlignment) const 
+	{
+		unsigned s=size();
+		bWrite(b,s);
+		for(size_t i=0;i<s;++i)
+			if (withAlignment) MyBase::operator[](i).appendBinWithAlignment(b);
+			else MyBase::operator[](i).appendBin(b);
+	}
+	
 	void readBin(FILE* f) 
 	{
 		unsigned s;fRead(f,s);resize(s);
@@ -346,6 +371,223 @@ void PDTimp::PrintTgtCand(const TgtCands& tcand,std::ostream& out) const
 	}
 }
 
+typedef PrefixTreeSA<LabelId,OFF_T> PSA;
+
+// a phrase pair waiting for its source tree to be built
+struct PDTpair {
+	IPhrase f,e;
+	Scores sc;
+	std::string sourceAlign,targetAlign;
+};
+
+// The phrase pairs of consecutive source phrases with the same first word, which make up one source tree.
+// The tree and the target candidates are serialised as if they started at offset 0 of their files;
+// the writer moves them to their place with the collected data and child positions.
+struct PDTpartition {
+	LabelId firstWord;
+	std::vector<PDTpair> pairs;
+	std::string srcTree,tgtData;
+	std::vector<size_t> dataPos,childPos;
+
+	void build(bool withAlignment);
+};
+
+// a batch of partitions, built on a worker thread and written out in input order
+struct PDTjob : public bg_zhechev_ventsislav::OrderedJob {
+	std::vector<PDTpartition*> partitions;
+	size_t pairCount;
+	bool withAlignment;
+
+	PDTjob(bool a) : pairCount(0),withAlignment(a) {}
+	~PDTjob() {for(size_t i=0;i<partitions.size();++i) delete partitions[i];}
+	void run() {for(size_t i=0;i<partitions.size();++i) partitions[i]->build(withAlignment);}
+};
+
+// state of the creation of a binary table from phrase pairs sorted by source phrase
+class PDTbuilder {
+public:
+	std::string ofi,ofsv,oftv;
+	FILE *os,*ot;
+	OFF_T srcTreePos,tgtDataPos;
+	std::vector<OFF_T> vo;
+	size_t count,lnc;
+	IPhrase currF;
+	bool withAlignment;
+
+	PDTpartition* partition;
+	PDTjob* job;
+	bg_zhechev_ventsislav::OrderedWorkerPool* pool;
+	bg_zhechev_ventsislav::Thread writer;
+
+	// partitions are handed to the workers in batches of about this many phrase pairs
+	static const size_t jobSize=1<<16;
+
+	PDTbuilder(unsigned threads,bool a)
+		: os(0),ot(0),srcTreePos(0),tgtDataPos(0),count(0),lnc(0),withAlignment(a),partition(0),job(new PDTjob(a)),pool(0) {
+		if(threads>1) {
+			pool=new bg_zhechev_ventsislav::OrderedWorkerPool(threads,2*threads);
+			writer.start(&writeJobs,this);
+		}
+	}
+	~PDTbuilder() {delete partition;delete job;delete pool;}
+
+	void add(PDTpair& pair);
+	void finish();
+	void closePartition();
+	void submitJob();
+	void write(PDTjob& job);
+	static void* writeJobs(void* data);
+};
+
+// turns a word-to-word alignment like "(0) () (1,2)" into the tokens "0 -1 1,2"
+static WordAlignments ParseAlignment(const std::string& alignment)
+{
+	if(alignment.empty()) return WordAlignments();
+	//change "()" into "(-1)", then remove all "(" and ")"
+	return Tokenize(Replace(Replace(Replace(alignment,"()","(-1)"),"(",""),")",""));
+}
+
+void PDTpartition::build(bool withAlignment)
+{
+	PSA psa;
+	TgtCands tgtCands;
+	IPhrase currF;
+	for(size_t i=0;i<pairs.size();++i)
+	{
+		PDTpair& pair=pairs[i];
+		if(currF!=pair.f) 
+		{
+			// new src phrase
+			if(!currF.empty())
+				tgtCands.appendBin(tgtData,withAlignment);
+			tgtCands.clear();
+			currF=pair.f;
+
+			// insert src phrase in prefix tree
+			PSA::Data& d=psa.insert(pair.f);
+			if(d==InvalidOffT) d=tgtData.size();
+			else 
+			{
+				TRACE_ERR("ERROR: source phrase already inserted!\nf: "<<pair.f<<"\n");
+				abort();
+			}
+		}
+
+		tgtCands.push_back(TgtCand(pair.e,pair.sc,ParseAlignment(pair.sourceAlign),ParseAlignment(pair.targetAlign)));
+	}
+	tgtCands.appendBin(tgtData,withAlignment);
+	std::vector<PDTpair>().swap(pairs);
+
+	PTF::create(psa,srcTree,dataPos,childPos);
+}
+
+void PDTbuilder::add(PDTpair& pair)
+{
+	const bool newSource=(currF!=pair.f);
+	if(newSource) 
+	{
+		if(currF.empty()) ++count;
+		else if(++count%10000==0) 
+		{
+			TRACE_ERR(".");
+			if(count%500000==0) TRACE_ERR("[phrase:"<<count<<"]\n");
+		}
+		if(partition && partition->firstWord!=pair.f[0])
+			closePartition();
+	}
+	if(!partition) 
+	{
+		partition=new PDTpartition;
+		partition->firstWord=pair.f[0];
+	}
+	partition->pairs.push_back(PDTpair());
+	partition->pairs.back().f.swap(pair.f);
+	partition->pairs.back().e.swap(pair.e);
+	partition->pairs.back().sc.swap(pair.sc);
+	partition->pairs.back().sourceAlign.swap(pair.sourceAlign);
+	partition->pairs.back().targetAlign.swap(pair.targetAlign);
+	if(newSource) currF=partition->pairs.back().f;
+}
+
+void PDTbuilder::closePartition()
+{
+	job->pairCount+=partition->pairs.size();
+	job->partitions.push_back(partition);
+	partition=0;
+	if(job->pairCount>=jobSize) submitJob();
+}
+
+void PDTbuilder::submitJob()
+{
+	if(pool) pool->submit(job);
+	else 
+	{
+		job->run();
+		write(*job);
+		delete job;
+	}
+	job=new PDTjob(withAlignment);
+}
+
+void PDTbuilder::finish()
+{
+	if(partition) closePartition();
+	submitJob();
+	if(pool) 
+	{
+		pool->finish();
+		writer.join();
+	}
+}
+
+// adds base to the offset stored at pos in the buffer
+static inline void relocate(std::string& buffer,size_t pos,OFF_T base)
+{
+	OFF_T offset;
+	memcpy(&offset,buffer.data()+pos,sizeof(OFF_T));
+	offset+=base;
+	buffer.replace(pos,sizeof(OFF_T),reinterpret_cast<const char*>(&offset),sizeof(OFF_T));
+}
+
+// moves the trees and target candidates of a job to the end of their files
+void PDTbuilder::write(PDTjob& job)
+{
+	for(size_t i=0;i<job.partitions.size();++i) 
+	{
+		PDTpartition& p=*job.partitions[i];
+		for(size_t j=0;j<p.dataPos.size();++j)
+			relocate(p.srcTree,p.dataPos[j],tgtDataPos);
+		for(size_t j=0;j<p.childPos.size();++j)
+			relocate(p.srcTree,p.childPos[j],srcTreePos);
+
+		if(p.firstWord>=vo.size()) 
+			vo.resize(p.firstWord+1,InvalidOffT);
+		vo[p.firstWord]=srcTreePos;
+
+		if(fwrite(p.srcTree.data(),1,p.srcTree.size(),os)!=p.srcTree.size() ||
+			 fwrite(p.tgtData.data(),1,p.tgtData.size(),ot)!=p.tgtData.size()) 
+		{
+			TRACE_ERR("ERROR: fwrite!\n");
+			abort();
+		}
+		srcTreePos+=p.srcTree.size();
+		tgtDataPos+=p.tgtData.size();
+		std::string().swap(p.srcTree);
+		std::string().swap(p.tgtData);
+	}
+}
+
+void* PDTbuilder::writeJobs(void* data)
+{
+	PDTbuilder* builder=static_cast<PDTbuilder*>(data);
+	for(bg_zhechev_ventsislav::OrderedJob* job=builder->pool->next();job;job=builder->pool->next()) 
+	{
+		builder->write(*static_cast<PDTjob*>(job));
+		delete job;
+	}
+	return 0;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // member functions of PhraseDictionaryTree
@@ -353,7 +595,7 @@ void PDTimp::PrintTgtCand(const TgtCands& tcand,std::ostream& out) const
 ////////////////////////////////////////////////////////////
 
 PhraseDictionaryTree::PhraseDictionaryTree(size_t numScoreComponent)
-	: Dictionary(numScoreComponent),imp(new PDTimp)
+	: Dictionary(numScoreComponent),imp(new PDTimp),builder(0)
 {
 	if(sizeof(OFF_T)!=8)
 		{
@@ -366,6 +608,7 @@ PhraseDictionaryTree::PhraseDictionaryTree(size_t numScoreComponent)
 
 PhraseDictionaryTree::~PhraseDictionaryTree() 
 {
+	delete builder;
 	delete imp;
 }
 
@@ -436,36 +679,13 @@ PrintTargetCandidates(const std::vector<std::string>& src,
 	imp->PrintTgtCand(tcand,out);
 }
 
-int PhraseDictionaryTree::Create(std::istream& inFile,const std::string& out) 
+int PhraseDictionaryTree::Create(std::istream& inFile,const std::string& out,unsigned threads) 
 {
 	std::string line;
-	size_t count = 0;
-
-	std::string ofn(out+".binphr.srctree"),
-		oft(out+".binphr.tgtdata"),
-		ofi(out+".binphr.idx"),
-		ofsv(out+".binphr.srcvoc"),
-		oftv(out+".binphr.tgtvoc");
-	
-	if (PrintWordAlignment()){
-		ofn+=".wa";
-		oft+=".wa";
-	}
-	
-  FILE *os=fOpen(ofn.c_str(),"wb"),
-    *ot=fOpen(oft.c_str(),"wb");
-
-  typedef PrefixTreeSA<LabelId,OFF_T> PSA;
-  PSA *psa=new PSA;PSA::setDefault(InvalidOffT);
-
-	LabelId currFirstWord=InvalidLabelId;
-	IPhrase currF;
-	TgtCands tgtCands;
-	std::vector<OFF_T> vo;
-	size_t lnc=0;
+	size_t lnc = 0;
 	size_t numElement = NOT_FOUND; // 3=old format, 5=async format which include word alignment info
-    imp->sv = new WordVoc();
-    imp->tv = new WordVoc();
+
+	BeginCreate(out,threads);
 	
 	while(getline(inFile, line)) 	
 	{
@@ -487,171 +707,113 @@ int PhraseDictionaryTree::Create(std::istream& inFile,const std::string& out)
 			abort();
 		}
 		
-		std::string sourcePhraseString, targetPhraseString;
-		std::string scoreString;
-		std::string sourceAlignString, targetAlignString;
-		
-		sourcePhraseString=tokens[0];
-		targetPhraseString=tokens[1];
-		if (numElement==3){
-			scoreString=tokens[2];
-		}
-		else{
-			sourceAlignString=tokens[2];
-			targetAlignString=tokens[3];
-			scoreString=tokens[4];
-		}
-		
-				
-		IPhrase f,e;
-		Scores sc;
-		WordAlignments sourceAlignment, targetAlignment;
-			
-		std::vector<std::string> wordVec = Tokenize(sourcePhraseString);
-		for (size_t i = 0 ; i < wordVec.size() ; ++i)
-			f.push_back(imp->sv->add(wordVec[i]));
-		
-		wordVec = Tokenize(targetPhraseString);
-		for (size_t i = 0 ; i < wordVec.size() ; ++i)
-			e.push_back(imp->tv->add(wordVec[i]));
-		
-		
-		
-		//change "()" into "(-1)" for both source and target word-to-word alignments
-		std::string emtpyAlignStr="()";
-		std::string replaceAlignStr="(-1)";
-		sourceAlignString=Replace(sourceAlignString,emtpyAlignStr,replaceAlignStr);
-		targetAlignString=Replace(targetAlignString,emtpyAlignStr,replaceAlignStr);
-
-		//remove all "(" from both source and target word-to-word alignments
-		emtpyAlignStr="(";
-		replaceAlignStr="";
-		sourceAlignString=Replace(sourceAlignString,emtpyAlignStr,replaceAlignStr);
-		targetAlignString=Replace(targetAlignString,emtpyAlignStr,replaceAlignStr);
-		
-		//remove all ")" from both source and target word-to-word alignments
-		emtpyAlignStr=")";
-		replaceAlignStr="";
-		sourceAlignString=Replace(sourceAlignString,emtpyAlignStr,replaceAlignStr);
-		targetAlignString=Replace(targetAlignString,emtpyAlignStr,replaceAlignStr);
-		
-		sourceAlignment = Tokenize(sourceAlignString);
-		targetAlignment = Tokenize(targetAlignString);
-			
 		//			while(is>>w && w!="|||") sc.push_back(atof(w.c_str()));
-		// Mauro: to handle 0 probs in phrase tables
-		std::vector<float> scoreVector = Tokenize<float>(scoreString);
-		for (size_t i = 0 ; i < scoreVector.size() ; ++i)
-		{
-			float tmp = scoreVector[i];
-			sc.push_back(((tmp>0.0)?tmp:(float)1.0e-38));
-		}
-		
-			
-		if(f.empty())
-		{
-			TRACE_ERR("WARNING: empty source phrase in line '"<<line<<"'\n");
-			continue;
-		}
-			
-		if(currFirstWord==InvalidLabelId) currFirstWord=f[0];
-		if(currF.empty()) 
-		{
-			++count;
-			currF=f;
-			// insert src phrase in prefix tree
-			assert(psa);
-			PSA::Data& d=psa->insert(f);
-			if(d==InvalidOffT) d=fTell(ot);
-			else 
-			{
-				TRACE_ERR("ERROR: source phrase already inserted (A)!\nline(" << lnc << "): '"
-									<<line<<"'\nf: "<<f<<"\n");
-				abort();
-			}
-		}
+		if (numElement==3)
+			AddPhrasePair(tokens[0], tokens[1], Tokenize<float>(tokens[2]));
+		else
+			AddPhrasePair(tokens[0], tokens[1], Tokenize<float>(tokens[4]), tokens[2], tokens[3]);
+	}
 
-		if(currF!=f) 
-		{
-			// new src phrase
-			currF=f;
-			if (PrintWordAlignment())
-				tgtCands.writeBinWithAlignment(ot);
-			else
-				tgtCands.writeBin(ot);
-			tgtCands.clear();
-				
-			if(++count%10000==0) 
-			{
-				TRACE_ERR(".");
-				if(count%500000==0) TRACE_ERR("[phrase:"<<count<<"]\n");
-			}
+	return EndCreate();
+}
 
-			if(f[0]!=currFirstWord) 
-			{
-				// write src prefix tree to file and clear
-				PTF pf;
-				if(currFirstWord>=vo.size()) 
-					vo.resize(currFirstWord+1,InvalidOffT);
-				vo[currFirstWord]=fTell(os);
-				pf.create(*psa,os);
-				// clear
-				delete psa;psa=new PSA;
-				currFirstWord=f[0];
-			}
-			
-			// insert src phrase in prefix tree
-			assert(psa);
-			PSA::Data& d=psa->insert(f);
-			if(d==InvalidOffT) d=fTell(ot);
-			else 
-			{
-				TRACE_ERR("ERROR: xsource phrase already inserted (B)!\nline(" << lnc << "): '"
-									<<line<<"'\nf: "<<f<<"\n");
-				abort();
-			}
-		}
-		tgtCands.push_back(TgtCand(e,sc, sourceAlignment, targetAlignment));
-		assert(currFirstWord!=InvalidLabelId);
-	}
-  if (PrintWordAlignment())
-		tgtCands.writeBinWithAlignment(ot);
-  else
-		tgtCands.writeBin(ot);
-	tgtCands.clear();
+void PhraseDictionaryTree::BeginCreate(const std::string& out,unsigned threads)
+{
+	delete builder;
+	builder = new PDTbuilder(threads,PrintWordAlignment());
+	PDTbuilder& b = *builder;
+
+	std::string ofn(out+".binphr.srctree"),
+		oft(out+".binphr.tgtdata");
+	b.ofi = out+".binphr.idx";
+	b.ofsv = out+".binphr.srcvoc";
+	b.oftv = out+".binphr.tgtvoc";
 	
-  PTF pf;
-  if(currFirstWord>=vo.size()) vo.resize(currFirstWord+1,InvalidOffT);
-  vo[currFirstWord]=fTell(os);
-  pf.create(*psa,os);
-  delete psa;psa=0;
-
-  TRACE_ERR("distinct source phrases: "<<count
-		<<" distinct first words of source phrases: "<<vo.size()
-		<<" number of phrase pairs (line count): "<<lnc
+	if (PrintWordAlignment()){
+		ofn+=".wa";
+		oft+=".wa";
+	}
+	
+	b.os=fOpen(ofn.c_str(),"wb");
+	b.ot=fOpen(oft.c_str(),"wb");
+
+	PSA::setDefault(InvalidOffT);
+
+	imp->sv = new WordVoc();
+	imp->tv = new WordVoc();
+}
+
+void PhraseDictionaryTree::AddPhrasePair(const std::string& sourcePhraseString, const std::string& targetPhraseString,
+																				 const std::vector<float>& scoreVector,
+																				 const std::string& sourceAlignString, const std::string& targetAlignString)
+{
+	assert(builder);
+	++builder->lnc;
+
+	// the words are numbered in the order in which they are seen, so this stays on the calling thread
+	PDTpair pair;
+	std::vector<std::string> wordVec = Tokenize(sourcePhraseString);
+	for (size_t i = 0 ; i < wordVec.size() ; ++i)
+		pair.f.push_back(imp->sv->add(wordVec[i]));
+	
+	wordVec = Tokenize(targetPhraseString);
+	for (size_t i = 0 ; i < wordVec.size() ; ++i)
+		pair.e.push_back(imp->tv->add(wordVec[i]));
+	
+	if(pair.f.empty())
+	{
+		TRACE_ERR("WARNING: empty source phrase in phrase pair " << builder->lnc << " ('"<<sourcePhraseString<<" ||| "<<targetPhraseString<<"')\n");
+		return;
+	}
+
+	// Mauro: to handle 0 probs in phrase tables
+	pair.sc.reserve(scoreVector.size());
+	for (size_t i = 0 ; i < scoreVector.size() ; ++i)
+	{
+		float tmp = scoreVector[i];
+		pair.sc.push_back(((tmp>0.0)?tmp:(float)1.0e-38));
+	}
+	
+	pair.sourceAlign = sourceAlignString;
+	pair.targetAlign = targetAlignString;
+	builder->add(pair);
+}
+
+int PhraseDictionaryTree::EndCreate()
+{
+	assert(builder);
+	PDTbuilder& b = *builder;
+	b.finish();
+
+  TRACE_ERR("distinct source phrases: "<<b.count
+		<<" distinct first words of source phrases: "<<b.vo.size()
+		<<" number of phrase pairs (line count): "<<b.lnc
 		<<"\n");
  	
-	fClose(os);
-  fClose(ot);
+	fClose(b.os);
+  fClose(b.ot);
 
   std::vector<size_t> inv;
-  for(size_t i=0;i<vo.size();++i)
-    if(vo[i]==InvalidOffT) inv.push_back(i);
+  for(size_t i=0;i<b.vo.size();++i)
+    if(b.vo[i]==InvalidOffT) inv.push_back(i);
 
   if(inv.size()) 
 		{
 			TRACE_ERR("WARNING: there are src voc entries with no phrase "
 				"translation: count "<<inv.size()<<"\n"
-				"There exists phrase translations for "<<vo.size()-inv.size()
+				"There exists phrase translations for "<<b.vo.size()-inv.size()
 							 <<" entries\n");
 		}
   
-  FILE *oi=fOpen(ofi.c_str(),"wb");
-  fWriteVector(oi,vo);
+  FILE *oi=fOpen(b.ofi.c_str(),"wb");
+  fWriteVector(oi,b.vo);
 	fClose(oi);
 
-	imp->sv->Write(ofsv);
-	imp->tv->Write(oftv);
+	imp->sv->Write(b.ofsv);
+	imp->tv->Write(b.oftv);
+
+	delete builder;
+	builder=0;
 
   return 1;
 }
@@ -30,11 +30,13 @@ class Phrase;
 class Word;
 class ConfusionNet;
 class PDTimp;
+class PDTbuilder;
 
 typedef PrefixTreeF<LabelId,OFF_T> PTF;
 
 class PhraseDictionaryTree : public Dictionary {
 	PDTimp *imp; //implementation
+	PDTbuilder *builder; //state of BeginCreate() ... EndCreate()
 
 	PhraseDictionaryTree(); // not implemented
 	PhraseDictionaryTree(const PhraseDictionaryTree&); //not implemented
@@ -57,7 +59,18 @@ public:
 	// convert from ascii phrase table format 
 	// note: only creates table, does not keep it in memory
 	//        -> use Read(outFileNamePrefix);
-	int Create(std::istream& in,const std::string& outFileNamePrefix);
+	// the source trees of the different first words are built on the given number of threads;
+	// the files are the same for any number of threads
+	int Create(std::istream& in,const std::string& outFileNamePrefix,unsigned threads=1);
+
+	// the same, but with the phrase pairs handed over one at a time, so that a
+	// training tool can build the binary table without writing an ascii one first;
+	// the phrase pairs have to come sorted by source phrase, just as in the ascii table
+	void BeginCreate(const std::string& outFileNamePrefix,unsigned threads=1);
+	void AddPhrasePair(const std::string& source,const std::string& target,
+										 const std::vector<float>& scores,
+										 const std::string& sourceAlignment="",const std::string& targetAlignment="");
+	int EndCreate();
 
 	int Read(const std::string& fileNamePrefix); 
 
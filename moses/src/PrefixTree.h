@@ -11,6 +11,7 @@
 #include <algorithm>
 #include <cassert>
 #include <deque>
+#include <string>
 #include "Util.h"
 #include "FilePtr.h"
 #include "File.h"
@@ -216,6 +217,46 @@ public:
     }
   }
 
+  // the same layout as create(psa,f), but appended to a buffer as if the tree started at offset 0.
+  // The positions of the (non-default) data and of the child offsets are collected,
+  // so that the tree can be moved to its place in the file and pointed to its data later on.
+  static void create(const PrefixTreeSA<Key,Data>& psa,std::string& out,
+                     std::vector<size_t>& dataPos,std::vector<size_t>& childPos) {
+    typedef std::pair<const PrefixTreeSA<Key,Data>*,size_t> P;
+    typedef std::deque<P> Queue;
+
+    Queue queue;
+
+    queue.push_back(P(&psa,out.size()));
+    bool isFirst=1;
+    while(queue.size()) {
+      const P& pp=queue.back();
+      const PrefixTreeSA<Key,Data>& p=*pp.first;
+      size_t pos=pp.second;
+      queue.pop_back();
+
+      if(!isFirst) {
+        OFF_T curr=out.size();
+        out.replace(pos,sizeof(OFF_T),reinterpret_cast<const char*>(&curr),sizeof(OFF_T));
+        childPos.push_back(pos);
+      } else isFirst=0;
+
+      bWriteVector(out,p.keys);
+      size_t dataStart=out.size()+sizeof(UINT32);
+      bWriteVector(out,p.data);
+      for(size_t i=0;i<p.data.size();++i)
+        if(p.data[i]!=psa.getDefault())
+          dataPos.push_back(dataStart+i*sizeof(Data));
+
+      for(size_t i=0;i<p.ptr.size();++i) {
+        if(p.ptr[i])
+          queue.push_back(P(p.ptr[i],out.size()));
+        OFF_T ppos=0;
+        bWrite(out,ppos);
+      }
+    }
+  }
+
   size_t size() const {return keys.size();}
   const Key& getKey(size_t i) const {return keys[i];}
   const Data& getData(size_t i) const {return data[i];}
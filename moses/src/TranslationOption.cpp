@@ -137,7 +137,7 @@ bool TranslationOption::Overlap(const Hypothesis &hypothesis) const
 	return bitmap.Overlap(GetSourceWordsRange());
 }
 
-void TranslationOption::CalcScore()
+void TranslationOption::CalcScore(const LMList::PhraseScores *lmScores)
 {
 	// LM scores
 	float ngramScore = 0;
@@ -145,7 +145,7 @@ void TranslationOption::CalcScore()
 
 	const LMList &allLM = StaticData::Instance().GetAllLM();
 
-	allLM.CalcScore(GetTargetPhrase(), retFullScore, ngramScore, &m_scoreBreakdown);
+	allLM.CalcScore(GetTargetPhrase(), retFullScore, ngramScore, &m_scoreBreakdown, lmScores);
 
 	size_t phraseSize = GetTargetPhrase().GetSize();
 	// future score
@@ -185,8 +185,9 @@ public:
 			return it->second;
 	}
 
-	/** Calculate future score and n-gram score of this trans option, plus the score breakdowns */
-	void CalcScore();
+	/** Calculate future score and n-gram score of this trans option, plus the score breakdowns.
+	 *  The LM scores of the target phrase are taken from lmScores if they are there */
+	void CalcScore(const LMList::PhraseScores *lmScores = NULL);
 	
 	void CacheScores(const ScoreProducer &scoreProducer, const Scores &score);
 
@@ -377,6 +377,8 @@ void TranslationOptionCollection::CalcFutureScore()
  */
 void TranslationOptionCollection::CreateTranslationOptions(const vector <DecodeGraph*> &decodeStepVL)
 {
+	CalcLanguageModelScores(decodeStepVL);
+
 	// loop over all substrings of the source sentence, look them up
 	// in the phraseDictionary (which is the- possibly filtered-- phrase
 	// table loaded on initialization), generate TranslationOption objects
@@ -402,6 +404,7 @@ void TranslationOptionCollection::CreateTranslationOptions(const vector <DecodeG
 	VERBOSE(2,"Translation Option Collection\n " << *this << endl);
 
 	ProcessUnknownWord(decodeStepVL);
+	m_lmScores.clear();
 	
 	// Prune
 	Prune();
@@ -415,6 +418,48 @@ void TranslationOptionCollection::CreateTranslationOptions(const vector <DecodeG
 	CacheLexReordering();
 }
 
+void TranslationOptionCollection::CalcLanguageModelScores(const vector <DecodeGraph*> &decodeStepVL)
+{
+	const StaticData &staticData = StaticData::Instance();
+	const bool xmlExclusive = (staticData.GetXmlInputType() == XmlExclusive)
+			, useCache = staticData.GetUseTransOptCache();
+	vector<const Phrase*> targetPhrases;
+	size_t size = m_source.GetSize();
+	for (size_t startVL = 0 ; startVL < decodeStepVL.size() ; startVL++)
+	{
+		const DecodeGraph &decodeGraph = *decodeStepVL[startVL];
+		const DecodeStep &decodeStep = **decodeGraph.begin();
+		const PhraseDictionary &phraseDictionary = decodeStep.GetPhraseDictionary();
+		const size_t tableLimit = phraseDictionary.GetTableLimit();
+		for (size_t startPos = 0 ; startPos < size; startPos++)
+		{
+			size_t maxSize = size - startPos;
+			size_t maxSizePhrase = staticData.GetMaxPhraseLength();
+			maxSize = std::min(maxSize, maxSizePhrase);
+
+			for (size_t endPos = startPos ; endPos < startPos + maxSize ; endPos++)
+			{
+				// only the ranges for which CreateTranslationOptionsForRange() creates options
+				const WordsRange wordsRange(startPos, endPos);
+				if (xmlExclusive && HasXmlOptionsOverlappingRange(startPos, endPos))
+					continue;
+				if (useCache && staticData.FindTransOptListInCache(decodeGraph, m_source.GetSubString(wordsRange)) != NULL)
+					continue;
+
+				const TargetPhraseCollection *phraseColl = phraseDictionary.GetTargetPhraseCollection(m_source, wordsRange);
+				if (phraseColl == NULL)
+					continue;
+				TargetPhraseCollection::const_iterator iterTargetPhrase, iterEnd;
+				iterEnd = (tableLimit == 0 || phraseColl->GetSize() < tableLimit) ? phraseColl->end() : phraseColl->begin() + tableLimit;
+				for (iterTargetPhrase = phraseColl->begin() ; iterTargetPhrase != iterEnd ; ++iterTargetPhrase)
+					targetPhrases.push_back(*iterTargetPhrase);
+			}
+		}
+	}
+	if (!targetPhrases.empty())
+		StaticData::Instance().GetAllLM().CalcScores(targetPhrases, m_lmScores);
+}
+
 void TranslationOptionCollection::Sort()
 {
 	size_t size = m_source.GetSize();
@@ -475,7 +520,7 @@ void TranslationOptionCollection::CreateTranslationOptionsForRange(
 		if (!skipTransOptCreation)
 		{
 			// partial trans opt stored in here
-			PartialTranslOptColl* oldPtoc = new PartialTranslOptColl;
+			PartialTranslOptColl* oldPtoc = new PartialTranslOptColl(&m_lmScores);
 			size_t totalEarlyPruned = 0;
 
 			// initial translation step
@@ -491,7 +536,7 @@ void TranslationOptionCollection::CreateTranslationOptionsForRange(
 			for (++iterStep ; iterStep != decodeGraph.end() ; ++iterStep)
 			{
 				const DecodeStep &decodeStep = **iterStep;
-				PartialTranslOptColl* newPtoc = new PartialTranslOptColl;
+				PartialTranslOptColl* newPtoc = new PartialTranslOptColl(&m_lmScores);
 
 				// go thru each intermediate trans opt just created
 				const vector<TranslationOption*>& partTransOptList = oldPtoc->GetList();
@@ -519,7 +564,7 @@ void TranslationOptionCollection::CreateTranslationOptionsForRange(
 			for (iterColl = partTransOptList.begin() ; iterColl != partTransOptList.end() ; ++iterColl)
 			{
 				TranslationOption *transOpt = *iterColl;
-				transOpt->CalcScore();
+				transOpt->CalcScore(&m_lmScores);
 				Add(transOpt);
 			}
 
@@ -70,6 +70,7 @@ protected:
 	const size_t				m_maxNoTransOptPerCoverage; /*< maximum number of translation options per input span */
 	const float				m_translationOptionThreshold; /*< threshold for translation options with regard to best option for input span */
 	std::vector<Phrase*> m_unksrcs;
+	LMList::PhraseScores m_lmScores; /*< LM scores of the target phrases of the sentence, while the options are created */
 	
 	TranslationOptionCollection(InputType const& src, size_t maxNoTransOptPerCoverage, float translationOptionThreshold);
 	
@@ -93,6 +94,8 @@ protected:
 	//! implemented by inherited class, called by this class
 	virtual void ProcessUnknownWord(size_t sourcePos)=0;
 	void CacheLexReordering();
+	//! scores the target phrases of the first translation step of each decoding path with all LMs at once, before the options are created
+	void CalcLanguageModelScores(const std::vector <DecodeGraph*> &decodeStepVL);
 
 public:
   virtual ~TranslationOptionCollection();
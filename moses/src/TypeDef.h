@@ -152,6 +152,7 @@ enum LMImplementation
 	,RandLM 	= 5
 	,Remote 	= 6
 	,ParallelBackoff	= 7
+	,Trie			= 8
 
 };
 
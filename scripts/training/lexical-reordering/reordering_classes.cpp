@@ -9,6 +9,54 @@
 
 
 #include "reordering_classes.h"
+#include "FieldSplitter.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <unistd.h>
+
+
+//The deferred counts are stored as variable-length numbers: seven bits per byte, with the high bit set on all but the last byte
+static inline void appendNumber(string& record, unsigned long long number) {
+	for (; number >= 0x80; number >>= 7)
+		record += char((number & 0x7F) | 0x80);
+	record += char(number);
+}
+
+static unsigned long long readNumber(FILE* file) {
+	unsigned long long number = 0;
+	for (int shift = 0; ; shift += 7) {
+		int byte = getc(file);
+		if (byte == EOF) {
+			cerr << "The temporary file with the deferred reordering counts is truncated!!!" << endl;
+			exit(5);
+		}
+		number |= (unsigned long long)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return number;
+	}
+}
+
+static inline void appendCounts(string& record, const vector<double>& counts) {
+	for (size_t i = 0; i < counts.size(); appendNumber(record, (unsigned long long)counts[i++]));
+}
+
+static inline void readCounts(FILE* file, vector<double>& counts) {
+	for (size_t i = 0; i < counts.size(); counts[i++] = readNumber(file));
+}
+
+static inline void appendString(string& record, const string& text) {
+	appendNumber(record, text.size());
+	record += text;
+}
+
+static inline void readString(FILE* file, string& text) {
+	text.resize(readNumber(file));
+	if (!text.empty() && fread(&text[0], 1, text.size(), file) != text.size()) {
+		cerr << "The temporary file with the deferred reordering counts is truncated!!!" << endl;
+		exit(5);
+	}
+}
 
 
 ModelScore::ModelScore() {
@@ -49,15 +97,51 @@ void ModelScore::reset_f() {
   }
 }
 
-void ModelScore::add_example(const string& previous, string& next) { 
+void ModelScore::add_example(const StringPiece& previous, const StringPiece& next) { 
   count_fe_prev[getType(previous)]++;
   count_f_prev[getType(previous)]++;
   count_fe_next[getType(next)]++;
   count_f_next[getType(next)]++;
 }
 
+void ModelScore::add_counts(const ModelScore& other) {
+  for(int i=MONO; i<=NOMONO; ++i) {
+    count_fe_prev[i] += other.count_fe_prev[i];
+    count_fe_next[i] += other.count_fe_next[i];
+    count_f_prev[i] += other.count_f_prev[i];
+    count_f_next[i] += other.count_f_next[i];
+  }
+}
 
-ORIENTATION ModelScore::getType(const string& type) {
+void ModelScore::add_counts_fe(const ModelScore& other) {
+  for(int i=MONO; i<=NOMONO; ++i) {
+    count_fe_prev[i] += other.count_fe_prev[i];
+    count_fe_next[i] += other.count_fe_next[i];
+  }
+}
+
+void ModelScore::save_fe(string& record) const {
+	appendCounts(record, count_fe_prev);
+	appendCounts(record, count_fe_next);
+}
+
+void ModelScore::save_f(string& record) const {
+	appendCounts(record, count_f_prev);
+	appendCounts(record, count_f_next);
+}
+
+void ModelScore::load_fe(FILE* file) {
+	readCounts(file, count_fe_prev);
+	readCounts(file, count_fe_next);
+}
+
+void ModelScore::load_f(FILE* file) {
+	readCounts(file, count_f_prev);
+	readCounts(file, count_f_next);
+}
+
+
+ORIENTATION ModelScore::getType(const StringPiece& type) {
   if (type == "mono")
     return MONO;
 	else if (type == "swap")
@@ -77,7 +161,7 @@ ORIENTATION ModelScore::getType(const string& type) {
 }
 
 
-ORIENTATION ModelScoreMSLR::getType(const string& type) {
+ORIENTATION ModelScoreMSLR::getType(const StringPiece& type) {
   if (type == "mono")
     return MONO;
   else if (type == "swap")
@@ -96,7 +180,7 @@ ORIENTATION ModelScoreMSLR::getType(const string& type) {
 }
 
 
-ORIENTATION ModelScoreLR::getType(const string& type) {
+ORIENTATION ModelScoreLR::getType(const StringPiece& type) {
   if (type == "mono" || type == "dright")
     return DRIGHT;
 	else if (type == "swap" || type == "dleft")
@@ -111,7 +195,7 @@ ORIENTATION ModelScoreLR::getType(const string& type) {
 }
 
 
-ORIENTATION ModelScoreMSD::getType(const string& type) {
+ORIENTATION ModelScoreMSD::getType(const StringPiece& type) {
   if (type == "mono")
     return MONO;
 	else if (type == "swap")
@@ -127,7 +211,7 @@ ORIENTATION ModelScoreMSD::getType(const string& type) {
   }
 }
 
-ORIENTATION ModelScoreMonotonicity::getType(const string& type) {
+ORIENTATION ModelScoreMonotonicity::getType(const StringPiece& type) {
   if (type == "mono")
     return MONO;
 	else if (type == "swap" || type == "dleft" || type == "dright" || type == "other" || type == "nomono")
@@ -217,88 +301,138 @@ void ScorerLR::createConstSmoothing(double weight, vector<double>& smoothing) co
 void Model::score_fe(const string& f, const string& e)  {
   if (!fe) return;    //Make sure we do not do anything if it is not a fe model
 	
-	outputFile->writeLine(f + " ||| " + e + " ||| ");
-	
-  //condition on the previous phrase
-  if (previous) {
-    vector<double> scores;
-    scorer->score(modelscore->get_scores_fe_prev(), scores);
-    double sum = 0;
-    for(size_t i=0; i<scores.size(); ++i) {
-      scores[i] += smoothing_prev[i];
-      sum += scores[i];
-    }
-		stringstream out;
-		for (size_t i = 0; i < scores.size(); out << scores[i++]/sum << " ");
-		outputFile->writeLine(out.str());
-  }
-  //condition on the next phrase
-  if (next) {
-    vector<double> scores;
-    scorer->score(modelscore->get_scores_fe_next(), scores);
-    double sum = 0;
-    for(size_t i=0; i<scores.size(); ++i) {
-      scores[i] += smoothing_next[i];
-      sum += scores[i];
-    }
-		stringstream out;
-		for (size_t i = 0; i < scores.size(); out << scores[i++]/sum << " ");
-		outputFile->writeLine(out.str());
-  }
-	outputFile->writeLine("\n");
+	if (queue == NULL) {
+		output += f;
+		output += " ||| ";
+		output += e;
+		format(modelscore->get_scores_fe_prev(), modelscore->get_scores_fe_next());
+	} else {
+		if (batch == NULL)
+			batch = new Batch();
+		batch->text += f;
+		batch->text += " ||| ";
+		batch->text += e;
+		addToBatch(modelscore->get_scores_fe_prev(), modelscore->get_scores_fe_next());
+	}
 }
 
 void Model::score_f(const string& f) {
   if (fe) return;      //Make sure we do not do anything if it is not a f model
 	
-	outputFile->writeLine(f + " ||| ");
+	if (queue == NULL) {
+		output += f;
+		format(modelscore->get_scores_f_prev(), modelscore->get_scores_f_next());
+	} else {
+		if (batch == NULL)
+			batch = new Batch();
+		batch->text += f;
+		addToBatch(modelscore->get_scores_f_prev(), modelscore->get_scores_f_next());
+	}
+}
+
+void Model::addToBatch(const vector<double>& prevCounts, const vector<double>& nextCounts) {
+	batch->ends.push_back(batch->text.size());
+	batch->counts.insert(batch->counts.end(), prevCounts.begin(), prevCounts.end());
+	batch->counts.insert(batch->counts.end(), nextCounts.begin(), nextCounts.end());
+	if (batch->text.size() >= batchSize) {
+		queue->push(batch);
+		batch = NULL;
+	}
+}
+
+//Appends the scores for the phrase that is already in the output buffer
+void Model::format(const vector<double>& prevCounts, const vector<double>& nextCounts) {
+	output += " ||| ";
 	
   //condition on the previous phrase
   if (previous) {
     vector<double> scores;
-    scorer->score(modelscore->get_scores_f_prev(), scores);
+    scorer->score(prevCounts, scores);
     double sum = 0;
-    for(int i=0; i<scores.size(); ++i) {
+    for(size_t i=0; i<scores.size(); ++i) {
       scores[i] += smoothing_prev[i];
       sum += scores[i];
     }
-		stringstream out;
-		for (size_t i = 0; i < scores.size(); out << scores[i++]/sum << " ");
-		outputFile->writeLine(out.str());
+		for (size_t i = 0; i < scores.size(); ++i) {
+			appendFloat(output, scores[i]/sum);
+			output += ' ';
+		}
   }
   //condition on the next phrase
   if (next) {
     vector<double> scores;
-    scorer->score(modelscore->get_scores_f_next(), scores);
+    scorer->score(nextCounts, scores);
     double sum = 0;
-    for(int i=0; i<scores.size(); ++i) {
+    for(size_t i=0; i<scores.size(); ++i) {
       scores[i] += smoothing_next[i];
       sum += scores[i];
     }
-		stringstream out;
-		for (size_t i = 0; i < scores.size(); out << scores[i++]/sum << " ");
-		outputFile->writeLine(out.str());
+		for (size_t i = 0; i < scores.size(); ++i) {
+			appendFloat(output, scores[i]/sum);
+			output += ' ';
+		}
   }
-	outputFile->writeLine("\n");
+	output += '\n';
+	flush();
 }
 
-Model::Model(ModelScore* ms, Scorer* sc, const string& dir, const string& lang, const string& fn) : modelscore(ms), scorer(sc), outputFile(new Bz2LineWriter(fn)), fe(lang == "fe"), previous(dir != "forward"), next(dir != "backward") {
+void* Model::writeBatches(void* data) {
+	Model* model = static_cast<Model*>(data);
+	const size_t orientations = NOMONO + 1;
+	vector<double> prevCounts(orientations), nextCounts(orientations);
+	Batch* batch;
+	while (model->queue->pop(batch)) {
+		size_t begin = 0;
+		for (size_t i = 0; i < batch->ends.size(); ++i) {
+			model->output.append(batch->text, begin, batch->ends[i] - begin);
+			begin = batch->ends[i];
+			vector<double>::const_iterator counts = batch->counts.begin() + 2 * orientations * i;
+			prevCounts.assign(counts, counts + orientations);
+			nextCounts.assign(counts + orientations, counts + 2 * orientations);
+			model->format(prevCounts, nextCounts);
+		}
+		delete batch;
+	}
+	return NULL;
+}
+
+Model::Model(ModelScore* ms, Scorer* sc, const string& dir, const string& lang, const string& fn, unsigned threads) : modelscore(ms), scorer(sc), outputFile(fn.empty() ? NULL : new Bz2LineWriter(fn, Bz2LineWriter::COMPRESSED, threads)), queue(NULL), writer(NULL), batch(NULL), fe(lang == "fe"), previous(dir != "forward"), next(dir != "backward") {
 	if (!fe && lang != "f") {
     cerr << "You have given an illegal language to condition on: "  << lang << endl
 		<< "Legal types: fe (on both languages), f (only on source language)" << endl;
     exit(1);
   }
+	//With more than one thread each table is formatted and written on its own thread, so that several tables are written in parallel
+	if (outputFile != NULL && threads > 1) {
+		queue = new BoundedQueue<Batch*>(maxPendingBatches);
+		writer = new Thread();
+		writer->start(&writeBatches, this);
+	}
 }
 
 Model::~Model() {
+	if (queue != NULL) {
+		if (batch != NULL)
+			queue->push(batch);
+		queue->close();
+		writer->join();
+		delete writer;
+		delete queue;
+	}
 	delete outputFile;
-  delete modelscore;
   delete scorer;
 }
 
-Model* Model::createModel(ModelScore* modelscore, string config, const string& filepath) {
+void Model::flush() {
+	if (outputFile != NULL) {
+		outputFile->append(output);
+		output.clear();
+	}
+}
+
+Model* Model::createModel(ModelScore* modelscore, string config, const string& filepath, unsigned threads) {
 	//Save the filename first
-  string filename = filepath == "-" ? filepath : filepath + "." + config + ".bz2";
+  string filename = filepath.empty() || filepath == "-" ? filepath : filepath + "." + config + ".bz2";
 	//Take out the type
 	config = config.substr(config.find('-') + 1);
 	//Read the orientation
@@ -310,13 +444,13 @@ Model* Model::createModel(ModelScore* modelscore, string config, const string& f
 	string language = config.substr(config.find('-') + 1);
 
   if (orientation == "mslr")
-    return new Model(modelscore, new ScorerMSLR(), direction, language, filename);
+    return new Model(modelscore, new ScorerMSLR(), direction, language, filename, threads);
 	else if (orientation == "msd")
-    return new Model(modelscore, new ScorerMSD(), direction, language, filename);
+    return new Model(modelscore, new ScorerMSD(), direction, language, filename, threads);
 	else if (orientation == "monotonicity")
-    return new Model(modelscore, new ScorerMonotonicity(), direction, language, filename);
+    return new Model(modelscore, new ScorerMonotonicity(), direction, language, filename, threads);
 	else if (orientation == "leftright")
-    return new Model(modelscore, new ScorerLR(), direction, language, filename);
+    return new Model(modelscore, new ScorerLR(), direction, language, filename, threads);
 	else {
     cerr << "Illegal orientation type of reordering model: " << orientation << endl << " allowed types: mslr, msd, monotonicity, leftright" << endl;
     exit(1);
@@ -325,12 +459,234 @@ Model* Model::createModel(ModelScore* modelscore, string config, const string& f
 
 
 
-void Model::createSmoothing(double w)  {
-  scorer->createSmoothing(modelscore->get_scores_fe_prev(), w, smoothing_prev);
-  scorer->createSmoothing(modelscore->get_scores_fe_next(), w, smoothing_next);
+void Model::createSmoothing(double w, const ModelScore& counts)  {
+  scorer->createSmoothing(counts.get_scores_fe_prev(), w, smoothing_prev);
+  scorer->createSmoothing(counts.get_scores_fe_next(), w, smoothing_next);
 }
 
 void Model::createConstSmoothing(double w)  {
   scorer->createConstSmoothing(w, smoothing_prev);
   scorer->createConstSmoothing(w, smoothing_next);
 }
+
+
+ReorderingTable::ReorderingTable() : hier(false), phrase(false), wbe(false), first(true), deferredFile(NULL), deferredPairCount(0) {}
+
+ReorderingTable::~ReorderingTable() {
+	if (deferredFile != NULL)
+		fclose(deferredFile);
+	for (size_t i=0; i<models.size(); delete models[i++]);
+	for (map<string, ModelScore*>::const_iterator it = modelScores.begin(); it != modelScores.end(); delete (it++)->second);
+	for (map<string, ModelScore*>::const_iterator it = totalScores.begin(); it != totalScores.end(); delete (it++)->second);
+}
+
+void ReorderingTable::addModels(const string& configuration, const string& filepath, unsigned threads) {
+	//The configuration is a space-separated list: model type, orientation type and the specifications of the tables to produce
+	istringstream is(configuration);
+	string m,t;
+	is >> m >> t;
+	if (m != "hier" && m != "phrase" && m != "wbe") {
+		cerr << "WARNING: No models specified for lexical reordering. No lexical reordering table will be trained.\n";
+		exit(1);
+	}
+	hier = hier || m == "hier";
+	phrase = phrase || m == "phrase";
+	wbe = wbe || m == "wbe";
+	
+	ModelScore*& modelScore = modelScores[m];
+	if (modelScore != NULL) {
+		cerr << "The reordering model type " << m << " may only be given once; list all its tables in the same --model option" << endl;
+		exit(1);
+	}
+	modelScore = ModelScore::createModelScore(t);
+	
+	string config;
+	while (is >> config)
+		models.push_back(Model::createModel(modelScore, config, filepath, threads));
+}
+
+void ReorderingTable::createConstSmoothing(double w) {
+	for (size_t i=0; i<models.size(); models[i++]->createConstSmoothing(w));
+}
+
+void ReorderingTable::createSmoothing(double w, const ReorderingTable& counts) {
+	assert(counts.models.size() == models.size());
+	for (size_t i=0; i<models.size(); ++i)
+		models[i]->createSmoothing(w, counts.models[i]->getModelScore());
+	for (map<string, ModelScore*>::const_iterator it = modelScores.begin(); it != modelScores.end(); ++it) {
+		it->second->reset_fe();
+		it->second->reset_f();
+	}
+}
+
+void ReorderingTable::addExamples() {
+	if (hier) {
+		get_orientations(h, prev, next);
+		modelScores["hier"]->add_example(prev,next);
+	} 
+	if (phrase) {
+		get_orientations(p, prev, next);
+		modelScores["phrase"]->add_example(prev,next);
+	} 
+	if (wbe) {
+		get_orientations(w, prev, next);
+		modelScores["wbe"]->add_example(prev,next);
+	}
+}
+
+void ReorderingTable::count(const StringPiece& line) {
+	split_line(line,f,e,w,p,h);
+	addExamples();
+}
+
+void ReorderingTable::addCounts(const ReorderingTable& other) {
+	for (map<string, ModelScore*>::const_iterator it = modelScores.begin(); it != modelScores.end(); ++it) {
+		map<string, ModelScore*>::const_iterator o = other.modelScores.find(it->first);
+		if (o != other.modelScores.end())
+			it->second->add_counts(*o->second);
+	}
+}
+
+void ReorderingTable::addLine(const StringPiece& line) {
+	split_line(line,f,e,w,p,h);
+	
+	if (first) {
+		f.copyTo(f_current);
+		e.copyTo(e_current);
+		first = false;
+	} else if (f != f_current || e != e_current) {
+		scorePair();
+		if (f != f_current)
+			scoreSource();
+		
+		f.copyTo(f_current);
+		e.copyTo(e_current);
+	}
+	
+	// uppdate counts
+	addExamples();
+}
+
+void ReorderingTable::finish() {
+	if (first)
+		return;
+	//Score the last phrases
+	scorePair();
+	scoreSource();
+	first = true;
+}
+
+void ReorderingTable::scorePair() {
+	if (deferredFile == NULL)
+		//fe - score
+		for (size_t i=0; i<models.size(); models[i++]->score_fe(f_current, e_current));
+	else {
+		appendString(deferredPairs, e_current);
+		for (map<string,ModelScore*>::const_iterator it = modelScores.begin(); it != modelScores.end(); ++it) {
+			it->second->save_fe(deferredPairs);
+			totalScores[it->first]->add_counts_fe(*it->second);
+		}
+		++deferredPairCount;
+	}
+	//reset
+	for(map<string,ModelScore*>::const_iterator it = modelScores.begin(); it != modelScores.end(); (it++)->second->reset_fe());
+}
+
+void ReorderingTable::scoreSource() {
+	if (deferredFile == NULL)
+		//f - score
+		for (size_t i=0; i<models.size(); models[i++]->score_f(f_current));
+	else {
+		//Record layout: f, its counts, the number of pairs, and the pairs collected by scorePair()
+		string record;
+		appendString(record, f_current);
+		for (map<string,ModelScore*>::const_iterator it = modelScores.begin(); it != modelScores.end(); (it++)->second->save_f(record));
+		appendNumber(record, deferredPairCount);
+		if (fwrite(record.data(), 1, record.size(), deferredFile) != record.size() ||
+				fwrite(deferredPairs.data(), 1, deferredPairs.size(), deferredFile) != deferredPairs.size()) {
+			cerr << "Could not write the deferred reordering counts to the temporary file!!!" << endl;
+			exit(5);
+		}
+		deferredPairs.clear();
+		deferredPairCount = 0;
+	}
+	//reset
+	for(map<string,ModelScore*>::const_iterator it = modelScores.begin(); it != modelScores.end(); (it++)->second->reset_f());
+}
+
+void ReorderingTable::deferSmoothing(const string& tempDir) {
+	assert(first && deferredFile == NULL);
+	string pattern = tempDir + "/score-reordering.XXXXXX";
+	vector<char> name(pattern.begin(), pattern.end());
+	name.push_back('\0');
+	int file = mkstemp(&name[0]);
+	//The file is unlinked straight away, so that it disappears as soon as it is closed, however the program ends
+	if (file < 0 || unlink(&name[0]) != 0 || (deferredFile = fdopen(file, "w+b")) == NULL) {
+		cerr << "Could not create a temporary file in " << tempDir << "!!!" << endl;
+		exit(5);
+	}
+	setvbuf(deferredFile, NULL, _IOFBF, 1 << 20);
+	for (map<string,ModelScore*>::const_iterator it = modelScores.begin(); it != modelScores.end(); ++it)
+		totalScores[it->first] = new ModelScore();
+}
+
+void ReorderingTable::scoreDeferred(double w) {
+	assert(first && deferredFile != NULL);
+	//The global counts are handed to the models through the (reset) model scores
+	for (map<string,ModelScore*>::const_iterator it = modelScores.begin(); it != modelScores.end(); ++it)
+		it->second->add_counts_fe(*totalScores[it->first]);
+	createSmoothing(w, *this);
+	
+	fflush(deferredFile);
+	rewind(deferredFile);
+	//Stop recording, so that only the models are scored from now on
+	FILE* file = deferredFile;
+	deferredFile = NULL;
+	while (true) {
+		int c = getc(file);
+		if (c == EOF)
+			break;
+		ungetc(c, file);
+		readString(file, f_current);
+		for (map<string,ModelScore*>::const_iterator it = modelScores.begin(); it != modelScores.end(); (it++)->second->load_f(file));
+		for (unsigned long long pairs = readNumber(file); pairs > 0; --pairs) {
+			readString(file, e_current);
+			for (map<string,ModelScore*>::const_iterator it = modelScores.begin(); it != modelScores.end(); (it++)->second->load_fe(file));
+			for (size_t i=0; i<models.size(); models[i++]->score_fe(f_current, e_current));
+		}
+		for (size_t i=0; i<models.size(); models[i++]->score_f(f_current));
+	}
+	fclose(file);
+	for(map<string,ModelScore*>::const_iterator it = modelScores.begin(); it != modelScores.end(); ++it) {
+		it->second->reset_fe();
+		it->second->reset_f();
+	}
+}
+
+void ReorderingTable::split_line(const StringPiece& line, StringPiece& foreign, StringPiece& english, StringPiece& wbe, StringPiece& phrase, StringPiece& hier) {
+	StringPiece field[3];
+	splitFields(line, field, 3);
+	foreign = field[0];
+	english = field[1];
+	
+	// the orientations of the three model types are separated by " | "
+	const StringPiece orientations = field[2];
+	size_t begin = 0;
+	size_t end = orientations.find(" | ");
+	wbe = orientations.substr(begin, end - begin);
+	
+	begin = end == StringPiece::npos ? orientations.size() : end + 3;
+	end = orientations.find(" | ", begin);
+	phrase = orientations.substr(begin, end - begin);
+	
+	begin = end == StringPiece::npos ? orientations.size() : end + 3;
+	hier = orientations.substr(begin);
+}
+
+void ReorderingTable::get_orientations(const StringPiece& pair, StringPiece& previous, StringPiece& next) {
+	TokenIterator tokens(pair);
+	if (!tokens.next(previous))
+		previous = StringPiece();
+	if (!tokens.next(next))
+		next = StringPiece();
+}
@@ -10,12 +10,16 @@
 
 #pragma once
 
+#include <cstdio>
+#include <map>
 #include <vector>
 #include <numeric>
 #include <sstream>
 #include <string>
 
 #include "Bz2LineWriter.h"
+#include "StringPiece.h"
+#include "Threading.h"
 
 using namespace std;
 using namespace bg_zhechev_ventsislav;
@@ -32,11 +36,20 @@ class ModelScore {
   vector<double> count_f_next;
 	
 protected:
-  virtual ORIENTATION getType(const string& s); 
+  virtual ORIENTATION getType(const StringPiece& s); 
 	
 public:
   ModelScore();
-  void add_example(const string& previous, string& next);
+  void add_example(const StringPiece& previous, const StringPiece& next);
+  //Adds all counts of another model score (of the same type)
+  void add_counts(const ModelScore& other);
+  //Adds only the (f, e) counts of another model score
+  void add_counts_fe(const ModelScore& other);
+  //Compact storage of the counts for deferred scoring
+  void save_fe(string& record) const;
+  void save_f(string& record) const;
+  void load_fe(FILE* file);
+  void load_f(FILE* file);
   void reset_fe();
   void reset_f();
   inline const vector<double>& get_scores_fe_prev() const { return count_fe_prev; }
@@ -49,22 +62,22 @@ public:
 
 class ModelScoreMSLR : public ModelScore {
 protected:
-  virtual ORIENTATION getType(const string& s);
+  virtual ORIENTATION getType(const StringPiece& s);
 };
 
 class ModelScoreLR : public ModelScore {
 protected:
-  virtual ORIENTATION getType(const string& s);
+  virtual ORIENTATION getType(const StringPiece& s);
 };
 
 class ModelScoreMSD : public ModelScore {
 protected:
-  virtual ORIENTATION getType(const string& s);
+  virtual ORIENTATION getType(const StringPiece& s);
 };
 
 class ModelScoreMonotonicity : public ModelScore {
 protected:
-  virtual ORIENTATION getType(const string& s);
+  virtual ORIENTATION getType(const StringPiece& s);
 };
 
 //Class for calculating total counts, and to calculate smoothing
@@ -102,11 +115,27 @@ struct ScorerLR : public Scorer {
 //Class for representing each model 
 //Contains a modelscore and scorer (which can be of different model types (mslr, msd...)), and file handling. 
 //This class also keeps track of bidirectionality, and which language to condition on
+//The modelscore is shared between the models of the same type and is not owned by the model.
 class Model {
   ModelScore* modelscore;
   Scorer* scorer;
 	
+	//The scores are collected in the output buffer and handed on to the output file (if there is one) after each phrase
 	Bz2LineWriter* outputFile;
+	string output;
+	
+	//With a writer thread the phrases and their counts are handed over in batches and only formatted on that thread
+	struct Batch {
+		string text;
+		vector<size_t> ends;
+		//The previous and next counts of each phrase, NOMONO+1 each
+		vector<double> counts;
+	};
+	static const size_t batchSize = 1 << 16;
+	static const size_t maxPendingBatches = 8;
+	BoundedQueue<Batch*>* queue;
+	Thread* writer;
+	Batch* batch;
 	
   bool fe;
   bool previous;
@@ -115,15 +144,86 @@ class Model {
   vector<double> smoothing_prev;
   vector<double> smoothing_next;
 
+	void flush();
+	void format(const vector<double>& prevCounts, const vector<double>& nextCounts);
+	void addToBatch(const vector<double>& prevCounts, const vector<double>& nextCounts);
+	static void* writeBatches(void* data);
+	
 	//Hide the default constructor
 	Model() {}
 public:
-  Model(ModelScore* ms, Scorer* sc, const string& dir, const string& lang, const string& fn);
+  Model(ModelScore* ms, Scorer* sc, const string& dir, const string& lang, const string& fn, unsigned threads = 1);
   ~Model();
-  static Model* createModel(ModelScore*, string, const string&);
-  void createSmoothing(double w);
+  //Without a filepath the output is only collected in the output buffer
+  static Model* createModel(ModelScore*, string, const string&, unsigned threads = 1);
+  void createSmoothing(double w, const ModelScore& counts);
   void createConstSmoothing(double w);
   void score_fe(const string& f, const string& e);
   void score_f(const string& f);
+	inline const ModelScore& getModelScore() const { return *modelscore; }
+	inline string& getOutput() { return output; }
 };
 
+//Scores the lines of a sorted orientation extract file (f ||| e ||| wbe | phrase | hier) with a set of models.
+//Each (f, e) and f group is scored as soon as the first line of the next group (or finish()) is seen.
+class ReorderingTable {
+  map<string, ModelScore*> modelScores;
+  vector<Model*> models;
+  bool hier;
+  bool phrase;
+  bool wbe;
+	
+  string f_current, e_current;
+	bool first;
+	
+  //Views of the current line
+  StringPiece e, f, w, p, h;
+  StringPiece prev, next;
+	
+	//With deferred smoothing the counts of each f group are stored in this file instead of being scored
+	FILE* deferredFile;
+	//The (e, counts) records of the current f group and their number
+	string deferredPairs;
+	unsigned long deferredPairCount;
+	//Global (f, e) counts for the smoothing, one for each model type
+	map<string, ModelScore*> totalScores;
+	
+	void addExamples();
+	void scorePair();
+	void scoreSource();
+	
+	//Disable copying
+	ReorderingTable(const ReorderingTable&);
+	ReorderingTable& operator=(const ReorderingTable&);
+public:
+	ReorderingTable();
+	~ReorderingTable();
+	
+	//Adds the models given as "type max-orientation (specification-strings)", e.g. "hier msd hier-msd-backward-f hier-msd-bidirectional-fe".
+	//The tables are written to filepath.specification-string.bz2; without a filepath the output is left in the buffers of the models.
+	void addModels(const string& configuration, const string& filepath, unsigned threads = 1);
+	inline size_t size() const { return models.size(); }
+	inline Model& getModel(size_t i) { return *models[i]; }
+	
+	void createConstSmoothing(double w);
+	//Smoothing based on the orientation counts collected with count() in a table with the same models (possibly this one).
+	//The counts of this table are reset afterwards, so that scoring starts from scratch.
+	void createSmoothing(double w, const ReorderingTable& counts);
+	
+	//Adds the orientations of a line to the global counts used for smoothing
+	void count(const StringPiece& line);
+	//Adds the global counts of another table with the same models
+	void addCounts(const ReorderingTable& other);
+	
+	void addLine(const StringPiece& line);
+	void finish();
+	
+	//Instead of scoring them right away, addLine() and finish() store the counts of the phrases in a temporary file in tempDir,
+	//while the global counts for the smoothing are collected. This allows smoothing with counts in a single pass over the extract file.
+	void deferSmoothing(const string& tempDir);
+	//Creates the smoothing from the global counts and scores the stored phrases; call after finish()
+	void scoreDeferred(double w);
+	
+	static void split_line(const StringPiece& line, StringPiece& foreign, StringPiece& english, StringPiece& wbe, StringPiece& phrase, StringPiece& hier);
+	static void get_orientations(const StringPiece& pair, StringPiece& previous, StringPiece& next);
+};
@@ -10,100 +10,109 @@
 
 #include "Bz2LineReader.h"
 
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
 namespace bg_zhechev_ventsislav {
-	string readChunk(istream& input, char delim = '\n', bool includeLast = false) {
-		if (input.fail())
-			return "";
-		
-		string output = "";
-		
-		char lastChar = '\0';
-		if (input.good())
-			lastChar = input.peek();
-		if (lastChar == delim) {
-			input.get();
-			if (includeLast)
-				output += lastChar;
-			return output;
-		}
-		
-		char ln[Bz2LineReader::bufSize];
-		input.get(ln, Bz2LineReader::bufSize, delim);
-		if (input.fail())
-			return "";
-		output += ln;
-		if (input.gcount() <= Bz2LineReader::bufSize && input.good())
-			lastChar = input.peek();
-#ifdef __debug_chunk__
-		cerr << "??? “" << lastChar << "” ??? output: “" << output << "”" << endl;
-#endif
-		while (lastChar != delim && input.good()) {
-			input.get(ln, Bz2LineReader::bufSize, delim);
-			if (input.fail()) {
-				if (includeLast) {
-					return output + delim;
-				} else {
-					return output;
-				}
-			}
-			output += ln;
-			if (input.gcount() <= Bz2LineReader::bufSize && input.good())
-				lastChar = input.peek();
-#ifdef __debug_chunk__
-			cerr << "??? “" << lastChar << "” ??? output: “" << output << "”" << endl;
-#endif
+	//A bzip2 stream starts with the “BZh” header and the block size, followed by the magic number of its first block
+	static const char blockMagic[] = {0x31, 0x41, 0x59, 0x26, 0x53, 0x59};
+	static const size_t streamStartLength = 10;
+	static const size_t readSize = 1 << 20;
+	//Stretches of the file without any stream starts are cut into segments of this size and decompressed serially
+	static const size_t maxSegment = 1 << 23;
+	
+	static inline bool isStreamStart(const char* data) {
+		return data[0] == 'B' && data[1] == 'Z' && data[2] == 'h' && data[3] >= '1' && data[3] <= '9' && memcmp(data + 4, blockMagic, sizeof(blockMagic)) == 0;
+	}
+	
+	//Feeds input from offset onwards to the stream, appending the decompressed data to output.
+	//Returns BZ_OK if all input was consumed before the end of the stream, BZ_STREAM_END (leaving any unused input in stream->avail_in) or an error code.
+	static int decompress(bz_stream* stream, const string& input, size_t offset, string& output) {
+		static const size_t minSpace = 1 << 16;
+		stream->next_in = const_cast<char*>(input.data()) + offset;
+		stream->avail_in = input.size() - offset;
+		size_t produced = output.size();
+		int result = BZ_OK;
+		while (result == BZ_OK) {
+			if (output.size() - produced < minSpace)
+				output.resize(produced + (produced > minSpace ? produced : minSpace));
+			stream->next_out = &output[produced];
+			stream->avail_out = output.size() - produced;
+			result = BZ2_bzDecompress(stream);
+			produced = output.size() - stream->avail_out;
+			if (result == BZ_OK && stream->avail_in == 0 && stream->avail_out > 0)
+				break;
 		}
-		
-#ifdef __debug_chunk__
-		if (!input.good())
-			wcerr << L"÷÷÷Terminated input loop due to bad input!!!÷÷÷" << endl;
-		else
-			wcerr << L"±±±Terminated input loop due to reaching delimiting character.±±±" << endl;
-#endif
-		
-		if (input.good() && lastChar == delim) {
-			if (includeLast)
-				output += lastChar;
-			input.get();
+		output.resize(produced);
+		return result;
+	}
+	
+	static bz_stream* newStream() {
+		bz_stream* stream = new bz_stream();
+		if (BZ2_bzDecompressInit(stream, 0, 0) != BZ_OK) {
+			/* handle error */
+			wcout << L"Trouble reading the stupid file!!!" << endl;
+			exit(6);
 		}
-		
-#ifdef __debug_chunk__
-		cerr << " " << output << endl;
-#endif
-		
-		return output;
+		return stream;
 	}
 	
-	void Bz2LineReader::processBuffer(char buf[], size_t bufLen) {
-		for (size_t i = 0; i < bufLen; dataBuf += buf[i++]);
+	static void closeStream(bz_stream*& stream) {
+		BZ2_bzDecompressEnd(stream);
+		delete stream;
+		stream = NULL;
 	}
 	
-	bool Bz2LineReader::findLine(bool includeLast) {
-		string::size_type lineBreak = dataBuf.find('\n');
-		if (lineBreak == string::npos) {
-			line += dataBuf;
-			dataBuf.clear();
-			return false;
-		} else {
-			line += dataBuf.substr(0, lineBreak + (includeLast ? 1 : 0));
-			dataBuf = dataBuf.substr(lineBreak + 1);
-			return true;
+	//A segment of the compressed file, starting at a stream start, that is decompressed by a worker thread.
+	//Segments that do not start at a stream start (continuations) are left to the reader, which decompresses them in order as part of the preceding stream.
+	struct Bz2DecompressionJob : public OrderedJob {
+		string input;
+		bool continuation;
+		string output;
+		//Still open if the segment ended before its stream did
+		bz_stream* stream;
+		//Input consumed up to the end of the stream
+		size_t consumed;
+		bool failed;
+		
+		Bz2DecompressionJob(bool cont) : continuation(cont), stream(NULL), consumed(0), failed(false) {}
+		~Bz2DecompressionJob() {
+			if (stream != NULL)
+				closeStream(stream);
 		}
-	}
 		
-	Bz2LineReader::Bz2LineReader(const string& fileName, bool plain) : charsRead(0), bzerror(BZ_OK), line(string()), finished(false), uncompressed(plain || fileName == "-" || fileName.find(".bz2") == string::npos), in(NULL), dataBuf(string()), open(true) {
+		void run() {
+			if (continuation)
+				return;
+			stream = newStream();
+			int result = decompress(stream, input, 0, output);
+			if (result == BZ_OK)
+				consumed = input.size();
+			else {
+				if (result == BZ_STREAM_END)
+					consumed = input.size() - stream->avail_in;
+				else
+					failed = true;
+				closeStream(stream);
+			}
+		}
+	};
+	
+	Bz2LineReader::Bz2LineReader(const string& fileName, bool plain, unsigned threadCount) : bzip2Handle(NULL), bzerror(BZ_OK), buffer(bufferSize), lineStart(0), scanned(0), dataEnd(0), finished(false), uncompressed(plain || fileName == "-" || fileName.find(".bz2") == string::npos), plainFile(-1), open(true), threads(threadCount > 0 ? threadCount : 1), pool(NULL), blockReader(NULL), stopReading(false), openStream(NULL), blockPos(0) {
 		if (uncompressed) {
 //			cerr << "UNCOMPRESSED INPUT!!!" << endl;
 			if (fileName != "-") {
-				uncompressedFile.open(fileName.c_str());
-				if (uncompressedFile.fail()) {
+				plainFile = ::open(fileName.c_str(), O_RDONLY);
+				if (plainFile < 0) {
 					/* handle error */
 					wcout << L"Could not open the stupid file!!!" << endl;
 					exit(3);
 				}
-				in = new istream(uncompressedFile.rdbuf());
 			} else
-				in = new istream(cin.rdbuf());
+				plainFile = STDIN_FILENO;
 		} else {
 //			cerr << "COMPRESSED INPUT!!!" << endl;
 			plainHandle = fopen(fileName.c_str(), "r");
@@ -112,6 +121,12 @@ namespace bg_zhechev_ventsislav {
 				wcout << L"Could not open the stupid file!!!" << endl;
 				exit(5);
 			}
+			if (threads > 1) {
+				pool = new OrderedWorkerPool(threads, 2 * threads);
+				blockReader = new Thread();
+				blockReader->start(&readBlocks, this);
+				return;
+			}
 			bzip2Handle = BZ2_bzReadOpen(&bzerror, plainHandle, 1, 0, NULL, 0);
 			if (bzerror != BZ_OK) {
 				BZ2_bzReadClose(&bzerror, bzip2Handle);
@@ -124,74 +139,282 @@ namespace bg_zhechev_ventsislav {
 		}
 	}
 	
-	string Bz2LineReader::readLine(bool includeLast) {
-		if (uncompressed)
-			return readChunk(*in, '\n', includeLast);
-		else {
+	void Bz2LineReader::close() {
+		if (!open) return;
+		if (uncompressed) {
+			if (plainFile != STDIN_FILENO)
+				::close(plainFile);
+		} else if (pool != NULL) {
+			{
+				ScopedLock lock(stopMutex);
+				stopReading = true;
+			}
+			pool->finish();
+			blockReader->join();
+			delete blockReader;
+			delete pool;
+			pool = NULL;
+			if (openStream != NULL)
+				closeStream(openStream);
+			fclose(plainHandle);
+		} else {
+			if (bzip2Handle != NULL)
+				BZ2_bzReadClose(&bzerror, bzip2Handle);
+			fclose(plainHandle);
+		}
+		vector<char>().swap(buffer);
+		lineStart = scanned = dataEnd = 0;
+		finished = true;
+		open = false;
+	}
+	
+	bool Bz2LineReader::readLine(StringPiece& line, bool includeLast) {
+		for (;;) {
+			char* data = buffer.empty() ? NULL : &buffer[0];
+			const char* lineBreak = dataEnd > scanned ? static_cast<const char*>(memchr(data + scanned, '\n', dataEnd - scanned)) : NULL;
+			if (lineBreak != NULL) {
+				size_t lineEnd = lineBreak - data;
+				line = StringPiece(data + lineStart, lineEnd - lineStart + (includeLast ? 1 : 0));
+				lineStart = scanned = lineEnd + 1;
+				return true;
+			}
+			scanned = dataEnd;
+			
+			if (finished) {
+				if (lineStart == dataEnd) {
+					line = StringPiece();
+					return false;
+				}
+				//The last line of the file has no line break
+				line = StringPiece(data + lineStart, dataEnd - lineStart);
+				lineStart = dataEnd;
+				return true;
+			}
 			
-			assert (!finished || bzerror != BZ_STREAM_END);
-		
 #ifdef __debug_reader__
-//		Debugger();
-			wcerr << L"Trying to get a line… (finished is " << finished << L", bzerror is " << bzerror << L")" << endl;
+			wcerr << L"Getting more data from the file…" << endl;
 #endif
+			//Move the incomplete line to the front of the buffer, and make room if it fills the whole buffer
+			if (lineStart > 0) {
+				memmove(data, data + lineStart, dataEnd - lineStart);
+				dataEnd -= lineStart;
+				scanned -= lineStart;
+				lineStart = 0;
+			}
+			if (dataEnd == buffer.size())
+				buffer.resize(buffer.size() * 2);
+			
+			size_t count = fill(&buffer[dataEnd], buffer.size() - dataEnd);
+			if (count == 0)
+				finished = true;
+			dataEnd += count;
+		}
+	}
+	
+	string Bz2LineReader::readLine(bool includeLast) {
+		StringPiece line;
+		if (!readLine(line, includeLast))
+			return string();
+		return line.as_string();
+	}
+	
+	//Reads up to space bytes of (decompressed) data into target. Returns 0 only at the end of the file.
+	size_t Bz2LineReader::fill(char* target, size_t space) {
+		if (uncompressed) {
+			for (;;) {
+				ssize_t count = ::read(plainFile, target, space);
+				if (count >= 0)
+					return count;
+				if (errno != EINTR) {
+					/* handle error */
+					wcout << L"Trouble reading the stupid file again!!!" << endl;
+					exit(7);
+				}
+			}
+		}
 		
-			if (findLine(includeLast)) {
-#ifdef __debug_reader__
-				wcerr << L"±±Apparently there was a line in the local buffer." << endl;
-#endif
-				string out = line;
-				line = "";
-				return out;
+		if (pool != NULL) {
+			while (blockPos == block.size()) {
+				if (!readBlock())
+					return 0;
+				blockPos = 0;
 			}
-
-			if (!finished) {
-				if (bzerror == BZ_OK) {
-#ifdef __debug_reader__
-					wcerr << L"Getting more data from compressed file…" << endl;
-#endif
-					while (bzerror == BZ_OK) {
-						charsRead = BZ2_bzRead(&bzerror, bzip2Handle, buf, bufSize);
-						if (bzerror == BZ_OK) {
-							processBuffer(buf, charsRead);
-							if (findLine(includeLast)) {
-								string out = line;
-								line = "";
-								return out;
-							}
-						}
-					}
-					if (bzerror != BZ_STREAM_END) {
-						BZ2_bzReadClose(&bzerror, bzip2Handle);
-						/* handle error */
-						wcout << L"Trouble reading the stupid file again!!!" << endl;
-						exit(7);
-					}
+			size_t count = min(space, block.size() - blockPos);
+			memcpy(target, block.data() + blockPos, count);
+			blockPos += count;
+			return count;
+		}
+		
+		while (bzip2Handle != NULL) {
+			int count = BZ2_bzRead(&bzerror, bzip2Handle, target, (int)min(space, (size_t)(1 << 30)));
+			if (bzerror != BZ_OK && bzerror != BZ_STREAM_END) {
+				BZ2_bzReadClose(&bzerror, bzip2Handle);
+				bzip2Handle = NULL;
+				/* handle error */
+				wcout << L"Trouble reading the stupid file again!!!" << endl;
+				exit(7);
+			}
+			if (bzerror == BZ_STREAM_END)
+				nextStream();
+			if (count > 0)
+				return count;
+		}
+		return 0;
+	}
+	
+	//A .bz2 file may consist of several concatenated streams (as written by pbzip2 or a multi-threaded Bz2LineWriter), so reading continues after the end of each stream.
+	//Returns false if there are no more streams in the file.
+	bool Bz2LineReader::nextStream() {
+		void* unused;
+		int unusedLength;
+		BZ2_bzReadGetUnused(&bzerror, bzip2Handle, &unused, &unusedLength);
+		string trailing(static_cast<char*>(unused), unusedLength);
+		BZ2_bzReadClose(&bzerror, bzip2Handle);
+		bzip2Handle = NULL;
+		
+		if (trailing.empty()) {
+			int next = fgetc(plainHandle);
+			if (next == EOF)
+				return false;
+			ungetc(next, plainHandle);
+		}
+		
+		bzip2Handle = BZ2_bzReadOpen(&bzerror, plainHandle, 1, 0, trailing.empty() ? NULL : &trailing[0], trailing.size());
+		if (bzerror != BZ_OK) {
+			BZ2_bzReadClose(&bzerror, bzip2Handle);
+			bzip2Handle = NULL;
+			/* handle error */
+			wcout << L"Trouble reading the stupid file again!!!" << endl;
+			exit(7);
+		}
+		return true;
+	}
+	
+	//Takes the next segment from the worker threads. Returns false once all segments have been read.
+	bool Bz2LineReader::readBlock() {
+		OrderedJob* next = pool->next();
+		if (next == NULL) {
+			if (openStream != NULL) {
+				/* handle error */
+				wcout << L"The stupid file ends unexpectedly!!!" << endl;
+				exit(7);
+			}
+			return false;
+		}
+		
+		Bz2DecompressionJob* job = static_cast<Bz2DecompressionJob*>(next);
+		block.clear();
+		if (openStream != NULL || job->continuation) {
+			//Either the segment was cut without a stream start, or it was split at data that only looked like one—the worker’s output is of no use then
+			continueStream(job->input, 0);
+		} else if (job->failed) {
+			/* handle error */
+			wcout << L"Trouble reading the stupid file again!!!" << endl;
+			exit(7);
+		} else {
+			block.swap(job->output);
+			if (job->stream != NULL) {
+				openStream = job->stream;
+				job->stream = NULL;
+			} else if (job->consumed < job->input.size())
+				continueStream(job->input, job->consumed);
+		}
+		delete job;
+		
+		return true;
+	}
+	
+	//Decompresses data from offset onwards in the reader thread, continuing the open stream or starting new ones as needed
+	void Bz2LineReader::continueStream(const string& data, size_t offset) {
+		while (offset < data.size()) {
+			if (openStream == NULL) {
+				if (data.compare(offset, 3, "BZh") != 0) {
+					/* handle error */
+					wcout << L"Trouble reading the stupid file again!!!" << endl;
+					exit(7);
 				}
-				if (bzerror == BZ_STREAM_END) {
-#ifdef __debug_reader__
-					wcerr << L"Finishing up reading from compressed file…" << endl;
-#endif
-					bzerror = BZ_OK;
-					processBuffer(buf, charsRead);
-					finished = true;
-					if (findLine(includeLast)) {
-						string out = line;
-						line = "";
-						return out;
-					}
+				openStream = newStream();
+			}
+			int result = decompress(openStream, data, offset, block);
+			if (result == BZ_OK)
+				return;
+			if (result != BZ_STREAM_END) {
+				/* handle error */
+				wcout << L"Trouble reading the stupid file again!!!" << endl;
+				exit(7);
+			}
+			offset = data.size() - openStream->avail_in;
+			closeStream(openStream);
+		}
+	}
+	
+	bool Bz2LineReader::isStopped() {
+		ScopedLock lock(stopMutex);
+		return stopReading;
+	}
+	
+	//Runs in a separate thread, splitting the compressed file into segments at the stream starts and queueing them for decompression
+	void* Bz2LineReader::readBlocks(void* data) {
+		Bz2LineReader* reader = static_cast<Bz2LineReader*>(data);
+		string segment;
+		bool continuation = false;
+		//Position 0 of a segment is always the start of the file or of a stream, so scanning starts after it
+		size_t scanFrom = 1;
+		vector<char> chunk(readSize);
+		while (!reader->isStopped()) {
+			size_t length = fread(&chunk[0], 1, readSize, reader->plainHandle);
+			if (length == 0) {
+				if (ferror(reader->plainHandle)) {
+					/* handle error */
+					wcout << L"Trouble reading the stupid file again!!!" << endl;
+					exit(7);
 				}
+				break;
 			}
-#ifdef __debug_reader__
-			wcerr << L"   Aparently there is no more data in the compressed file." << endl;
-#endif
-		
-			return "";
+			segment.append(&chunk[0], length);
+			if (segment.size() < streamStartLength)
+				continue;
+			
+			const char* base = segment.data();
+			size_t scanTo = segment.size() - streamStartLength + 1;
+			size_t segmentStart = 0;
+			for (size_t position = scanFrom; position < scanTo; ++position) {
+				const char* candidate = static_cast<const char*>(memchr(base + position, 'B', scanTo - position));
+				if (candidate == NULL)
+					break;
+				position = candidate - base;
+				if (isStreamStart(candidate)) {
+					Bz2DecompressionJob* job = new Bz2DecompressionJob(continuation);
+					job->input.assign(segment, segmentStart, position - segmentStart);
+					reader->pool->submit(job);
+					continuation = false;
+					segmentStart = position;
+				}
+			}
+			segment.erase(0, segmentStart);
+			scanFrom = scanTo - segmentStart;
+			
+			if (segment.size() > maxSegment) {
+				Bz2DecompressionJob* job = new Bz2DecompressionJob(continuation);
+				job->input.assign(segment, 0, scanFrom);
+				reader->pool->submit(job);
+				segment.erase(0, scanFrom);
+				continuation = true;
+				scanFrom = 1;
+			}
+		}
+		if (!segment.empty() && !reader->isStopped()) {
+			Bz2DecompressionJob* job = new Bz2DecompressionJob(continuation);
+			job->input.swap(segment);
+			reader->pool->submit(job);
 		}
+		reader->pool->finish();
+		
+		return NULL;
 	}
 	
 	string Bz2LineReader::readLine(unsigned maxLength, bool includeLast) {
-		string out(readLine(), includeLast);
+		string out(readLine(includeLast));
 		if (out.length() > maxLength)
 			return out.substr(0, maxLength);
 		else
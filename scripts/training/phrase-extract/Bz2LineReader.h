@@ -4,6 +4,7 @@
  *
  *  Created by Венцислав Жечев on 17.10.09.
  *  © 2009–2011 Венцислав Жечев. All rights reserved.
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
  *
  */
 
@@ -12,12 +13,15 @@
 
 #include <cassert>
 #include <iostream>
-#include <fstream>
 #include <string>
+#include <vector>
 
 #include <bzlib.h>
 #include <cerrno>
 
+#include "StringPiece.h"
+#include "Threading.h"
+
 using namespace std;
 
 namespace bg_zhechev_ventsislav {
@@ -25,46 +29,55 @@ namespace bg_zhechev_ventsislav {
 	class Bz2LineReader {
 		FILE* plainHandle;
 		BZFILE* bzip2Handle;
-		unsigned charsRead;
-		static const unsigned bufSize = 100;
-		char buf[bufSize];
 		int bzerror;
-		string line;
-		string dataBuf;
+		
+		//Data is read into a large buffer that is reused for the lifetime of the reader and lines are handed out as slices of it.
+		//The buffer only grows if a single line does not fit into it.
+		static const size_t bufferSize = 1 << 22;
+		vector<char> buffer;
+		size_t lineStart;
+		//Line breaks have already been searched for up to this position
+		size_t scanned;
+		size_t dataEnd;
 		bool finished;
 		
 		bool uncompressed;
-		ifstream uncompressedFile;
-		istream *in;
+		int plainFile;
 		
 		bool open;
 		
+		//Block-parallel decompression: a separate thread splits the compressed file at the starts of bzip2 streams and the streams are decompressed on a pool of worker threads
+		unsigned threads;
+		OrderedWorkerPool* pool;
+		Thread* blockReader;
+		//Set by close() and polled by the block reader thread, only under stopMutex
+		bool stopReading;
+		Mutex stopMutex;
+		bz_stream* openStream;
+		string block;
+		size_t blockPos;
+		
 		//Disable default constructor
 		Bz2LineReader() {}
 
-		void processBuffer(char buf[], size_t bufLen);
-		bool findLine(bool includeLast = false);
-		
-		friend string readChunk(istream& input, char delim, bool includeLast);
+		size_t fill(char* target, size_t space);
+		bool nextStream();
+		bool readBlock();
+		void continueStream(const string& data, size_t offset);
+		static void* readBlocks(void* data);
+		bool isStopped();
 	public:
-		Bz2LineReader(const string& fileName, bool plain = false);
+		//With threads > 1 the streams of a multi-stream compressed file (as written by a multi-threaded Bz2LineWriter or pbzip2) are decompressed in parallel
+		Bz2LineReader(const string& fileName, bool plain = false, unsigned threads = 1);
 		~Bz2LineReader() { close(); }
 		
-		inline void close() {
-			if (!open) return;
-			if (uncompressed) {
-				if (in != NULL) {
-					delete in;
-					if (uncompressedFile.is_open())
-						uncompressedFile.close();
-				}
-			} else {
-				BZ2_bzReadClose(&bzerror, bzip2Handle);
-				fclose(plainHandle);
-			}
-			open = false;
-		}
+		void close();
+		
+		//Points line to the next line in the file (without the line break, unless includeLast is set). Returns false at the end of the file.
+		//The line is only valid until the next call to readLine() or close().
+		bool readLine(StringPiece& line, bool includeLast = false);
 		
+		//Return a copy of the next line, or an empty string at the end of the file
 		string readLine(bool includeLast = false);
 		string readLine(unsigned maxLength, bool includeLast = false);
 
@@ -4,15 +4,65 @@
  *
  *  Created by Венцислав Жечев on 02.03.11.
  *  © 2011 Венцислав Жечев. All rights reserved.
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
  *
  */
 
 #include "Bz2LineWriter.h"
 
+#include <cstdio>
+
 
 namespace bg_zhechev_ventsislav {
 	
-	Bz2LineWriter::Bz2LineWriter(const string& fileName, bool plain) : bzerror(BZ_OK), uncompressed(plain || fileName == "-" || fileName.find(".bz2") == string::npos), out(NULL), open(true) {
+	//A block of output that is compressed into a complete bzip2 stream of its own
+	struct Bz2CompressionJob : public OrderedJob {
+		string input;
+		string output;
+		int level;
+		
+		Bz2CompressionJob(int compressionLevel) : level(compressionLevel) {}
+		
+		void run() {
+			//Worst case expansion as documented for BZ2_bzBuffToBuffCompress
+			unsigned outputLength = input.size() + input.size() / 100 + 600;
+			output.resize(outputLength);
+			int result = BZ2_bzBuffToBuffCompress(&output[0], &outputLength, const_cast<char*>(input.data()), input.size(), level, 0, 0);
+			if (result != BZ_OK) {
+				/* handle error */
+				wcout << L"Trouble compressing a block for the stupid file!!!" << endl;
+				exit(6);
+			}
+			output.resize(outputLength);
+			string().swap(input);
+		}
+	};
+	
+	void appendInt(string& target, long number) {
+		if (number < 0) {
+			target += '-';
+			appendUnsigned(target, 0UL - (unsigned long)number);
+		} else
+			appendUnsigned(target, number);
+	}
+	
+	void appendUnsigned(string& target, unsigned long number) {
+		char digits[24];
+		char* start = digits + sizeof(digits);
+		do {
+			*--start = '0' + number % 10;
+			number /= 10;
+		} while (number > 0);
+		target.append(start, digits + sizeof(digits) - start);
+	}
+	
+	void appendFloat(string& target, double number) {
+		char digits[32];
+		int length = snprintf(digits, sizeof(digits), "%g", number);
+		target.append(digits, length);
+	}
+	
+	Bz2LineWriter::Bz2LineWriter(const string& fileName, bool plain, unsigned threadCount, int compressionLevel) : bzerror(BZ_OK), uncompressed(plain || fileName == "-" || fileName.find(".bz2") == string::npos), out(NULL), open(true), flushSize(stagingSize), threads(threadCount > 0 ? threadCount : 1), level(compressionLevel >= 1 && compressionLevel <= 9 ? compressionLevel : 9), blocksWritten(false), pool(NULL), blockWriter(NULL) {
 		if (uncompressed) {
 //			cerr << "UNCOMPRESSED OUTPUT!!!" << endl;
 			if (fileName != "-") {
@@ -33,58 +83,127 @@ namespace bg_zhechev_ventsislav {
 				wcout << L"Could not open the stupid file for writing!!!" << endl;
 				exit(5);
 			}
-			bzip2Handle = BZ2_bzWriteOpen(&bzerror, plainHandle, 9, 0, 0);
-			if (bzerror != BZ_OK) {
+			if (threads > 1) {
+				flushSize = blockSize;
+				pool = new OrderedWorkerPool(threads, 2 * threads);
+				blockWriter = new Thread();
+				blockWriter->start(&writeBlocks, this);
+			} else {
+				bzip2Handle = BZ2_bzWriteOpen(&bzerror, plainHandle, level, 0, 0);
+				if (bzerror != BZ_OK) {
+					BZ2_bzWriteClose(&bzerror, bzip2Handle, 0, NULL, NULL);
+					/* handle error */
+					wcout << L"Trouble writing to the stupid file!!!" << endl;
+					exit(6);
+				}
+				
+				bzerror = BZ_OK;
+			}
+		}
+		staging.reserve(flushSize + (flushSize >> 2));
+	}
+	
+	bool Bz2LineWriter::writeLine(const string& line) {
+		append(line);
+		return uncompressed ? !out->fail() : true;
+	}
+	
+	//Hands the staged output on and empties the staging buffer
+	void Bz2LineWriter::flush() {
+		if (staging.empty())
+			return;
+		
+		if (uncompressed) {
+			out->write(staging.data(), staging.size());
+			staging.clear();
+			return;
+		}
+		
+		if (pool != NULL) {
+			submitBlock();
+			return;
+		}
+		
+#ifdef __debug_writer__
+		wcerr << L"Trying to write a chunk… (bzerror is " << bzerror << L")" << endl;
+#endif
+		//Hand the data to libbzip2 straight from the buffer—copying it piece by piece made writing large chunks of output quadratic
+		const char* data = staging.data();
+		size_t remaining = staging.size();
+		while (remaining > 0) {
+			int chunk = remaining > (size_t)maxChunk ? maxChunk : (int)remaining;
+			
+			BZ2_bzWrite(&bzerror, bzip2Handle, const_cast<char*>(data), chunk);
+			if (bzerror == BZ_IO_ERROR) {
 				BZ2_bzWriteClose(&bzerror, bzip2Handle, 0, NULL, NULL);
+				fclose(plainHandle);
 				/* handle error */
-				wcout << L"Trouble writing to the stupid file!!!" << endl;
-				exit(6);
+				wcout << L"Trouble writing the stupid file again!!!" << endl;
+				exit(7);
 			}
 			
-			bzerror = BZ_OK;
+			data += chunk;
+			remaining -= chunk;
 		}
+		staging.clear();
 	}
 	
-	bool Bz2LineWriter::writeLine(string line) {
+	void Bz2LineWriter::close() {
+		if (!open) return;
 		if (uncompressed) {
-			*out << line;
-//			if (line.find('\n') != string::npos) *out << flush;
-			return !(*out).fail();
+			flush();
+			if (out != NULL) {
+				out->flush();
+				delete out;
+				if (uncompressedFile.is_open())
+					uncompressedFile.close();
+			}
+		} else if (pool != NULL) {
+			//An empty file still gets one (empty) stream, so that it remains a valid .bz2 file
+			if (!staging.empty() || !blocksWritten)
+				submitBlock();
+			pool->finish();
+			blockWriter->join();
+			delete blockWriter;
+			delete pool;
+			pool = NULL;
+			if (fclose(plainHandle) != 0) {
+				/* handle error */
+				wcout << L"Trouble writing the stupid file again!!!" << endl;
+				exit(7);
+			}
 		} else {
-#ifdef __debug_writer__
-		//		Debugger();
-			wcerr << L"Trying to write a line… (finished is " << finished << L", bzerror is " << bzerror << L")" << endl;
-#endif
-		
-			while (line.size() > bufSize) {
-				/* get data to write into buf, and set nBuf appropriately */
-				strncpy(buf, line.c_str(), bufSize);
-				line = line.substr(bufSize);
-			
-				BZ2_bzWrite(&bzerror, bzip2Handle, buf, bufSize);
-				if (bzerror == BZ_IO_ERROR) {
-					BZ2_bzWriteClose(&bzerror, bzip2Handle, 0, NULL, NULL);
-					fclose(plainHandle);
-					/* handle error */
-					wcout << L"Trouble writing the stupid file again!!!" << endl;
-					exit(7);
-				}
+			flush();
+			if (bzerror != BZ_OK) {
+				cerr << "±±± There is a problem with the Bzip2 stream just before the attempt to close it!!!" << endl;
 			}
-			if (line.size() > 0) {
-				strncpy(buf, line.c_str(), line.size());
-				
-				BZ2_bzWrite(&bzerror, bzip2Handle, buf, (int)line.size());
-				if (bzerror == BZ_IO_ERROR) {
-					BZ2_bzWriteClose(&bzerror, bzip2Handle, 0, NULL, NULL);
-					fclose(plainHandle);
-					/* handle error */
-					wcout << L"Trouble writing the stupid file again!!!" << endl;
-					exit(8);
-				}
+			BZ2_bzWriteClose(&bzerror, bzip2Handle, 0, NULL, NULL);
+			fclose(plainHandle);
+		}
+		string().swap(staging);
+		open = false;
+	}
+	
+	void Bz2LineWriter::submitBlock() {
+		Bz2CompressionJob* job = new Bz2CompressionJob(level);
+		job->input.swap(staging);
+		staging.reserve(flushSize + (flushSize >> 2));
+		blocksWritten = true;
+		pool->submit(job);
+	}
+	
+	void* Bz2LineWriter::writeBlocks(void* data) {
+		Bz2LineWriter* writer = static_cast<Bz2LineWriter*>(data);
+		for (OrderedJob* job = writer->pool->next(); job != NULL; job = writer->pool->next()) {
+			const string& output = static_cast<Bz2CompressionJob*>(job)->output;
+			if (fwrite(output.data(), 1, output.size(), writer->plainHandle) != output.size()) {
+				/* handle error */
+				wcout << L"Trouble writing the stupid file again!!!" << endl;
+				exit(7);
 			}
-		
-			return true;
+			delete job;
 		}
+		return NULL;
 	}
 	
-}
\ No newline at end of file
+}
@@ -4,6 +4,7 @@
  *
  *  Created by Венцислав Жечев on 02.03.11.
  *  © 2011 Венцислав Жечев. All rights reserved.
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
  *
  */
 
@@ -18,15 +19,24 @@
 #include <bzlib.h>
 #include <cerrno>
 
+#include "StringPiece.h"
+#include "Threading.h"
+
 using namespace std;
 
 namespace bg_zhechev_ventsislav {
 	
+	//Formatting of numbers straight into a string, without any temporary objects.
+	//The target only allocates when its capacity is exhausted.
+	void appendInt(string& target, long number);
+	void appendUnsigned(string& target, unsigned long number);
+	//Formats the number the same way an ostream with default settings does (%g)
+	void appendFloat(string& target, double number);
+	
 	class Bz2LineWriter {
 		FILE* plainHandle;
 		BZFILE* bzip2Handle;
-		static const unsigned bufSize = 100;
-		char buf[bufSize];
+		static const int maxChunk = 1 << 24;
 		int bzerror;
 		
 		bool uncompressed;
@@ -34,33 +44,63 @@ namespace bg_zhechev_ventsislav {
 		ostream *out;
 		
 		bool open;
+		
+		//All output is collected in a staging buffer and only handed on to bzip2 (or the plain file) when the buffer fills up
+		static const size_t stagingSize = 1 << 22;
+		string staging;
+		size_t flushSize;
+		
+		//Block-parallel compression: the staged output is cut into blocks that are compressed as independent bzip2 streams on a pool of worker threads and written out in order by a separate thread
+		static const size_t blockSize = 900000;
+		unsigned threads;
+		int level;
+		bool blocksWritten;
+		OrderedWorkerPool* pool;
+		Thread* blockWriter;
 
 		//Disable the default constructor
 		Bz2LineWriter() {}
+		
+		void flush();
+		void submitBlock();
+		static void* writeBlocks(void* data);
+		
+		inline void checkStaging() {
+			if (staging.size() >= flushSize)
+				flush();
+		}
 	public:
 
-		Bz2LineWriter(const string& fileName, bool plain = false);
+		//With threads > 1 a compressed file is written as a sequence of bzip2 streams, one per block, that are compressed in parallel.
+		//The compression level (1–9) is the bzip2 block size in units of 100k; lower levels are faster, e.g. for temporary files.
+		Bz2LineWriter(const string& fileName, bool plain = false, unsigned threads = 1, int compressionLevel = 9);
 		~Bz2LineWriter() { close(); }
 		
-		inline void close() {
-			if (!open) return;
-			if (uncompressed) {
-				if (out != NULL) {
-					delete out;
-					if (uncompressedFile.is_open())
-						uncompressedFile.close();
-				}
-			} else {
-				if (bzerror != BZ_OK) {
-					cerr << "±±± There is a problem with the Bzip2 stream just before the attempt to close it!!!" << endl;
-				}
-				BZ2_bzWriteClose(&bzerror, bzip2Handle, 0, NULL, NULL);
-				fclose(plainHandle);
-			}
-			open = false;
-		}
+		void close();
+		
+		bool writeLine(const string& line);
 		
-		bool writeLine(string line);
+		//Fragments of output are appended to the staging buffer without any heap allocation
+		inline void append(const StringPiece& piece) {
+			staging.append(piece.data(), piece.size());
+			checkStaging();
+		}
+		inline void append(char c) {
+			staging += c;
+			checkStaging();
+		}
+		inline void appendInt(long number) {
+			bg_zhechev_ventsislav::appendInt(staging, number);
+			checkStaging();
+		}
+		inline void appendUnsigned(unsigned long number) {
+			bg_zhechev_ventsislav::appendUnsigned(staging, number);
+			checkStaging();
+		}
+		inline void appendFloat(double number) {
+			bg_zhechev_ventsislav::appendFloat(staging, number);
+			checkStaging();
+		}
 
 		static const bool UNCOMPRESSED = true;
 		static const bool COMPRESSED = false;
@@ -0,0 +1,300 @@
+/*
+ *  ExternalSorter.cpp
+ *  Moses Training
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ */
+
+#include "ExternalSorter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "Bz2LineReader.h"
+#include "Bz2LineWriter.h"
+
+namespace bg_zhechev_ventsislav {
+
+	typedef pair<size_t, size_t> LineSpan;
+
+	//Byte order of two lines in the same buffer, with a line that is a prefix of another sorting first
+	struct LineOrder {
+		const char* base;
+
+		LineOrder(const char* b) : base(b) {}
+
+		inline bool operator()(const LineSpan& a, const LineSpan& b) const {
+			int result = memcmp(base + a.first, base + b.first, min(a.second, b.second));
+			return result != 0 ? result < 0 : a.second < b.second;
+		}
+	};
+
+	struct SortSlice {
+		vector<LineSpan>::iterator begin, end;
+		const char* base;
+	};
+
+	static void* sortSlice(void* data) {
+		SortSlice* slice = static_cast<SortSlice*>(data);
+		std::sort(slice->begin, slice->end, LineOrder(slice->base));
+		return NULL;
+	}
+
+	//A run of lines that is sorted as a whole and, unless it is the last run, spilled to a temporary file
+	struct SortRun : public OrderedJob {
+		string data;
+		vector<LineSpan> lines;
+		string spillFile;
+		unsigned sortThreads;
+
+		SortRun() : sortThreads(1) {}
+
+		inline size_t memoryUsed() const { return data.size() + lines.size() * sizeof(LineSpan); }
+		inline StringPiece line(size_t i) const { return StringPiece(data.data() + lines[i].first, lines[i].second); }
+
+		void run() {
+			sortLines();
+			if (spillFile.empty())
+				return;
+
+			Bz2LineWriter output(spillFile, Bz2LineWriter::COMPRESSED, 1, 1);
+			for (size_t i = 0; i < lines.size(); ++i) {
+				output.append(line(i));
+				output.append('\n');
+			}
+			output.close();
+
+			string().swap(data);
+			vector<LineSpan>().swap(lines);
+		}
+
+		//With several threads, slices of the run are sorted in parallel and then merged
+		void sortLines() {
+			const char* base = data.data();
+			size_t slices = min((size_t)sortThreads, lines.size() / 1024 + 1);
+			if (slices <= 1) {
+				std::sort(lines.begin(), lines.end(), LineOrder(base));
+				return;
+			}
+
+			vector<SortSlice> slice(slices);
+			vector<Thread*> workers(slices);
+			for (size_t s = 0; s < slices; ++s) {
+				slice[s].begin = lines.begin() + lines.size() * s / slices;
+				slice[s].end = lines.begin() + lines.size() * (s + 1) / slices;
+				slice[s].base = base;
+				workers[s] = new Thread();
+				workers[s]->start(&sortSlice, &slice[s]);
+			}
+			for (size_t s = 0; s < slices; ++s) {
+				workers[s]->join();
+				delete workers[s];
+			}
+			for (size_t s = 1; s < slices; ++s)
+				std::inplace_merge(lines.begin(), slice[s].begin, slice[s].end, LineOrder(base));
+		}
+	};
+
+	//k-way merge of sorted temporary files and (optionally) a sorted run in memory
+	class RunMerger {
+		struct Source {
+			Bz2LineReader* reader;
+			const SortRun* run;
+			size_t next;
+			StringPiece line;
+
+			bool advance() {
+				if (reader != NULL)
+					return reader->readLine(line);
+				if (next >= run->lines.size())
+					return false;
+				line = run->line(next++);
+				return true;
+			}
+		};
+
+		//std::*_heap build a max-heap, so the order is reversed to get the smallest line on top
+		struct SourceOrder {
+			const vector<Source>* sources;
+
+			SourceOrder(const vector<Source>* s) : sources(s) {}
+
+			inline bool operator()(size_t a, size_t b) const { return (*sources)[b].line < (*sources)[a].line; }
+		};
+
+		vector<Source> sources;
+		vector<size_t> heap;
+		//The source of the line returned last, which is only advanced on the next call
+		int lastSource;
+
+		//Disable copying
+		RunMerger(const RunMerger&);
+		RunMerger& operator=(const RunMerger&);
+	public:
+		RunMerger(const vector<string>& files, const SortRun* run) : lastSource(-1) {
+			sources.resize(files.size() + (run != NULL ? 1 : 0));
+			for (size_t i = 0; i < sources.size(); ++i) {
+				sources[i].reader = i < files.size() ? new Bz2LineReader(files[i]) : NULL;
+				sources[i].run = run;
+				sources[i].next = 0;
+				if (sources[i].advance())
+					heap.push_back(i);
+			}
+			make_heap(heap.begin(), heap.end(), SourceOrder(&sources));
+		}
+
+		~RunMerger() {
+			for (size_t i = 0; i < sources.size(); ++i)
+				delete sources[i].reader;
+		}
+
+		bool readLine(StringPiece& line) {
+			if (lastSource >= 0) {
+				if (sources[lastSource].advance()) {
+					heap.push_back(lastSource);
+					push_heap(heap.begin(), heap.end(), SourceOrder(&sources));
+				}
+				lastSource = -1;
+			}
+			if (heap.empty())
+				return false;
+
+			pop_heap(heap.begin(), heap.end(), SourceOrder(&sources));
+			lastSource = heap.back();
+			heap.pop_back();
+			line = sources[lastSource].line;
+			return true;
+		}
+	};
+
+	ExternalSorter::ExternalSorter(const string& dir, size_t memory, unsigned threadCount) : tempDir(dir), threads(threadCount > 0 ? threadCount : 1), currentRun(NULL), pendingRuns(0), lastRun(NULL), merger(NULL), sorted(false) {
+		//One run is being filled while the others are sorted and spilled
+		runSize = max(memory / (threads + 1), size_t(1) << 20);
+		pool = new OrderedWorkerPool(threads, threads);
+	}
+
+	ExternalSorter::~ExternalSorter() {
+		delete merger;
+		if (pool != NULL) {
+			pool->finish();
+			while (pendingRuns > 0)
+				retireRun();
+			delete pool;
+		}
+		delete currentRun;
+		delete lastRun;
+		for (size_t i = 0; i < spillFiles.size(); ++i)
+			unlink(spillFiles[i].c_str());
+	}
+
+	string ExternalSorter::defaultTempDir() {
+		const char* dir = getenv("TMPDIR");
+		return dir != NULL && *dir != '\0' ? dir : "/tmp";
+	}
+
+	string ExternalSorter::newSpillFile() {
+		return createTempFile(tempDir, "extract-sort");
+	}
+	
+	string ExternalSorter::createTempFile(const string& dir, const string& prefix, const string& suffix) {
+		string pattern = dir + "/" + prefix + ".XXXXXX" + suffix;
+		vector<char> name(pattern.begin(), pattern.end());
+		name.push_back('\0');
+		int file = mkstemps(&name[0], suffix.size());
+		if (file < 0) {
+			cerr << "Could not create a temporary file in " << dir << "!!!" << endl;
+			exit(5);
+		}
+		close(file);
+		return string(&name[0]);
+	}
+
+	void ExternalSorter::add(const StringPiece& line) {
+		assert(!sorted);
+		if (currentRun == NULL) {
+			currentRun = new SortRun();
+			currentRun->data.reserve(runSize);
+		}
+		currentRun->lines.push_back(LineSpan(currentRun->data.size(), line.size()));
+		currentRun->data.append(line.data(), line.size());
+		currentRun->data += '\n';
+
+		if (currentRun->memoryUsed() >= runSize) {
+			currentRun->spillFile = newSpillFile();
+			if (pendingRuns == threads)
+				retireRun();
+			pool->submit(currentRun);
+			++pendingRuns;
+			currentRun = NULL;
+		}
+	}
+
+	//Waits for the oldest run on the worker threads to be spilled
+	void ExternalSorter::retireRun() {
+		SortRun* run = static_cast<SortRun*>(pool->next());
+		spillFiles.push_back(run->spillFile);
+		delete run;
+		--pendingRuns;
+	}
+
+	void ExternalSorter::sort() {
+		if (sorted)
+			return;
+		sorted = true;
+
+		//The last run is sorted with all threads at once and kept in memory
+		if (currentRun != NULL) {
+			currentRun->sortThreads = threads;
+			currentRun->run();
+			lastRun = currentRun;
+			currentRun = NULL;
+		}
+		pool->finish();
+		while (pendingRuns > 0)
+			retireRun();
+		delete pool;
+		pool = NULL;
+
+		mergeSpills();
+		rewind();
+	}
+
+	//Keeps the number of files that are merged at the same time (and their read buffers) bounded
+	void ExternalSorter::mergeSpills() {
+		while (spillFiles.size() > maxMergeWidth) {
+			vector<string> group(spillFiles.begin(), spillFiles.begin() + maxMergeWidth);
+			string mergedFile = newSpillFile();
+			{
+				RunMerger groupMerger(group, NULL);
+				Bz2LineWriter output(mergedFile, Bz2LineWriter::COMPRESSED, threads, 1);
+				StringPiece line;
+				while (groupMerger.readLine(line)) {
+					output.append(line);
+					output.append('\n');
+				}
+			}
+			for (size_t i = 0; i < group.size(); ++i)
+				unlink(group[i].c_str());
+			spillFiles.erase(spillFiles.begin(), spillFiles.begin() + maxMergeWidth);
+			spillFiles.push_back(mergedFile);
+		}
+	}
+
+	void ExternalSorter::rewind() {
+		assert(sorted);
+		delete merger;
+		merger = new RunMerger(spillFiles, lastRun);
+	}
+
+	bool ExternalSorter::readLine(StringPiece& line) {
+		if (!sorted)
+			sort();
+		return merger->readLine(line);
+	}
+
+}
@@ -0,0 +1,84 @@
+/*
+ *  ExternalSorter.h
+ *  Moses Training
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ *  Sorts lines in byte order (the order of LC_ALL=C sort) with bounded memory.
+ *  Lines are collected into runs that are sorted on worker threads and spilled to compressed temporary files,
+ *  which are then merged back. Runs that never had to be spilled are merged straight from memory.
+ *
+ */
+
+#ifndef EXTERNALSORTER
+#define EXTERNALSORTER
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "StringPiece.h"
+#include "Threading.h"
+
+using namespace std;
+
+namespace bg_zhechev_ventsislav {
+
+	class Bz2LineReader;
+	struct SortRun;
+	class RunMerger;
+
+	class ExternalSorter {
+		string tempDir;
+		size_t runSize;
+		unsigned threads;
+
+		SortRun* currentRun;
+		//Runs that are being sorted and spilled on the worker threads
+		OrderedWorkerPool* pool;
+		size_t pendingRuns;
+		vector<string> spillFiles;
+		//The last run is kept in memory
+		SortRun* lastRun;
+		RunMerger* merger;
+		bool sorted;
+
+		//Disable copying
+		ExternalSorter(const ExternalSorter&);
+		ExternalSorter& operator=(const ExternalSorter&);
+
+		void retireRun();
+		string newSpillFile();
+		void mergeSpills();
+	public:
+		//At most about memory bytes of line data are kept in memory, divided between the runs being filled and sorted.
+		//Merging additionally uses a read buffer per temporary file.
+		ExternalSorter(const string& tempDir = defaultTempDir(), size_t memory = size_t(1) << 30, unsigned threads = 1);
+		~ExternalSorter();
+
+		//Adds a line (without the line break)
+		void add(const StringPiece& line);
+
+		//Called once all lines have been added. Sorts the remaining lines and prepares the merge.
+		void sort();
+
+		//Points line to the next line in sorted order. Returns false after the last line.
+		//The line is only valid until the next call to readLine() or rewind().
+		bool readLine(StringPiece& line);
+
+		//Starts reading the sorted lines from the beginning again
+		void rewind();
+
+		//$TMPDIR or /tmp
+		static string defaultTempDir();
+		//Creates a new empty file named prefix.XXXXXXsuffix in dir and returns its name
+		static string createTempFile(const string& dir, const string& prefix, const string& suffix = ".bz2");
+
+		//Runs that are spilled to disk are merged in groups of at most this many files
+		static const size_t maxMergeWidth = 32;
+	};
+
+}
+
+#endif
@@ -0,0 +1,86 @@
+/*
+ *  FieldSplitter.h
+ *  Moses Training
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ *  Splitting of the lines of extract files and phrase tables (“source ||| target ||| alignment ||| count”) into fields and tokens.
+ *  A field separator is a "|||" token, i.e. it is surrounded by whitespace or the ends of the line, just as for tokenize().
+ *  Fields and tokens are returned as views of the line, so nothing is copied or allocated.
+ *
+ */
+
+#ifndef FIELDSPLITTER
+#define FIELDSPLITTER
+
+#include <cstring>
+
+#include "StringPiece.h"
+
+namespace bg_zhechev_ventsislav {
+
+	inline bool isFieldSpace(char c) { return c == ' ' || c == '\t'; }
+
+	//Position of the first "|||" separator token at or after pos, or StringPiece::npos
+	inline size_t findFieldSeparator(const StringPiece& line, size_t pos = 0) {
+		const char* data = line.data();
+		const size_t length = line.size();
+		while (pos + 3 <= length) {
+			//memchr is vectorised in the C library, so the line is skimmed for the next | at full speed
+			const char* bar = static_cast<const char*>(memchr(data + pos, '|', length - pos));
+			if (bar == NULL)
+				return StringPiece::npos;
+			size_t i = bar - data;
+			if (i + 3 <= length && data[i+1] == '|' && data[i+2] == '|' &&
+					(i == 0 || isFieldSpace(data[i-1])) && (i + 3 == length || isFieldSpace(data[i+3])))
+				return i;
+			//Skip the whole run of |, so that |||| is not taken for a separator either
+			for (pos = i + 1; pos < length && data[pos] == '|'; ++pos);
+		}
+		return StringPiece::npos;
+	}
+
+	//Removes one space (or tab) at either end of a field, which belongs to the surrounding separators
+	inline StringPiece trimField(const StringPiece& field) {
+		size_t begin = !field.empty() && isFieldSpace(field[0]) ? 1 : 0;
+		size_t end = field.size() > begin && isFieldSpace(field[field.size()-1]) ? field.size() - 1 : field.size();
+		return field.substr(begin, end - begin);
+	}
+
+	//Splits a line into at most maxFields fields; the last field takes the rest of the line.
+	//Returns the number of fields, which is one more than the number of separators found.
+	inline size_t splitFields(const StringPiece& line, StringPiece fields[], size_t maxFields) {
+		size_t count = 0;
+		size_t begin = 0;
+		for (size_t separator = findFieldSeparator(line); separator != StringPiece::npos && count + 1 < maxFields; separator = findFieldSeparator(line, begin)) {
+			fields[count++] = trimField(line.substr(begin, separator - begin));
+			begin = separator + 3;
+		}
+		fields[count++] = trimField(line.substr(begin));
+		return count;
+	}
+
+	//Iterates over the whitespace-separated tokens of a field (or a whole line)
+	class TokenIterator {
+		StringPiece text;
+		size_t position;
+	public:
+		TokenIterator(const StringPiece& t) : text(t), position(0) {}
+
+		//Points token to the next token; returns false after the last one
+		inline bool next(StringPiece& token) {
+			while (position < text.size() && isFieldSpace(text[position]))
+				++position;
+			if (position >= text.size())
+				return false;
+			size_t begin = position;
+			while (position < text.size() && !isFieldSpace(text[position]))
+				++position;
+			token = text.substr(begin, position - begin);
+			return true;
+		}
+	};
+
+}
+
+#endif
@@ -0,0 +1,494 @@
+/*
+ *  PhraseExtractor.cpp
+ *  Moses Training
+ *
+ *  Extraction code taken over from extract.cpp
+ *      Modified by: (C) Nadi Tomeh - LIMSI/CNRS
+ *      Machine Translation Marathon 2010, Dublin
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ */
+
+#include "PhraseExtractor.h"
+
+#include <iostream>
+#include <cstdlib>
+
+#include "Bz2LineWriter.h"
+
+using namespace std;
+using namespace bg_zhechev_ventsislav;
+
+// HPhraseVertex represents a point in the alignment matrix
+typedef pair<int, int> HPhraseVertex;
+
+// Phrase represents a bi-phrase; each bi-phrase is defined by two points in the alignment matrix:
+// bottom-left and top-right
+typedef pair<HPhraseVertex, HPhraseVertex> HPhrase;
+
+// HPhraseVector is a vector of HPhrases
+typedef vector<HPhrase> HPhraseVector;
+
+enum REO_POS {LEFT, RIGHT, DLEFT, DRIGHT, UNKNOWN};
+
+static REO_POS getOrientWordModel(const BitMatrix &, REO_MODEL_TYPE, bool, bool,
+													 int, int, int, int, int, int, int,
+													 bool (*)(int, int), bool (*)(int, int));
+static REO_POS getOrientPhraseModel(REO_MODEL_TYPE, bool, bool,
+														 int, int, int, int, int, int, int,
+														 bool (*)(int, int), bool (*)(int, int),
+														 const BitMatrix &, const BitMatrix &);
+static REO_POS getOrientHierModel(REO_MODEL_TYPE, bool, bool,
+													 int, int, int, int, int, int, int,
+													 bool (*)(int, int), bool (*)(int, int),
+													 const BitMatrix &, const BitMatrix &,
+													 const BitMatrix &, const BitMatrix &,
+													 REO_POS);
+
+static string getOrientString(REO_POS, REO_MODEL_TYPE);
+
+static bool ge(int, int);
+static bool le(int, int);
+static bool lt(int, int);
+
+static bool isAligned (const BitMatrix &, int, int);
+
+PhraseExtractor::PhraseExtractor() : maxPhraseLength(7), orientationFlag(false), onlyOutputSpanInfo(false), allModelsOutputFlag(false), wordModel(false), wordType(REO_MSD), phraseModel(false), phraseType(REO_MSD), hierModel(false), hierType(REO_MSD) {}
+
+void PhraseExtractor::addModel(const string& modelParams) {
+  const string modelName = modelParams.substr(0, modelParams.find('-'));
+  const string modelType = modelParams.substr(modelParams.find('-') + 1);
+//	modelMaxDistance = modelParams.find('-', modelParams.find('-') + 1) ? atoi(modelParams.substr(modelParams.find_last_of('-') + 1).c_str()) : 6;
+	
+  if (modelName == "wbe"){
+		wordModel = true;
+		if (modelType == "msd")
+			wordType = REO_MSD;
+		else if (modelType == "mslr")
+			wordType = REO_MSLR;
+		else if (modelType == "mono" || modelType == "monotonicity")
+			wordType = REO_MONO;
+		else {
+			cerr << "extract: syntax error, unknown reordering model type: " << modelType << endl;
+			exit(1);
+		}
+  } else if (modelName == "phrase") {
+		phraseModel = true;
+		if (modelType == "msd")
+			phraseType = REO_MSD;
+		else if (modelType == "mslr")
+			phraseType = REO_MSLR;
+		else if (modelType == "mono" || modelType == "monotonicity")
+			phraseType = REO_MONO;
+		else {
+			cerr << "extract: syntax error, unknown reordering model type: " << modelType << endl;
+			exit(1);
+		}
+  } else if (modelName == "hier") {
+		hierModel = true;
+		if (modelType == "msd")
+			hierType = REO_MSD;
+		else if (modelType == "mslr")
+			hierType = REO_MSLR;
+		else if (modelType == "mono" || modelType == "monotonicity")
+			hierType = REO_MONO;
+		else {
+			cerr << "extract: syntax error, unknown reordering model type: " << modelType << endl;
+			exit(1);
+		}
+  } else {
+		cerr << "extract: syntax error, unknown reordering model: " << modelName << endl;
+		exit(1);
+  }
+	
+  allModelsOutputFlag = true;
+}
+
+void PhraseExtractor::setDefaultModel() {
+  // default reordering model if no model selected
+  // allows for the old syntax to be used
+  if(orientationFlag && !allModelsOutputFlag) {
+    wordModel = true;
+    wordType = REO_MSD;
+  }
+}
+
+void PhraseExtractor::extract(SentenceAlignment &sentence, ExtractOutput &output) const {
+  int countE = sentence.target.size();
+  int countF = sentence.source.size();
+	
+  HPhraseVector inboundPhrases;
+	
+  bool relaxLimit = hierModel;
+  bool buildExtraStructure = phraseModel || hierModel;
+	
+	// only the bottom corners of the extracted phrases are needed for the orientation queries
+	BitMatrix& inBottomLeft = output.inBottomLeft;
+	BitMatrix& inBottomRight = output.inBottomRight;
+	BitMatrix& outBottomLeft = output.outBottomLeft;
+	BitMatrix& outBottomRight = output.outBottomRight;
+	BitMatrix& alignment = output.alignment;
+	if (wordModel || buildExtraStructure) {
+		alignment.reset(countE, countF);
+		for(int ei=0;ei<countE;++ei)
+			for(size_t i=0;i<sentence.alignedToT[ei].size();++i)
+				alignment.set(ei, sentence.alignedToT[ei][i]);
+	}
+	if (buildExtraStructure) {
+		inBottomLeft.reset(countE, countF);
+		inBottomRight.reset(countE, countF);
+		outBottomLeft.reset(countE, countF);
+		outBottomRight.reset(countE, countF);
+	}
+	
+  // check alignments for target phrase startE...endE
+  // loop over extracted phrases which are compatible with the word-alignments
+  // the target span is extended one word at a time, updating the source span and its alignment counts in place:
+  // usedF holds the number of alignment points of each source word outside of startE...endE and
+  // outOfBounds the number of source words within minF...maxF that still have such alignment points
+  vector<int>& usedF = output.usedF;
+  for(int startE=0; startE<countE; ++startE) {
+    int minF = 9999;
+    int maxF = -1;
+    int outOfBounds = 0;
+    usedF.assign(sentence.alignedCountS.begin(), sentence.alignedCountS.end());
+    for(int endE=startE; (endE<countE && (relaxLimit || endE<startE+maxPhraseLength)); ++endE) {
+			
+      int newMinF = minF;
+      int newMaxF = maxF;
+      for(size_t i=0;i<sentence.alignedToT[endE].size();++i) {
+				int fi = sentence.alignedToT[endE][i];
+				if (fi<newMinF) { newMinF = fi; }
+				if (fi>newMaxF) { newMaxF = fi; }
+				if (--usedF[fi] == 0 && fi >= minF && fi <= maxF)
+					--outOfBounds;
+      }
+      // the source words that have just come into the span
+      if (maxF < 0) {
+				for(int fi=newMinF;fi<=newMaxF;++fi)
+					outOfBounds += usedF[fi] > 0;
+      } else {
+				for(int fi=newMinF;fi<minF;++fi)
+					outOfBounds += usedF[fi] > 0;
+				for(int fi=maxF+1;fi<=newMaxF;++fi)
+					outOfBounds += usedF[fi] > 0;
+      }
+      minF = newMinF;
+      maxF = newMaxF;
+			
+      if (maxF >= 0 && // aligned to any source words at all
+					(relaxLimit || maxF-minF < maxPhraseLength)) { // source phrase within limits
+				
+				// cout << "doing if for ( " << minF << "-" << maxF << ", " << startE << "," << endE << ")\n";
+				// check if source words are aligned to out of bound target words
+				if (outOfBounds == 0){
+					// start point of source phrase may retreat over unaligned
+					for(int startF=minF;
+							(startF>=0 &&
+							 (relaxLimit || startF>maxF-maxPhraseLength) && // within length limit
+							 (startF==minF || sentence.alignedCountS[startF]==0)); // unaligned
+							--startF)
+						// end point of source phrase may advance over unaligned
+						for(int endF=maxF;
+								(endF<countF &&
+								 (relaxLimit || endF<startF+maxPhraseLength) && // within length limit
+								 (endF==maxF || sentence.alignedCountS[endF]==0)); // unaligned
+								++endF){ // at this point we have extracted a phrase
+							if(buildExtraStructure){ // phrase || hier
+								if(endE-startE < maxPhraseLength && endF-startF < maxPhraseLength){ // within limit
+									inboundPhrases.push_back(HPhrase(HPhraseVertex(startF,startE),
+																									 HPhraseVertex(endF,endE)));
+									inBottomLeft.set(endE, startF);
+									inBottomRight.set(endE, endF);
+								} else {
+									outBottomLeft.set(endE, startF);
+									outBottomRight.set(endE, endF);
+								}
+							} else {
+								string orientationInfo = "";
+								if(wordModel) {
+									REO_POS wordPrevOrient, wordNextOrient;
+									bool connectedLeftTopP  = isAligned( alignment, startF-1, startE-1 );
+									bool connectedRightTopP = isAligned( alignment, endF+1,   startE-1 );
+									bool connectedLeftTopN  = isAligned( alignment, endF+1, endE+1 );
+									bool connectedRightTopN = isAligned( alignment, startF-1,   endE+1 );
+									wordPrevOrient = getOrientWordModel(alignment, wordType, connectedLeftTopP, connectedRightTopP, startF, endF, startE, endE, countF, 0, 1, &ge, &lt);
+									wordNextOrient = getOrientWordModel(alignment, wordType, connectedLeftTopN, connectedRightTopN, endF, startF, endE, startE, 0, countF, -1, &lt, &ge);
+									orientationInfo += getOrientString(wordPrevOrient, wordType) + " " + getOrientString(wordNextOrient, wordType);
+//									if(allModelsOutputFlag)
+//										" | | ";
+								}
+								addPhrase(sentence, startE, endE, startF, endF, orientationInfo, output);
+							}
+						}
+				}
+      }
+    }
+  }
+	
+  if(buildExtraStructure){ // phrase || hier
+    string orientationInfo = "";
+    REO_POS wordPrevOrient, wordNextOrient, phrasePrevOrient, phraseNextOrient, hierPrevOrient, hierNextOrient;
+		
+    for(size_t i = 0; i < inboundPhrases.size(); ++i){
+      int startF = inboundPhrases[i].first.first;
+      int startE = inboundPhrases[i].first.second;
+      int endF = inboundPhrases[i].second.first;
+      int endE = inboundPhrases[i].second.second;
+			
+      bool connectedLeftTopP  = isAligned(alignment, startF-1, startE-1);
+      bool connectedRightTopP = isAligned(alignment, endF+1,   startE-1);
+      bool connectedLeftTopN  = isAligned(alignment, endF+1,   endE+1);
+      bool connectedRightTopN = isAligned(alignment, startF-1, endE+1);
+      
+      if(wordModel){
+				wordPrevOrient = getOrientWordModel(alignment, wordType,
+																						connectedLeftTopP, connectedRightTopP,
+																						startF, endF, startE, endE, countF, 0, 1,
+																						&ge, &lt);
+				wordNextOrient = getOrientWordModel(alignment, wordType,
+																						connectedLeftTopN, connectedRightTopN,
+																						endF, startF, endE, startE, 0, countF, -1,
+																						&lt, &ge);
+      }
+			
+      if (phraseModel) {
+				phrasePrevOrient = getOrientPhraseModel(phraseType, 
+																								connectedLeftTopP, connectedRightTopP,
+																								startF, endF, startE, endE, countF-1, 0, 1, &ge, &lt, inBottomRight, inBottomLeft);
+				phraseNextOrient = getOrientPhraseModel(phraseType,
+																								connectedLeftTopN, connectedRightTopN,
+																								endF, startF, endE, startE, 0, countF-1, -1, &lt, &ge, inBottomLeft, inBottomRight);
+      } else
+				phrasePrevOrient = phraseNextOrient = UNKNOWN;
+			
+      if(hierModel){
+				hierPrevOrient = getOrientHierModel(hierType, 
+																						connectedLeftTopP, connectedRightTopP,
+																						startF, endF, startE, endE, countF-1, 0, 1, &ge, &lt, inBottomRight, inBottomLeft, outBottomRight, outBottomLeft, phrasePrevOrient);
+				hierNextOrient = getOrientHierModel(hierType,
+																						connectedLeftTopN, connectedRightTopN,
+																						endF, startF, endE, startE, 0, countF-1, -1, &lt, &ge, inBottomLeft, inBottomRight, outBottomLeft, outBottomRight, phraseNextOrient);
+      }
+			
+      orientationInfo = ((wordModel)? getOrientString(wordPrevOrient, wordType) + " " + getOrientString(wordNextOrient, wordType) : "") + " | " +
+			((phraseModel)? getOrientString(phrasePrevOrient, phraseType) + " " + getOrientString(phraseNextOrient, phraseType) : "") + " | " +
+			((hierModel)? getOrientString(hierPrevOrient, hierType) + " " + getOrientString(hierNextOrient, hierType) : "");
+			
+      addPhrase(sentence, startE, endE, startF, endF, orientationInfo, output);
+    }
+  }
+}
+
+static REO_POS getOrientWordModel(const BitMatrix & alignment, REO_MODEL_TYPE modelType,
+													 bool connectedLeftTop, bool connectedRightTop,
+													 int startF, int endF, int startE, int endE, int countF, int zero, int unit,
+													 bool (*ge)(int, int), bool (*lt)(int, int) ){
+	
+	if(connectedLeftTop && !connectedRightTop)
+    return LEFT;
+  if(modelType == REO_MONO)
+    return UNKNOWN;
+  if (!connectedLeftTop &&  connectedRightTop)
+    return RIGHT;
+  if(modelType == REO_MSD)
+    return UNKNOWN;
+  for(int indexF=startF-2*unit; (*ge)(indexF, zero) && !connectedLeftTop; indexF=indexF-unit)
+    connectedLeftTop = isAligned(alignment, indexF, startE-unit);
+  for(int indexF=endF+2*unit; (*lt)(indexF,countF) && !connectedRightTop; indexF=indexF+unit)
+    connectedRightTop = isAligned(alignment, indexF, startE-unit);
+  if(connectedLeftTop && !connectedRightTop)
+    return DRIGHT;
+  else if(!connectedLeftTop && connectedRightTop)
+    return DLEFT;
+  return UNKNOWN;
+}
+
+// to be called with countF-1 instead of countF
+static REO_POS getOrientPhraseModel (REO_MODEL_TYPE modelType,
+															bool connectedLeftTop, bool connectedRightTop,
+															int startF, int endF, int startE, int endE, int countF, int zero, int unit,
+															bool (*ge)(int, int), bool (*lt)(int, int),
+															const BitMatrix & inBottomRight, const BitMatrix & inBottomLeft){
+	
+  if((connectedLeftTop && !connectedRightTop) ||
+     inBottomRight.test(startE - unit, startF - unit))
+    return LEFT;
+  if(modelType == REO_MONO)
+    return UNKNOWN;
+  if((!connectedLeftTop &&  connectedRightTop) ||
+     inBottomLeft.test(startE - unit, endF + unit))
+    return RIGHT;
+  if(modelType == REO_MSD)
+    return UNKNOWN;
+  // unlike the hierarchical model, only the nearest discontinuous position is checked on either side
+  if((*ge)(startF - 2*unit, zero) && inBottomRight.test(startE - unit, startF - 2*unit))
+    return DRIGHT;
+  if((*lt)(endF + 2*unit, countF) && inBottomLeft.test(startE - unit, endF + 2*unit))
+    return DLEFT;
+  return UNKNOWN;
+}
+
+// to be called with countF-1 instead of countF
+static REO_POS getOrientHierModel (REO_MODEL_TYPE modelType,
+														bool connectedLeftTop, bool connectedRightTop,
+														int startF, int endF, int startE, int endE, int countF, int zero, int unit,
+														bool (*ge)(int, int), bool (*lt)(int, int),
+														const BitMatrix & inBottomRight, const BitMatrix & inBottomLeft,
+														const BitMatrix & outBottomRight, const BitMatrix & outBottomLeft,
+														REO_POS phraseOrient){
+	
+  if(phraseOrient == LEFT ||
+     (connectedLeftTop && !connectedRightTop) ||
+     inBottomRight.test(startE - unit, startF - unit) ||
+     outBottomRight.test(startE - unit, startF - unit))
+    return LEFT;
+  if(modelType == REO_MONO)
+    return UNKNOWN;  
+  if(phraseOrient == RIGHT || 
+     (!connectedLeftTop &&  connectedRightTop) ||
+     inBottomLeft.test(startE - unit, endF + unit) ||
+     outBottomLeft.test(startE - unit, endF + unit))
+    return RIGHT;
+  if(modelType == REO_MSD)
+    return UNKNOWN;
+  if(phraseOrient != UNKNOWN)
+    return phraseOrient;
+  for(int indexF=startF-2*unit; (*ge)(indexF, zero); indexF=indexF-unit)
+    if(inBottomRight.test(startE - unit, indexF) || outBottomRight.test(startE - unit, indexF))
+      return DRIGHT;
+  for(int indexF=endF+2*unit; (*lt)(indexF, countF); indexF=indexF+unit)
+    if(inBottomLeft.test(startE - unit, indexF) || outBottomLeft.test(startE - unit, indexF))
+      return DLEFT;
+  return UNKNOWN;
+}
+
+static bool isAligned (const BitMatrix &alignment, int fi, int ei){
+  if (ei == -1 && fi == -1)
+    return true;
+  if (ei == alignment.rowCount() && fi == alignment.columnCount())
+    return true;
+  return alignment.test(ei, fi);
+}
+
+static inline bool ge(int first, int second){
+  return first >= second;
+}
+
+static inline bool le(int first, int second){
+  return first <= second;
+}
+
+static inline bool lt(int first, int second){
+  return first < second;
+}
+
+static string getOrientString(REO_POS orient, REO_MODEL_TYPE modelType){
+  switch(orient) {
+		case LEFT: return "mono"; break;
+		case RIGHT: return "swap"; break;
+		case DRIGHT: return "dright"; break;
+		case DLEFT: return "dleft"; break;
+		case UNKNOWN:
+			switch(modelType){
+				case REO_MONO: return "nomono"; break;
+				case REO_MSD: return "other"; break;
+				case REO_MSLR: return "dright"; break;
+			}
+			break;
+  }
+	return "";
+}
+
+void PhraseExtractor::addPhrase( SentenceAlignment &sentence, int startE, int endE, int startF, int endF , string &orientationInfo, ExtractOutput &output) const {
+	
+  if (onlyOutputSpanInfo) {
+    cout << startF << " " << endF << " " << startE << " " << endE << endl;
+    return;
+  }
+	
+	// source
+  for(int fi=startF;fi<=endF;++fi) {
+    output.extract += sentence.source[fi];
+    output.extract += ' ';
+    if (orientationFlag) {
+      output.extractOrientation += sentence.source[fi];
+      output.extractOrientation += ' ';
+    }
+  }
+  output.extract += "||| ";
+  if (orientationFlag) output.extractOrientation += "||| ";
+	
+  // target
+  for(int ei=startE;ei<=endE;++ei) {
+    output.extract += sentence.target[ei];
+    output.extract += ' ';
+    output.extractInv += sentence.target[ei];
+    output.extractInv += ' ';
+    if (orientationFlag) {
+      output.extractOrientation += sentence.target[ei];
+      output.extractOrientation += ' ';
+    }
+  }
+  output.extract += "|||";
+  output.extractInv += "||| ";
+  if (orientationFlag) output.extractOrientation += "||| ";
+	
+  // source (for inverse)
+  for(int fi=startF;fi<=endF;++fi) {
+    output.extractInv += sentence.source[fi];
+    output.extractInv += ' ';
+  }
+  output.extractInv += "|||";
+	
+  // alignment
+  for(int ei=startE;ei<=endE;++ei)
+    for(size_t i=0;i<sentence.alignedToT[ei].size();++i) {
+      int fi = sentence.alignedToT[ei][i];
+      output.extract += ' ';
+      appendInt(output.extract, fi-startF);
+      output.extract += '-';
+      appendInt(output.extract, ei-startE);
+      output.extractInv += ' ';
+      appendInt(output.extractInv, ei-startE);
+      output.extractInv += '-';
+      appendInt(output.extractInv, fi-startF);
+    }
+	
+	output.extract += '\n';
+  output.extractInv += '\n';
+  if (orientationFlag) {
+    output.extractOrientation += orientationInfo;
+    output.extractOrientation += '\n';
+  }
+}
+
+// if proper conditioning, we need the number of times a source phrase occured
+void PhraseExtractor::extractBase( SentenceAlignment &sentence, ExtractOutput &output ) const {
+  int countF = sentence.source.size();
+  for(int startF=0;startF<countF;++startF) {
+    for(int endF=startF;
+        (endF<countF && endF<startF+maxPhraseLength);
+        endF++) {
+      for(int fi=startF;fi<=endF;++fi) {
+				output.extract += sentence.source[fi];
+				output.extract += ' ';
+      }
+      output.extract += "|||\n";
+    }
+  }
+	
+  int countE = sentence.target.size();
+  for(int startE=0;startE<countE;++startE) {
+    for(int endE=startE;
+        (endE<countE && endE<startE+maxPhraseLength);
+        endE++) {
+      for(int ei=startE;ei<=endE;++ei) {
+				output.extractInv += sentence.target[ei];
+				output.extractInv += ' ';
+      }
+      output.extractInv += "|||\n";
+    }
+  }
+}
@@ -0,0 +1,99 @@
+/*
+ *  PhraseExtractor.h
+ *  Moses Training
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ *  Extraction of phrase pairs (and their orientation) from one word-aligned sentence pair.
+ *  Shared by extract and extract-score; all settings are fixed before extraction starts, so one extractor can be used from several threads at once.
+ *
+ */
+
+#ifndef PHRASEEXTRACTOR
+#define PHRASEEXTRACTOR
+
+#include <string>
+#include <vector>
+
+#include "SentenceAlignment.h"
+
+using namespace std;
+
+enum REO_MODEL_TYPE {REO_MSD, REO_MSLR, REO_MONO};
+
+// A dense matrix of bits over the alignment grid of a sentence pair, indexed by (target, source) position.
+// Tests outside of the matrix yield false. The memory is kept when the matrix is reset for the next sentence.
+class BitMatrix {
+	vector<unsigned long> bits;
+	int rows;
+	int columns;
+	static const size_t wordBits = sizeof(unsigned long) * 8;
+public:
+	BitMatrix() : rows(0), columns(0) {}
+	
+	inline void reset(int rowCount, int columnCount) {
+		rows = rowCount;
+		columns = columnCount;
+		bits.assign(((size_t)rows * columns + wordBits - 1) / wordBits, 0);
+	}
+	inline void set(int row, int column) {
+		size_t i = (size_t)row * columns + column;
+		bits[i / wordBits] |= 1UL << (i % wordBits);
+	}
+	inline bool test(int row, int column) const {
+		if (row < 0 || row >= rows || column < 0 || column >= columns)
+			return false;
+		size_t i = (size_t)row * columns + column;
+		return (bits[i / wordBits] >> (i % wordBits)) & 1;
+	}
+	inline int rowCount() const { return rows; }
+	inline int columnCount() const { return columns; }
+};
+
+// ExtractOutput collects the text produced for one or more sentence pairs, before it is handed to the output files
+struct ExtractOutput {
+	string extract;
+	string extractInv;
+	string extractOrientation;
+	
+	// Scratch space of extract(), reused between sentences:
+	// the alignment counts of the source words outside the current target span,
+	// the word alignment and the bottom corners of the phrases extracted within and beyond the length limit
+	vector<int> usedF;
+	BitMatrix alignment;
+	BitMatrix inBottomLeft;
+	BitMatrix inBottomRight;
+	BitMatrix outBottomLeft;
+	BitMatrix outBottomRight;
+
+	inline void clear() { extract.clear(); extractInv.clear(); extractOrientation.clear(); }
+};
+
+class PhraseExtractor {
+	void addPhrase(SentenceAlignment &, int, int, int, int, string &, ExtractOutput &) const;
+public:
+	int maxPhraseLength;
+	bool orientationFlag;
+	bool onlyOutputSpanInfo;
+
+	bool allModelsOutputFlag;
+	bool wordModel;
+	REO_MODEL_TYPE wordType;
+	bool phraseModel;
+	REO_MODEL_TYPE phraseType;
+	bool hierModel;
+	REO_MODEL_TYPE hierType;
+
+	PhraseExtractor();
+
+	//Enables a reordering model given as [wbe|phrase|hier]-[msd|mslr|mono]
+	void addModel(const string& modelParams);
+	//Falls back to the word-based msd model if orientation output is requested without any model
+	void setDefaultModel();
+
+	void extract(SentenceAlignment &, ExtractOutput &) const;
+	// if proper conditioning, we need the number of times a source phrase occured
+	void extractBase(SentenceAlignment &, ExtractOutput &) const;
+};
+
+#endif
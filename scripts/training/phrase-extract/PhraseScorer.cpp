@@ -0,0 +1,790 @@
+/*
+ *  PhraseScorer.cpp
+ *  Moses Training
+ *
+ *  Scoring code taken over from score.cpp
+ *  © 2009 University of Edinburgh
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ */
+
+#include "PhraseScorer.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Bz2LineReader.h"
+#include "Bz2LineWriter.h"
+#include "FieldSplitter.h"
+
+using namespace bg_zhechev_ventsislav;
+
+static bool isNonTerminal( const StringPiece &word )
+{
+	return (word.length()>=3 &&
+		word[0] == '[' &&
+		word[word.length()-1] == ']');
+}
+
+// the fields are not null-terminated, so numbers are copied out before parsing
+static const char* copyNumber(const StringPiece& field, char (&number)[64]) {
+	StringPiece digits = field.substr(0, sizeof(number) - 1);
+	memcpy(number, digits.data(), digits.size());
+	number[digits.size()] = '\0';
+	return number;
+}
+
+static float parseCount(const StringPiece& field) {
+	char number[64];
+	return strtof(copyNumber(field, number), NULL);
+}
+
+static double parseProbability(const StringPiece& field) {
+	char number[64];
+	return strtod(copyNumber(field, number), NULL);
+}
+
+static int parseIndex(const StringPiece& digits) {
+	int index = 0;
+	for (size_t i = 0; i < digits.size() && digits[i] >= '0' && digits[i] <= '9'; index = index * 10 + (digits[i++] - '0'));
+	return index;
+}
+
+// the deferred records are binary: lengths are stored in 7-bit groups, lowest first, with the top bit set on all but the last
+static void appendLength(string& target, size_t length) {
+	for (; length >= 0x80; length >>= 7)
+		target += char((length & 0x7f) | 0x80);
+	target += char(length);
+}
+
+static bool readLength(istream& in, size_t& length) {
+	length = 0;
+	for (int shift = 0; ; shift += 7) {
+		int c = in.get();
+		if (c == EOF)
+			return false;
+		length |= size_t(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return true;
+	}
+}
+
+static void appendCount(string& target, float count) {
+	target.append(reinterpret_cast<const char*>(&count), sizeof(count));
+}
+
+static float readCount(istream& in) {
+	float count;
+	in.read(reinterpret_cast<char*>(&count), sizeof(count));
+	return count;
+}
+
+PhraseScorer::PhraseScorer(const LexicalTable& lex) : lexTable(lex), vcbS(lex.vcbS), vcbT(lex.vcbT), lineCount(0), lastSource(-1), lastPhrasePair(NULL), countedLines(0), lastCountedPair(NULL), inverseFlag(false), hierarchicalFlag(false), wordAlignmentFlag(false), goodTuringFlag(false), logProbFlag(false), negLogProb(1), lexFlag(true), deferDiscountFlag(false), topK(0), significanceThreshold(0.), sentencePairs(0.) {
+	for (size_t i=0; i<=GT_MAX; ++i) {
+		countOfCounts[i] = 0;
+		discountFactor[i] = 1.;
+	}
+}
+
+PhraseScorer::~PhraseScorer() {
+	finishCounting();
+}
+
+void PhraseScorer::addLine(const StringPiece& line) {
+	++lineCount;
+
+	// identical to last line? just add count
+	if (lastSource >= 0 && line == lastLine) {
+		lastPhrasePair->addToCount(line);
+		return;
+	}
+	line.copyTo(lastLine);
+
+	// create new phrase pair
+	PhraseAlignment phrasePair;
+	phrasePair.create(line, lineCount, *this);
+
+	// only differs in count? just add count
+	if (lastPhrasePair != NULL && lastPhrasePair->equals(phrasePair)) {
+		lastPhrasePair->count += phrasePair.count;
+		phrasePair.clear();
+		return;
+	}
+
+	// if new source phrase, process last batch
+	if (lastSource >= 0 && lastSource != phrasePair.source) {
+		processPhrasePairs(phrasePairsWithSameF);
+		for (size_t j=0; j<phrasePairsWithSameF.size(); phrasePairsWithSameF[j++].clear());
+		phrasePairsWithSameF.clear();
+		phraseTableT.clear();
+		phraseTableS.clear();
+		// process line again, since phrase tables flushed
+		phrasePair.clear();
+		phrasePair.create(line, lineCount, *this);
+	}
+
+	// add phrase pairs to list, it's now the last one
+	lastSource = phrasePair.source;
+	phrasePairsWithSameF.push_back(phrasePair);
+	lastPhrasePair = &phrasePairsWithSameF[phrasePairsWithSameF.size()-1];
+}
+
+void PhraseScorer::finish() {
+	processPhrasePairs(phrasePairsWithSameF);
+	for (size_t j=0; j<phrasePairsWithSameF.size(); phrasePairsWithSameF[j++].clear());
+	phrasePairsWithSameF.clear();
+	phraseTableT.clear();
+	phraseTableS.clear();
+	lastSource = -1;
+	lastPhrasePair = NULL;
+	lastLine.clear();
+	lastRecordHead.clear();
+}
+
+void PhraseScorer::countLine(const StringPiece& line) {
+	++countedLines;
+
+	// identical to last line? just add count
+	if (line == lastCountedLine) {
+		lastCountedPair->addToCount(line);
+		return;
+	}
+	line.copyTo(lastCountedLine);
+
+	// create new phrase pair
+	PhraseAlignment *phrasePair = new PhraseAlignment();
+	phrasePair->create(line, countedLines, *this);
+
+	if (countedLines == 1) {
+		lastCountedPair = phrasePair;
+		return;
+	}
+
+	// only differs in count? just add count
+	if (lastCountedPair->match(*phrasePair, *this)) {
+		lastCountedPair->count += phrasePair->count;
+		phrasePair->clear();
+		delete(phrasePair);
+		return;
+	}
+
+	// periodically house cleaning
+	if (phrasePair->source != lastCountedPair->source) {
+		phraseTableT.clear(); // these would get too big
+		phraseTableS.clear(); // these would get too big
+		// process line again, since phrase tables flushed
+		phrasePair->clear();
+		phrasePair->create(line, countedLines, *this);
+	}
+
+	int count = lastCountedPair->count + 0.99999;
+	if(count <= GT_MAX)
+		++countOfCounts[ count ];
+	lastCountedPair->clear();
+	delete( lastCountedPair );
+	lastCountedPair = phrasePair;
+}
+
+void PhraseScorer::finishCounting() {
+	if (lastCountedPair != NULL) {
+		// the last phrase pair has to be counted as well
+		int count = lastCountedPair->count + 0.99999;
+		if(count <= GT_MAX)
+			++countOfCounts[ count ];
+		lastCountedPair->clear();
+		delete lastCountedPair;
+		lastCountedPair = NULL;
+	}
+	lastCountedLine.clear();
+}
+
+bool PhraseScorer::appendDiscounted(istream& records, string& head, string& target) const {
+	size_t shared, rest;
+	if (!readLength(records, shared) || !readLength(records, rest))
+		return false;
+	head.resize(shared + rest);
+	records.read(&head[0] + shared, rest);
+	float count = readCount(records);
+	float totalCount = readCount(records);
+	size_t scoresSize;
+	readLength(records, scoresSize);
+
+	target += head;
+	if (count<GT_MAX)
+		count *= discountFactor[(int)(count+0.99999)];
+	appendFloat(target, logProbFlag ? negLogProb*log(count / totalCount) : count / totalCount);
+	const size_t scoresStart = target.size();
+	target.resize(scoresStart + scoresSize);
+	records.read(&target[0] + scoresStart, scoresSize);
+	target += " ||| ";
+	appendFloat(target, totalCount);
+	target += '\n';
+	return records.good();
+}
+
+void PhraseScorer::computeDiscountFactors(const int countOfCounts[], float discountFactor[]) {
+	discountFactor[0] = 0.01; // floor
+	cerr << "\n";
+	for(int i=1;i<GT_MAX; ++i) {
+		discountFactor[i] = ((float)i+1)/(float)i*(((float)countOfCounts[i+1]+0.1) / ((float)countOfCounts[i]+0.1));
+		cerr << "count " << i << ": " << countOfCounts[ i ] << ", discount factor: " << discountFactor[i];
+		// some smoothing...
+		if (discountFactor[i]>1)
+			discountFactor[i] = 1;
+		if (discountFactor[i]<discountFactor[i-1])
+			discountFactor[i] = discountFactor[i-1];
+		cerr << " -> " << discountFactor[i]*i << endl;
+	}
+}
+
+void PhraseScorer::processPhrasePairs(vector<PhraseAlignment>& phrasePair) {
+  if (phrasePair.size() == 0) return;
+
+	// group phrase pairs based on alignments that matter
+	// (i.e. that re-arrange non-terminals)
+	vector<vector<PhraseAlignment*> > phrasePairGroup;
+	float totalSource = 0.;
+
+	// loop through phrase pairs
+	for(size_t i=0; i<phrasePair.size(); ++i) {
+		// add to total count
+		totalSource += phrasePair[i].count;
+
+		bool matched = false;
+		// check for matches
+		for(size_t g=0; g<phrasePairGroup.size(); ++g) {
+			vector< PhraseAlignment* > &group = phrasePairGroup[g];
+			// matched? place into same group
+			if ( group[0]->match( phrasePair[i], *this )) {
+				group.push_back( &phrasePair[i] );
+				matched = true;
+			}
+		}
+		// not matched? create new group
+		if (!matched) {
+			vector< PhraseAlignment* > newGroup;
+			newGroup.push_back( &phrasePair[i] );
+			phrasePairGroup.push_back( newGroup );
+		}
+	}
+
+	if (topK > 0 || significanceThreshold > 0.)
+		prunePhrasePairs(phrasePairGroup, totalSource);
+
+	for(size_t g=0; g<phrasePairGroup.size(); ++g) {
+		vector< PhraseAlignment* > &group = phrasePairGroup[g];
+		outputPhrasePair(group, totalSource);
+	}
+}
+
+// Removes the groups that fail the significance test or do not rank among the topK best; the rest keep their order.
+// Pruned pairs still count towards the counts of counts, so that the Good Turing discount factors do not depend on pruning.
+void PhraseScorer::prunePhrasePairs(vector<vector<PhraseAlignment*> >& phrasePairGroup, float totalSource) {
+	vector<pair<double, size_t> > ranking;
+	vector<bool> kept(phrasePairGroup.size(), false);
+	for(size_t g=0; g<phrasePairGroup.size(); ++g) {
+		float count = 0.;
+		for(size_t i=0; i<phrasePairGroup[g].size(); count += phrasePairGroup[g][i++]->count);
+		if (significanceThreshold > 0. && significance(count, totalSource) < significanceThreshold)
+			continue;
+		kept[g] = true;
+		if (topK > 0)
+			ranking.push_back(make_pair(-pruningScore(phrasePairGroup[g], totalSource), g));
+	}
+
+	if (topK > 0 && ranking.size() > (size_t)topK) {
+		// ties are broken by the original order
+		sort(ranking.begin(), ranking.end());
+		for(size_t r=topK; r<ranking.size(); ++r)
+			kept[ranking[r].second] = false;
+	}
+
+	size_t keptGroups = 0;
+	for(size_t g=0; g<phrasePairGroup.size(); ++g)
+		if (kept[g])
+			phrasePairGroup[keptGroups++].swap(phrasePairGroup[g]);
+		else if (goodTuringFlag && deferDiscountFlag) {
+			float count = 0.;
+			for(size_t i=0; i<phrasePairGroup[g].size(); count += phrasePairGroup[g][i++]->count);
+			int countClass = count + 0.99999;
+			if (countClass <= GT_MAX)
+				++countOfCounts[ countClass ];
+		}
+	phrasePairGroup.resize(keptGroups);
+}
+
+// The weighted sum of the log scores of a group; the phrase translation probability is taken without discounting,
+// which can only change the ranking of pairs with very close counts.
+double PhraseScorer::pruningScore(vector<PhraseAlignment*>& phrasePair, float totalCount) {
+	float count = 0.;
+	for(size_t i=0; i<phrasePair.size(); count += phrasePair[i++]->count);
+
+	double score = (pruneWeights.size() > 0 ? pruneWeights[0] : 1.) * log(count / totalCount);
+	const double lexWeight = pruneWeights.size() > 1 ? pruneWeights[1] : 1.;
+	if (lexFlag && lexWeight != 0.) {
+		PhraseView phraseS = phraseTableS.getPhrase( phrasePair[0]->source );
+		PhraseView phraseT = phraseTableT.getPhrase( phrasePair[0]->target );
+		score += lexWeight * log(computeLexicalTranslation(phraseS, phraseT, findBestAlignment(phrasePair)));
+	}
+	return score;
+}
+
+// Significance of a phrase pair as in Johnson et al. (2007): the negative log p-value of Fisher's exact test on the pair and source counts.
+// The target phrase count is not known while scoring the direct table, so it is taken to be the pair count,
+// which gives the highest significance possible; hence only pairs are pruned that would fail the full test as well.
+// With that, p = C(c(s), c(s,t)) / C(N, c(s,t)); pairs seen more often than there are sentence pairs are always significant.
+double PhraseScorer::significance(float count, float totalSource) const {
+	const int k = count + 0.99999;
+	if (k >= sentencePairs)
+		return HUGE_VAL;
+	double negLogP = 0.;
+	for (int i = 0; i < k; ++i)
+		negLogP += log((sentencePairs - i) / (totalSource - i));
+	return negLogP;
+}
+
+PhraseAlignment* PhraseScorer::findBestAlignment( vector< PhraseAlignment* > &phrasePair ) {
+	float bestAlignmentCount = -1.;
+	PhraseAlignment* bestAlignment;
+
+	for(size_t i=0; i<phrasePair.size(); ++i)
+		if (phrasePair[i]->count > bestAlignmentCount) {
+			bestAlignmentCount = phrasePair[i]->count;
+			bestAlignment = phrasePair[i];
+		}
+
+	return bestAlignment;
+}
+
+void PhraseScorer::outputPhrasePair(vector<PhraseAlignment*> &phrasePair, float totalCount) {
+  if (phrasePair.size() == 0)
+		return;
+
+	PhraseAlignment *bestAlignment = findBestAlignment( phrasePair );
+
+	// compute count
+	float count = 0.;
+	for(size_t i=0; i<phrasePair.size(); count += phrasePair[i++]->count);
+
+	const size_t lineStart = output.size();
+
+	PhraseView phraseS = phraseTableS.getPhrase( phrasePair[0]->source );
+	PhraseView phraseT = phraseTableT.getPhrase( phrasePair[0]->target );
+
+	// labels (if hierarchical)
+
+	// source phrase (unless inverse)
+	if (!inverseFlag) {
+		for (size_t j=0; j<phraseS.size(); ++j) {
+			vcbS.getWord(phraseS[j]).appendTo(output);
+			output += ' ';
+		}
+		output += "||| ";
+	}
+
+	// target phrase
+	for (size_t j=0; j<phraseT.size(); ++j) {
+		vcbT.getWord(phraseT[j]).appendTo(output);
+		output += ' ';
+	}
+	output += "||| ";
+
+	// source phrase (if inverse)
+	if (inverseFlag) {
+		for (size_t j=0; j<phraseS.size(); ++j) {
+			vcbS.getWord(phraseS[j]).appendTo(output);
+			output += ' ';
+		}
+		output += "||| ";
+	}
+
+	// alignment info for non-terminals
+	if (!inverseFlag && hierarchicalFlag) {
+    assert(phraseT.size() == bestAlignment->alignedToT.size() + 1);
+		for(size_t j = 0; j < phraseT.size() - 1; ++j)
+			if (isNonTerminal(vcbT.getWord( phraseT[j] ))) {
+        assert(bestAlignment->alignedToT[ j ].size() == 1);
+				appendUnsigned(output, *(bestAlignment->alignedToT[j].begin()));
+				output += '-';
+				appendUnsigned(output, j);
+				output += ' ';
+			}
+		output += "||| ";
+	}
+
+	// phrase translation probability (filled in later if the discount factors are not known yet)
+	const size_t probabilityStart = output.size();
+	const bool deferred = goodTuringFlag && deferDiscountFlag;
+	if (deferred) {
+		int countClass = count + 0.99999;
+		if (countClass <= GT_MAX)
+			++countOfCounts[ countClass ];
+	} else {
+		if (goodTuringFlag && count<GT_MAX)
+			count *= discountFactor[(int)(count+0.99999)];
+
+		appendFloat(output, logProbFlag ? negLogProb*log(count / totalCount) : count / totalCount);
+	}
+
+	// lexical translation probability
+	if (lexFlag) {
+		output += ' ';
+		appendFloat(output, logProbFlag ?
+								negLogProb*log(computeLexicalTranslation(phraseS, phraseT, bestAlignment)) :
+								computeLexicalTranslation(phraseS, phraseT, bestAlignment));
+	}
+
+	const size_t scoresEnd = output.size();
+	output += " ||| ";
+	appendFloat(output, totalCount);
+	output += '\n';
+
+	if (deferred)
+		replaceByRecord(lineStart, probabilityStart, scoresEnd, count, totalCount);
+
+	// optional output of word alignments
+	if (!inverseFlag && wordAlignmentFlag) {
+		// source phrase
+		for (size_t j=0; j<phraseS.size(); ++j) {
+			vcbS.getWord(phraseS[j]).appendTo(wordAlignmentOutput);
+			wordAlignmentOutput += ' ';
+		}
+		wordAlignmentOutput += "||| ";
+
+		// target phrase
+		for (size_t j=0; j<phraseT.size(); ++j) {
+			vcbT.getWord(phraseT[j]).appendTo(wordAlignmentOutput);
+			wordAlignmentOutput += ' ';
+		}
+		wordAlignmentOutput += "|||";
+
+		// alignment
+		for(size_t j=0;j<bestAlignment->alignedToT.size(); ++j) {
+			const set< size_t > &aligned = bestAlignment->alignedToT[j];
+			for (set< size_t >::const_iterator p(aligned.begin()); p != aligned.end(); ++p) {
+				wordAlignmentOutput += ' ';
+				appendUnsigned(wordAlignmentOutput, *p);
+				wordAlignmentOutput += '-';
+				appendUnsigned(wordAlignmentOutput, j);
+			}
+		}
+		wordAlignmentOutput += '\n';
+	}
+}
+
+// The record of a line for appendDiscounted(): the phrases (and non-terminal alignment) before the probability,
+// without the bytes they share with those of the last record, the raw counts, and the scores following the probability.
+// The probability and the total count are formatted from the counts once the discount factors are known.
+void PhraseScorer::replaceByRecord(size_t lineStart, size_t probabilityStart, size_t scoresEnd, float count, float totalCount) {
+	const size_t headSize = probabilityStart - lineStart;
+	const size_t maxShared = min(headSize, lastRecordHead.size());
+	size_t shared = 0;
+	while (shared < maxShared && output[lineStart + shared] == lastRecordHead[shared])
+		++shared;
+	lastRecordHead.assign(output, lineStart, headSize);
+
+	record.clear();
+	appendLength(record, shared);
+	appendLength(record, headSize - shared);
+	record.append(lastRecordHead, shared, headSize - shared);
+	appendCount(record, count);
+	appendCount(record, totalCount);
+	appendLength(record, scoresEnd - probabilityStart);
+	record.append(output, probabilityStart, scoresEnd - probabilityStart);
+
+	output.resize(lineStart);
+	output += record;
+}
+
+double PhraseScorer::computeLexicalTranslation( const PhraseView &phraseS, const PhraseView &phraseT, PhraseAlignment *alignment ) {
+	// lexical translation probability
+	double lexScore = 1.;
+	int null = vcbS.getWordID("NULL");
+	// all target words have to be explained
+	for (size_t ti=0; ti<alignment->alignedToT.size(); ++ti) {
+    const set<size_t>& srcIndices = alignment->alignedToT[ti];
+		if (srcIndices.empty())
+		// explain unaligned word by NULL
+			lexScore *= lexTable.permissiveLookup(null, phraseT[ti]);
+		else {
+		 // go through all the aligned words to compute average
+			double thisWordScore = 0.;
+      for (set<size_t>::const_iterator p(srcIndices.begin()); p != srcIndices.end(); thisWordScore += lexTable.permissiveLookup(phraseS[*(p++)], phraseT[ti]));
+			lexScore *= (thisWordScore / srcIndices.size());
+		}
+	}
+	return lexScore;
+}
+
+void PhraseAlignment::addToCount(const StringPiece& line) {
+	StringPiece field[5];
+	size_t items = splitFields(line, field, 5);
+	if (items == 3) // no specified counts -> counts as one
+		count += 1.;
+	else
+		count += parseCount(field[items-1]);
+}
+
+// read in a phrase pair and store it
+void PhraseAlignment::create(const StringPiece& line, int lineID, PhraseScorer& scorer) {
+	StringPiece field[5];
+	size_t items = splitFields(line, field, 5);
+	PHRASE phraseS, phraseT;
+	StringPiece token;
+
+	// source phrase
+	for (TokenIterator tokens(field[0]); tokens.next(token); phraseS.push_back( scorer.vcbS.storeIfNew( token ) ));
+	// target phrase
+	if (items > 1)
+		for (TokenIterator tokens(field[1]); tokens.next(token); phraseT.push_back( scorer.vcbT.storeIfNew( token ) ));
+	// alignment
+	if (items > 2)
+		for (TokenIterator tokens(field[2]); tokens.next(token);) {
+			size_t dash = token.find('-');
+			int s = parseIndex(token.substr(0, dash));
+			int t = parseIndex(dash == StringPiece::npos ? token : token.substr(dash + 1));
+			if (t >= phraseT.size() || s >= phraseS.size()) {
+				cerr << "WARNING: phrase pair " << lineID
+						 << " has alignment point (" << s << ", " << t
+						 << ") out of bounds (" << phraseS.size() << ", " << phraseT.size() << ")\n";
+			} else {
+				// first alignment point? -> initialize
+				if (alignedToT.size() == 0) {
+          assert(alignedToS.size() == 0);
+          size_t numTgtSymbols = (scorer.hierarchicalFlag ? phraseT.size()-1 : phraseT.size());
+          alignedToT.resize(numTgtSymbols);
+          size_t numSrcSymbols = (scorer.hierarchicalFlag ? phraseS.size()-1 : phraseS.size());
+          alignedToS.resize(numSrcSymbols);
+					source = scorer.phraseTableS.storeIfNew( phraseS );
+					target = scorer.phraseTableT.storeIfNew( phraseT );
+				}
+				// add alignment point
+				alignedToT[t].insert( s );
+				alignedToS[s].insert( t );
+			}
+		}
+	// count (the last number in the field)
+	if (items > 3)
+		for (TokenIterator tokens(field[3]); tokens.next(token); count = parseCount(token));
+
+	if (items == 3)
+		count = 1.0;
+	if (items < 3 || items > 4)
+		cerr << "ERROR: faulty line " << lineID << ": " << line << endl;
+}
+
+// check if two word alignments between a phrase pairs "match"
+// i.e. they do not differ in the alignment of non-termimals
+bool PhraseAlignment::match( const PhraseAlignment& other, PhraseScorer& scorer )
+{
+	if (other.target != target || other.source != source) return false;
+	if (!scorer.hierarchicalFlag) return true;
+
+	PhraseView phraseT = scorer.phraseTableT.getPhrase( target );
+
+  assert(phraseT.size() == alignedToT.size() + 1);
+  assert(alignedToT.size() == other.alignedToT.size());
+
+	// loop over all words (note: 0 = left hand side of rule)
+	for(size_t i=0;i<phraseT.size()-1;++i)
+		if (isNonTerminal( scorer.vcbT.getWord( phraseT[i] ) )) {
+			if (alignedToT[i].size() != 1 ||
+			    other.alignedToT[i].size() != 1 ||
+		    	    *(alignedToT[i].begin()) != *(other.alignedToT[i].begin()))
+				return false;
+		}
+
+	return true;
+}
+
+
+// One line of a lex file; the later of two lines for the same word pair wins
+struct LexicalEntry {
+	WORD_ID source;
+	WORD_ID target;
+	double prob;
+
+	LexicalEntry(WORD_ID s, WORD_ID t, double p) : source(s), target(t), prob(p) {}
+	inline bool operator<(const LexicalEntry& other) const { return source < other.source || (source == other.source && target < other.target); }
+};
+
+// Layout of a binary lexical table: the header is followed by probs, targets, offsets and
+// the source and target words (each followed by a line break, in the order of their IDs)
+struct BinaryLexHeader {
+	char magic[8];
+	uint64_t sourceWords;
+	uint64_t targetWords;
+	uint64_t entries;
+	uint64_t sourceVocabularyBytes;
+	uint64_t targetVocabularyBytes;
+};
+
+static const char binaryLexMagic[8] = {'L', 'E', 'X', 'C', 'S', 'R', '1', '\0'};
+
+LexicalTable::LexicalTable() : offsetData(1, 0), offsets(&offsetData[0]), targets(NULL), probs(NULL), sourceCount(0), mapping(NULL), mappingSize(0) {}
+
+LexicalTable::~LexicalTable() {
+	if (mapping != NULL)
+		munmap(mapping, mappingSize);
+}
+
+void LexicalTable::load(const string& fileName, bool binaryCache) {
+	const string binaryFileName = fileName + ".bin";
+	if (binaryCache && fileName != "-" && loadBinary(binaryFileName, fileName))
+		return;
+
+  cerr << "Loading lexical translation table from " << fileName;
+	Bz2LineReader inFile(fileName, Bz2LineReader::UNCOMPRESSED);
+
+	vector<LexicalEntry> entries;
+	int i = 0;
+	StringPiece line;
+	while (inFile.readLine(line)) {
+		if (line.empty())
+			break;
+    if (++i%100000 == 0) cerr << "." << flush;
+
+    StringPiece token[4];
+    size_t tokenCount = 0;
+    for (TokenIterator tokens(line); tokenCount < 4 && tokens.next(token[tokenCount]); ++tokenCount);
+    if (tokenCount != 3) {
+      cerr << "line " << i << " “" << line << "” in " << fileName
+			     << " has wrong number of tokens (" << (tokenCount < 4 ? "" : "more than ") << tokenCount << "), skipping" << endl;
+      continue;
+    }
+
+    WORD_ID wordT = vcbT.storeIfNew( token[0] );
+    WORD_ID wordS = vcbS.storeIfNew( token[1] );
+    entries.push_back(LexicalEntry(wordS, wordT, parseProbability(token[2])));
+  }
+  cerr << endl;
+
+	// build the rows, keeping the last probability given for each word pair
+	stable_sort(entries.begin(), entries.end());
+	offsetData.assign(vcbS.size() + 1, 0);
+	targetData.clear();
+	probData.clear();
+	for (size_t e = 0; e < entries.size(); ++e) {
+		if (e + 1 < entries.size() && !(entries[e] < entries[e+1]))
+			continue;
+		targetData.push_back(entries[e].target);
+		probData.push_back(entries[e].prob);
+		++offsetData[entries[e].source + 1];
+	}
+	for (size_t s = 1; s < offsetData.size(); ++s)
+		offsetData[s] += offsetData[s-1];
+
+	offsets = &offsetData[0];
+	targets = targetData.empty() ? NULL : &targetData[0];
+	probs = probData.empty() ? NULL : &probData[0];
+	sourceCount = vcbS.size();
+
+	if (binaryCache && fileName != "-")
+		saveBinary(binaryFileName);
+}
+
+bool LexicalTable::loadBinary(const string& binaryFileName, const string& fileName) {
+	struct stat binaryStat, textStat;
+	if (stat(binaryFileName.c_str(), &binaryStat) != 0)
+		return false;
+	if (stat(fileName.c_str(), &textStat) == 0 && textStat.st_mtime > binaryStat.st_mtime) {
+		cerr << "The binary lexical table " << binaryFileName << " is older than " << fileName << " and will be rebuilt" << endl;
+		return false;
+	}
+
+	int file = open(binaryFileName.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+	size_t size = binaryStat.st_size;
+	void* data = size < sizeof(BinaryLexHeader) ? MAP_FAILED : mmap(NULL, size, PROT_READ, MAP_SHARED, file, 0);
+	close(file);
+	if (data == MAP_FAILED) {
+		cerr << "Could not map the binary lexical table " << binaryFileName << "; it will be rebuilt" << endl;
+		return false;
+	}
+
+	const BinaryLexHeader& header = *static_cast<const BinaryLexHeader*>(data);
+	if (memcmp(header.magic, binaryLexMagic, sizeof(binaryLexMagic)) != 0 ||
+			size != sizeof(BinaryLexHeader) + header.entries * (sizeof(double) + sizeof(WORD_ID)) + (header.sourceWords + 1) * sizeof(unsigned) + header.sourceVocabularyBytes + header.targetVocabularyBytes) {
+		cerr << "The file " << binaryFileName << " is not a valid binary lexical table; it will be rebuilt" << endl;
+		munmap(data, size);
+		return false;
+	}
+
+	cerr << "Mapping binary lexical translation table from " << binaryFileName << endl;
+	const char* position = static_cast<const char*>(data) + sizeof(BinaryLexHeader);
+	probs = reinterpret_cast<const double*>(position);
+	position += header.entries * sizeof(double);
+	targets = reinterpret_cast<const WORD_ID*>(position);
+	position += header.entries * sizeof(WORD_ID);
+	offsets = reinterpret_cast<const unsigned*>(position);
+	position += (header.sourceWords + 1) * sizeof(unsigned);
+	sourceCount = header.sourceWords;
+
+	// the vocabularies are rebuilt in ID order, so that the IDs match the rows
+	Vocabulary* vocabularies[2] = {&vcbS, &vcbT};
+	const uint64_t vocabularyBytes[2] = {header.sourceVocabularyBytes, header.targetVocabularyBytes};
+	for (size_t v = 0; v < 2; ++v) {
+		StringPiece words(position, vocabularyBytes[v]);
+		for (size_t begin = 0, end; begin < words.size(); begin = end + 1) {
+			end = words.find('\n', begin);
+			vocabularies[v]->storeIfNew(words.substr(begin, end - begin));
+		}
+		position += vocabularyBytes[v];
+	}
+	assert(vcbS.size() == header.sourceWords && vcbT.size() == header.targetWords);
+
+	mapping = data;
+	mappingSize = size;
+	return true;
+}
+
+void LexicalTable::saveBinary(const string& binaryFileName) const {
+	string vocabularies[2];
+	for (WORD_ID w = 0; w < vcbS.size(); ++w) {
+		vcbS.getWord(w).appendTo(vocabularies[0]);
+		vocabularies[0] += '\n';
+	}
+	for (WORD_ID w = 0; w < vcbT.size(); ++w) {
+		vcbT.getWord(w).appendTo(vocabularies[1]);
+		vocabularies[1] += '\n';
+	}
+
+	BinaryLexHeader header;
+	memcpy(header.magic, binaryLexMagic, sizeof(binaryLexMagic));
+	header.sourceWords = sourceCount;
+	header.targetWords = vcbT.size();
+	header.entries = probData.size();
+	header.sourceVocabularyBytes = vocabularies[0].size();
+	header.targetVocabularyBytes = vocabularies[1].size();
+
+	// written under a temporary name first, so that a concurrent run never maps a partial file
+	ostringstream temporaryName;
+	temporaryName << binaryFileName << "." << getpid();
+	ofstream binaryFile(temporaryName.str().c_str(), ios::binary);
+	binaryFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	if (!probData.empty()) {
+		binaryFile.write(reinterpret_cast<const char*>(&probData[0]), probData.size() * sizeof(double));
+		binaryFile.write(reinterpret_cast<const char*>(&targetData[0]), targetData.size() * sizeof(WORD_ID));
+	}
+	binaryFile.write(reinterpret_cast<const char*>(&offsetData[0]), offsetData.size() * sizeof(unsigned));
+	binaryFile << vocabularies[0] << vocabularies[1];
+	binaryFile.close();
+	if (binaryFile.fail() || rename(temporaryName.str().c_str(), binaryFileName.c_str()) != 0) {
+		cerr << "WARNING: could not write the binary lexical table " << binaryFileName << endl;
+		remove(temporaryName.str().c_str());
+	} else
+		cerr << "Saved binary lexical translation table to " << binaryFileName << endl;
+}
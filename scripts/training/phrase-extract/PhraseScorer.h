@@ -0,0 +1,170 @@
+/*
+ *  PhraseScorer.h
+ *  Moses Training
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ *  Scoring of the phrase pairs of a sorted extract file, shared by score and extract-score.
+ *  Each scorer keeps its own vocabularies and phrase tables, so several scorers can work on separate source phrases at the same time.
+ *  Only the lexical translation table is shared; it is read-only once loaded.
+ *
+ */
+
+#ifndef PHRASESCORER
+#define PHRASESCORER
+
+#include <algorithm>
+#include <istream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "tables-core.h"
+
+using namespace std;
+
+#define GT_MAX 10
+
+class PhraseScorer;
+
+// data structure for a single phrase pair
+struct PhraseAlignment {
+	int target, source;
+	float count;
+	vector< set<size_t> > alignedToT;
+	vector< set<size_t> > alignedToS;
+
+	void create(const bg_zhechev_ventsislav::StringPiece&, int, PhraseScorer&);
+	void addToCount(const bg_zhechev_ventsislav::StringPiece&);
+	inline void clear() { alignedToT.clear(); alignedToS.clear(); }
+	inline bool equals(const PhraseAlignment& other) { return (other.target == target && other.source == source && other.alignedToT == alignedToT && other.alignedToS == alignedToS); }
+	bool match(const PhraseAlignment&, PhraseScorer&);
+};
+
+// LexicalTable holds the lexical translation probabilities in compressed sparse rows:
+// the translations of source word s are targets[offsets[s]..offsets[s+1]), sorted by target word, with their probabilities in probs.
+// The rows can be saved to a binary file, from which later runs map them straight into memory.
+class LexicalTable {
+	vector<unsigned> offsetData;
+	vector<WORD_ID> targetData;
+	vector<double> probData;
+	//Point either into the vectors above or into the mapped binary file
+	const unsigned* offsets;
+	const WORD_ID* targets;
+	const double* probs;
+	size_t sourceCount;
+	void* mapping;
+	size_t mappingSize;
+
+	//Disable copying
+	LexicalTable(const LexicalTable&);
+	LexicalTable& operator=(const LexicalTable&);
+
+	bool loadBinary(const string& binaryFileName, const string& fileName);
+	void saveBinary(const string& binaryFileName) const;
+public:
+	//The words of the lexical table; every scorer starts with a copy of these, so that the word IDs in the table stay valid
+	Vocabulary vcbS;
+	Vocabulary vcbT;
+
+	LexicalTable();
+	~LexicalTable();
+
+	//Reads a lex file with lines “target source probability”.
+	//With binaryCache the table is mapped from fileName.bin if that is not older than the lex file, and is written there otherwise.
+	void load(const string& fileName, bool binaryCache = false);
+	inline double permissiveLookup(WORD_ID wordS, WORD_ID wordT) const {
+		if (wordS >= sourceCount) return 1.0;
+		const WORD_ID* end = targets + offsets[wordS+1];
+		const WORD_ID* found = lower_bound(targets + offsets[wordS], end, wordT);
+		if (found == end || *found != wordT) return 1.0;
+		return probs[found - targets];
+	}
+};
+
+class PhraseScorer {
+	friend struct PhraseAlignment;
+
+	const LexicalTable& lexTable;
+	Vocabulary vcbS;
+	Vocabulary vcbT;
+	PhraseTable phraseTableS;
+	PhraseTable phraseTableT;
+
+	//State of the scoring pass
+	int lineCount;
+	int lastSource;
+	vector<PhraseAlignment> phrasePairsWithSameF;
+	string lastLine;
+	PhraseAlignment* lastPhrasePair;
+
+	//State of the count of counts pass
+	int countedLines;
+	string lastCountedLine;
+	PhraseAlignment* lastCountedPair;
+
+	//State of the deferred records: the phrases of the last record, which the next one may share
+	string lastRecordHead;
+	string record;
+
+	//Disable copying
+	PhraseScorer(const PhraseScorer&);
+	PhraseScorer& operator=(const PhraseScorer&);
+
+	void processPhrasePairs(vector<PhraseAlignment>&);
+	void prunePhrasePairs(vector<vector<PhraseAlignment*> >&, float);
+	double pruningScore(vector<PhraseAlignment*>&, float);
+	double significance(float, float) const;
+	PhraseAlignment* findBestAlignment(vector<PhraseAlignment*>&);
+	void outputPhrasePair(vector<PhraseAlignment*>&, float);
+	void replaceByRecord(size_t, size_t, size_t, float, float);
+	double computeLexicalTranslation(const PhraseView&, const PhraseView&, PhraseAlignment*);
+public:
+	bool inverseFlag;
+	bool hierarchicalFlag;
+	bool wordAlignmentFlag;
+	bool goodTuringFlag;
+	bool logProbFlag;
+	int negLogProb;
+	bool lexFlag;
+	//With goodTuringFlag: the scores are output as binary records with the raw counts, and the counts of counts are collected while scoring.
+	//Once all counts are known, computeDiscountFactors() and appendDiscounted() turn the records into phrase table lines.
+	bool deferDiscountFlag;
+
+	//Pruning of the translations of each source phrase, for the direct table only:
+	//at most topK pairs are kept, ranked by the sum of the log scores weighted with pruneWeights (1 for missing weights), and
+	//with a significanceThreshold pairs are dropped whose co-occurrence is not significant (-log p-value) among sentencePairs sentence pairs.
+	//Zero disables either kind of pruning.
+	int topK;
+	vector<double> pruneWeights;
+	double significanceThreshold;
+	double sentencePairs;
+
+	int countOfCounts[GT_MAX+1];
+	float discountFactor[GT_MAX+1];
+
+	//The scored phrase table lines (and word alignments) are appended here; the caller writes them out and clears them
+	string output;
+	string wordAlignmentOutput;
+
+	PhraseScorer(const LexicalTable&);
+	~PhraseScorer();
+
+	//Feeds the next line of a sorted extract file.
+	//The scores for a source phrase are produced once the first line of the next source phrase (or finish()) is seen.
+	void addLine(const bg_zhechev_ventsislav::StringPiece& line);
+	void finish();
+
+	//Feeds the next line of a sorted extract file to the count of counts for Good Turing discounting
+	void countLine(const bg_zhechev_ventsislav::StringPiece& line);
+	void finishCounting();
+
+	//Turns (possibly combined) counts of counts into Good Turing discount factors
+	static void computeDiscountFactors(const int countOfCounts[], float discountFactor[]);
+	//Reads the next record output with deferDiscountFlag and appends its phrase table line, using the current discount factors.
+	//head keeps the phrases of the previous record between calls. Returns false once there are no more records.
+	bool appendDiscounted(istream& records, string& head, string& target) const;
+};
+
+#endif
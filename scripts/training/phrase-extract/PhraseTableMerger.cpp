@@ -0,0 +1,76 @@
+/*
+ *  PhraseTableMerger.cpp
+ *  Moses Training
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ */
+
+#include "PhraseTableMerger.h"
+
+#include <cstdlib>
+#include <iostream>
+
+#include "FieldSplitter.h"
+
+namespace bg_zhechev_ventsislav {
+
+	PhraseTableMerger::PhraseTableMerger(const string& fileNameDirect, const string& fileNameIndirect, unsigned threads) : direct(fileNameDirect, Bz2LineReader::COMPRESSED, threads), indirect(fileNameIndirect, Bz2LineReader::COMPRESSED, threads), started(false), skippedDirect(0), skippedIndirect(0) {
+		moreDirect = direct.readLine(directLine) && !directLine.empty();
+		moreIndirect = indirect.readLine(indirectLine) && !indirectLine.empty();
+	}
+
+	bool PhraseTableMerger::next(StringPiece& directResult, StringPiece& indirectResult) {
+		if (started && moreDirect && moreIndirect) {
+			moreDirect = direct.readLine(directLine) && !directLine.empty();
+			moreIndirect = indirect.readLine(indirectLine) && !indirectLine.empty();
+		}
+		started = true;
+
+		while (moreDirect && moreIndirect) {
+			const StringPiece directKey = phrasePairKey(directLine, "direct");
+			const StringPiece indirectKey = phrasePairKey(indirectLine, "indirect");
+			const int order = directKey.compare(indirectKey);
+			if (order == 0) {
+				directKey.copyTo(lastKey);
+				directResult = directLine;
+				indirectResult = indirectLine;
+				return true;
+			}
+			// skip the line that has no partner in the other table
+			const StringPiece& smaller = order < 0 ? directKey : indirectKey;
+			if (smaller < StringPiece(lastKey)) {
+				cerr << "ERROR: the " << (order < 0 ? "direct" : "indirect") << " table is not sorted in the same (bytewise) order as the other one near: " << smaller << endl;
+				exit(1);
+			}
+			if (order < 0) {
+				++skippedDirect;
+				moreDirect = direct.readLine(directLine) && !directLine.empty();
+			} else {
+				++skippedIndirect;
+				moreIndirect = indirect.readLine(indirectLine) && !indirectLine.empty();
+			}
+		}
+
+		for (; moreDirect; moreDirect = direct.readLine(directLine) && !directLine.empty()) ++skippedDirect;
+		for (; moreIndirect; moreIndirect = indirect.readLine(indirectLine) && !indirectLine.empty()) ++skippedIndirect;
+		return false;
+	}
+
+	void PhraseTableMerger::reportSkipped() const {
+		if (skippedDirect > 0 || skippedIndirect > 0)
+			cerr << "WARNING: " << skippedDirect << " phrase pairs of the direct table and " << skippedIndirect << " of the indirect table have no counterpart in the other table and were skipped" << endl;
+	}
+
+	StringPiece PhraseTableMerger::phrasePairKey(const StringPiece& line, const char* table) {
+		size_t separator = findFieldSeparator(line);
+		if (separator != StringPiece::npos)
+			separator = findFieldSeparator(line, separator + 3);
+		if (separator == StringPiece::npos) {
+			cerr << "ERROR: malformed line in the " << table << " table: " << line << endl;
+			exit(1);
+		}
+		return line.substr(0, separator + 3);
+	}
+
+}
@@ -0,0 +1,57 @@
+/*
+ *  PhraseTableMerger.h
+ *  Moses Training
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ *  Merge-join of the direct and indirect phrase tables written by score on their phrase pairs.
+ *  Shared by consolidate and by the binarisation straight from the score output, so that both see the same phrase pairs.
+ *
+ */
+
+#ifndef PHRASETABLEMERGER
+#define PHRASETABLEMERGER
+
+#include <string>
+
+#include "Bz2LineReader.h"
+#include "StringPiece.h"
+
+using namespace std;
+
+namespace bg_zhechev_ventsislav {
+
+	//Both tables have to be sorted bytewise on whole lines; phrase pairs that are missing from either table (e.g. after pruning) are skipped.
+	class PhraseTableMerger {
+		Bz2LineReader direct;
+		Bz2LineReader indirect;
+		StringPiece directLine;
+		StringPiece indirectLine;
+		bool moreDirect;
+		bool moreIndirect;
+		bool started;
+		string lastKey;
+
+		//Disable copying
+		PhraseTableMerger(const PhraseTableMerger&);
+		PhraseTableMerger& operator=(const PhraseTableMerger&);
+	public:
+		unsigned long skippedDirect;
+		unsigned long skippedIndirect;
+
+		PhraseTableMerger(const string& fileNameDirect, const string& fileNameIndirect, unsigned threads = 1);
+
+		//Points the lines to the next phrase pair found in both tables. Returns false after the last one.
+		//The lines are only valid until the next call to next().
+		bool next(StringPiece& direct, StringPiece& indirect);
+
+		//Warns about the skipped phrase pairs, if there were any
+		void reportSkipped() const;
+
+		//The phrase pair of a line, including the separator after it, so that keys compare in the same order as the whole lines
+		static StringPiece phrasePairKey(const StringPiece& line, const char* table);
+	};
+
+}
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ *  StringPiece.h
+ *  Moses Training
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ *  A non-owning view of a run of characters, used to hand out lines and fields without copying them.
+ *  The viewed data has to outlive the piece—for lines returned by Bz2LineReader this means until the next call to readLine().
+ *
+ */
+
+#ifndef STRINGPIECE
+#define STRINGPIECE
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+namespace bg_zhechev_ventsislav {
+
+	class StringPiece {
+		const char* ptr;
+		size_t length_;
+	public:
+		static const size_t npos = size_t(-1);
+
+		StringPiece() : ptr(NULL), length_(0) {}
+		StringPiece(const char* data, size_t length) : ptr(data), length_(length) {}
+		StringPiece(const char* data) : ptr(data), length_(strlen(data)) {}
+		StringPiece(const string& data) : ptr(data.data()), length_(data.size()) {}
+
+		inline const char* data() const { return ptr; }
+		inline size_t size() const { return length_; }
+		inline size_t length() const { return length_; }
+		inline bool empty() const { return length_ == 0; }
+		inline const char* begin() const { return ptr; }
+		inline const char* end() const { return ptr + length_; }
+		inline char operator[](size_t i) const { return ptr[i]; }
+
+		inline string as_string() const { return empty() ? string() : string(ptr, length_); }
+		//Copies the piece into an existing string, reusing its storage
+		inline void copyTo(string& target) const { target.assign(ptr, length_); }
+		inline void appendTo(string& target) const { target.append(ptr, length_); }
+
+		inline StringPiece substr(size_t pos, size_t n = npos) const {
+			if (pos > length_) pos = length_;
+			if (n > length_ - pos) n = length_ - pos;
+			return StringPiece(ptr + pos, n);
+		}
+
+		inline size_t find(char c, size_t pos = 0) const {
+			if (pos >= length_) return npos;
+			const char* found = static_cast<const char*>(memchr(ptr + pos, c, length_ - pos));
+			return found == NULL ? npos : found - ptr;
+		}
+
+		size_t find(const StringPiece& s, size_t pos = 0) const {
+			if (s.empty()) return pos <= length_ ? pos : npos;
+			for (size_t i = find(s[0], pos); i != npos && i + s.length_ <= length_; i = find(s[0], i + 1))
+				if (memcmp(ptr + i, s.ptr, s.length_) == 0)
+					return i;
+			return npos;
+		}
+
+		inline int compare(const StringPiece& other) const {
+			int result = memcmp(ptr, other.ptr, length_ < other.length_ ? length_ : other.length_);
+			if (result != 0) return result;
+			return length_ < other.length_ ? -1 : (length_ > other.length_ ? 1 : 0);
+		}
+	};
+
+	inline bool operator==(const StringPiece& a, const StringPiece& b) { return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0; }
+	inline bool operator!=(const StringPiece& a, const StringPiece& b) { return !(a == b); }
+	inline bool operator<(const StringPiece& a, const StringPiece& b) { return a.compare(b) < 0; }
+
+	inline ostream& operator<<(ostream& out, const StringPiece& piece) { return out.write(piece.data(), piece.size()); }
+
+}
+
+#endif
@@ -0,0 +1,245 @@
+/*
+ *  Threading.h
+ *  Moses Training
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ *  Minimal pthread wrappers shared by the multi-threaded training tools.
+ *
+ */
+
+#ifndef THREADING
+#define THREADING
+
+#include <deque>
+#include <vector>
+#include <iostream>
+#include <cstdlib>
+
+#include <pthread.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace bg_zhechev_ventsislav {
+
+	class Mutex {
+		pthread_mutex_t mutex;
+
+		//Disable copying
+		Mutex(const Mutex&);
+		Mutex& operator=(const Mutex&);
+
+		friend class Condition;
+	public:
+		Mutex() { pthread_mutex_init(&mutex, NULL); }
+		~Mutex() { pthread_mutex_destroy(&mutex); }
+
+		inline void lock() { pthread_mutex_lock(&mutex); }
+		inline void unlock() { pthread_mutex_unlock(&mutex); }
+	};
+
+	class ScopedLock {
+		Mutex& mutex;
+
+		//Disable copying
+		ScopedLock(const ScopedLock&);
+		ScopedLock& operator=(const ScopedLock&);
+	public:
+		ScopedLock(Mutex& m) : mutex(m) { mutex.lock(); }
+		~ScopedLock() { mutex.unlock(); }
+	};
+
+	class Condition {
+		pthread_cond_t condition;
+
+		//Disable copying
+		Condition(const Condition&);
+		Condition& operator=(const Condition&);
+	public:
+		Condition() { pthread_cond_init(&condition, NULL); }
+		~Condition() { pthread_cond_destroy(&condition); }
+
+		//The mutex has to be locked by the calling thread
+		inline void wait(Mutex& m) { pthread_cond_wait(&condition, &m.mutex); }
+		inline void signal() { pthread_cond_signal(&condition); }
+		inline void broadcast() { pthread_cond_broadcast(&condition); }
+	};
+
+	class Thread {
+		pthread_t thread;
+		bool running;
+
+		//Disable copying
+		Thread(const Thread&);
+		Thread& operator=(const Thread&);
+	public:
+		Thread() : running(false) {}
+		~Thread() { join(); }
+
+		inline void start(void* (*function)(void*), void* argument) {
+			if (pthread_create(&thread, NULL, function, argument) != 0) {
+				cerr << "Could not start a worker thread!!!" << endl;
+				exit(10);
+			}
+			running = true;
+		}
+
+		inline void join() {
+			if (!running) return;
+			pthread_join(thread, NULL);
+			running = false;
+		}
+	};
+
+	//A blocking FIFO queue with a capacity limit. Producers block while the queue is full, consumers block while it is empty.
+	//After close() has been called, pop() drains the remaining items and then returns false.
+	template <typename T>
+	class BoundedQueue {
+		deque<T> items;
+		size_t capacity;
+		bool closed;
+		Mutex mutex;
+		Condition notEmpty;
+		Condition notFull;
+
+		//Disable copying
+		BoundedQueue(const BoundedQueue&);
+		BoundedQueue& operator=(const BoundedQueue&);
+	public:
+		BoundedQueue(size_t cap) : capacity(cap > 0 ? cap : 1), closed(false) {}
+
+		void push(const T& item) {
+			ScopedLock lock(mutex);
+			while (items.size() >= capacity && !closed)
+				notFull.wait(mutex);
+			items.push_back(item);
+			notEmpty.signal();
+		}
+
+		bool pop(T& item) {
+			ScopedLock lock(mutex);
+			while (items.empty() && !closed)
+				notEmpty.wait(mutex);
+			if (items.empty())
+				return false;
+			item = items.front();
+			items.pop_front();
+			notFull.signal();
+			return true;
+		}
+
+		void close() {
+			ScopedLock lock(mutex);
+			closed = true;
+			notEmpty.broadcast();
+			notFull.broadcast();
+		}
+	};
+
+	//A one-shot flag that a worker raises when it has finished with a job, so that an in-order consumer can wait for it.
+	class Completion {
+		bool done;
+		Mutex mutex;
+		Condition finished;
+
+		//Disable copying
+		Completion(const Completion&);
+		Completion& operator=(const Completion&);
+	public:
+		Completion() : done(false) {}
+
+		void signal() {
+			ScopedLock lock(mutex);
+			done = true;
+			finished.broadcast();
+		}
+
+		void wait() {
+			ScopedLock lock(mutex);
+			while (!done)
+				finished.wait(mutex);
+		}
+	};
+
+	//Base class for the jobs run by an OrderedWorkerPool
+	struct OrderedJob {
+		Completion completion;
+		
+		virtual ~OrderedJob() {}
+		virtual void run() = 0;
+	};
+	
+	//Runs jobs on a pool of worker threads and hands them back to the consumer in the order in which they were submitted.
+	//Every job is put on two queues—the workers take them as soon as they are free, while next() takes them in submission order and waits for each to be completed.
+	//The consumer owns the jobs returned by next().
+	class OrderedWorkerPool {
+		BoundedQueue<OrderedJob*> workQueue;
+		BoundedQueue<OrderedJob*> outputQueue;
+		vector<Thread*> workers;
+		
+		static void* work(void* data) {
+			OrderedWorkerPool* pool = static_cast<OrderedWorkerPool*>(data);
+			OrderedJob* job;
+			while (pool->workQueue.pop(job)) {
+				job->run();
+				job->completion.signal();
+			}
+			return NULL;
+		}
+		
+		//Disable copying
+		OrderedWorkerPool(const OrderedWorkerPool&);
+		OrderedWorkerPool& operator=(const OrderedWorkerPool&);
+	public:
+		OrderedWorkerPool(unsigned threads, size_t maxPending) : workQueue(maxPending), outputQueue(maxPending) {
+			for (unsigned t = 0; t < threads; ++t) {
+				workers.push_back(new Thread());
+				workers.back()->start(&work, this);
+			}
+		}
+		~OrderedWorkerPool() { shutdown(); }
+		
+		inline void submit(OrderedJob* job) {
+			outputQueue.push(job);
+			workQueue.push(job);
+		}
+		
+		//No more jobs will be submitted
+		inline void finish() {
+			workQueue.close();
+			outputQueue.close();
+		}
+		
+		//Returns the next job in submission order once it has been run, or NULL when all jobs have been handed out after finish()
+		OrderedJob* next() {
+			OrderedJob* job;
+			if (!outputQueue.pop(job))
+				return NULL;
+			job->completion.wait();
+			return job;
+		}
+		
+		//Stops the workers and discards any jobs that have not been handed out yet
+		void shutdown() {
+			finish();
+			for (size_t t = 0; t < workers.size(); ++t) {
+				workers[t]->join();
+				delete workers[t];
+			}
+			workers.clear();
+			OrderedJob* job;
+			while (outputQueue.pop(job))
+				delete job;
+		}
+	};
+	
+	//Number of online processors, used when the caller asks for “all” threads
+	inline unsigned availableCores() {
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		return cores > 0 ? (unsigned)cores : 1;
+	}
+
+}
+
+#endif
@@ -7,6 +7,11 @@
   Changes:
   1) Switched to reading and writing Bzip2-compressed data to reduce I/O operations
   2) Input and output can also automatically be done without compression to facilitate the use of named pipes
+  3) Bzip2 files can be compressed and decompressed on several threads (--Threads)
+  4) The lines are split into fields and written out without copying them
+  5) The direct and indirect tables are merge-joined on their phrase pairs, so that pairs missing from either table (e.g. after pruning) are skipped;
+     with --Threads the phrase pairs are formatted in parallel batches, while each input is decompressed on threads of its own
+  6) The merge-join is shared with processPhraseTable -consolidate, which builds the binary phrase table straight from the score output
 
  
   This library is free software; you can redistribute it and/or
@@ -27,19 +32,33 @@
 #include <iostream>
 #include <vector>
 #include <string>
-#include <sstream>
-#include <cassert>
 
-#include "Bz2LineReader.h"
 #include "Bz2LineWriter.h"
+#include "FieldSplitter.h"
+#include "PhraseTableMerger.h"
+#include "Threading.h"
 
 using namespace std;
 using namespace bg_zhechev_ventsislav;
 
 bool hierarchicalFlag = false;
 bool logProbFlag = false;
+unsigned threads = 1;
 
-vector<string> splitLine(const string&);
+//The matched lines are handed to the workers in batches of about this size
+static const size_t consolidateBatchSize = 1 << 20;
+
+//A batch of matching direct and indirect lines, each newline-terminated
+struct ConsolidateJob : public OrderedJob {
+	string direct;
+	string indirect;
+	string output;
+	
+	void run();
+};
+
+void consolidate(const StringPiece& directLine, const StringPiece& indirectLine, string& output);
+void* consolidatedWriter(void* data);
 
 int main(int argc, char* argv[]) {
   cerr	<< "Consolidate v2.1 written by Philipp Koehn" << endl
@@ -48,7 +67,7 @@ int main(int argc, char* argv[]) {
 	;
 
   if (argc < 4) {
-    cerr << "syntax: consolidate phrase-table.direct phrase-table.indirect phrase-table.consolidated [--Hierarchical]\n";
+    cerr << "syntax: consolidate phrase-table.direct phrase-table.indirect phrase-table.consolidated [--Hierarchical] [--LogProb] [--Threads N]\n";
     exit(1);
   }
   const string fileNameDirect = argv[1];
@@ -62,87 +81,132 @@ int main(int argc, char* argv[]) {
     } else if (strcmp(argv[i],"--LogProb") == 0) {
       logProbFlag = true;
       cerr << "using log-probabilities\n";
+    } else if (strcmp(argv[i],"--Threads") == 0) {
+      if (i+1 >= argc) {
+        cerr << "ERROR: no thread count provided to the option --Threads" << endl;
+        exit(1);
+      }
+      int threadCount = atoi(argv[++i]);
+      threads = threadCount > 0 ? threadCount : availableCores();
+      cerr << "using " << threads << " threads for bzip2 compression\n";
     } else {
       cerr << "ERROR: unknown option " << argv[i] << endl;
       exit(1);
     }
   }
 
-  // open input files
-	Bz2LineReader fileDirect(fileNameDirect);
-	Bz2LineReader fileIndirect(fileNameIndirect);
+  // merge-join the two tables on their phrase pairs; both are sorted bytewise on whole lines
+	PhraseTableMerger merger(fileNameDirect, fileNameIndirect, threads);
 
   // open output file: consolidated phrase table
-	Bz2LineWriter fileConsolidated(fileNameConsolidated);
-
-  // loop through all extracted phrase translations
-	stringstream streamConsolidated;
-	for (unsigned i = 1; ; ++i) {
-		string directLine = fileDirect.readLine();
-		if (directLine.empty()) break;
-		string indirectLine = fileIndirect.readLine();
-		if (indirectLine.empty()) break;
-		
+	Bz2LineWriter fileConsolidated(fileNameConsolidated, Bz2LineWriter::COMPRESSED, threads);
+
+	OrderedWorkerPool* pool = NULL;
+	pair<OrderedWorkerPool*, Bz2LineWriter*> writerData(NULL, &fileConsolidated);
+	Thread writer;
+	if (threads > 1) {
+		pool = new OrderedWorkerPool(threads, 4 * threads);
+		writerData.first = pool;
+		writer.start(&consolidatedWriter, &writerData);
+	}
+
+	ConsolidateJob* job = new ConsolidateJob();
+	StringPiece directLine, indirectLine;
+	for (unsigned i = 1; merger.next(directLine, indirectLine); ++i) {
 		if (i % 10000000 == 0) cerr << "[consolidate:" << i << "]" << flush;
     if (i % 100000 == 0) cerr << "." << flush;
+		
+		if (pool == NULL)
+			consolidate(directLine, indirectLine, job->output);
+		else {
+			directLine.appendTo(job->direct);
+			job->direct += '\n';
+			indirectLine.appendTo(job->indirect);
+			job->indirect += '\n';
+		}
+		if (job->output.size() >= consolidateBatchSize) {
+			fileConsolidated.append(job->output);
+			job->output.clear();
+		} else if (job->direct.size() >= consolidateBatchSize) {
+			pool->submit(job);
+			job = new ConsolidateJob();
+		}
+	}
+	
+	if (pool == NULL) {
+		fileConsolidated.append(job->output);
+		delete job;
+	} else {
+		pool->submit(job);
+		pool->finish();
+		writer.join();
+		delete pool;
+	}
+	
+	merger.reportSkipped();
+}
 
-    vector<string> itemDirect = splitLine(directLine);
-		vector<string> itemIndirect = splitLine(indirectLine);
+void consolidate(const StringPiece& directLine, const StringPiece& indirectLine, string& output) {
+	StringPiece itemDirect[6], itemIndirect[6];
+	size_t itemsDirect = splitFields(directLine, itemDirect, 6);
+	size_t itemsIndirect = splitFields(indirectLine, itemIndirect, 6);
 
-    // direct: target source alignment probabilities
-    // indirect: source target probabilities
+	// direct: target source alignment probabilities
+	// indirect: source target probabilities
 
-    // consistency checks
-		assert(itemDirect.size() == (hierarchicalFlag ? 5 : 4));
-		assert(itemIndirect.size() == 4);
-		assert(itemDirect[0] == itemIndirect[0]);
-		assert(itemDirect[1] == itemIndirect[1]);
-		
-    // output hierarchical phrase pair (with separated labels)
-    streamConsolidated << itemDirect[0] << " ||| " << itemDirect[1] << " ||| ";
-
-    // output alignment and probabilities
-    if (hierarchicalFlag)
-      streamConsolidated << itemDirect[2]   << " ||| " // alignment
-        << itemIndirect[2]      // prob indirect
-        << " " << itemDirect[3]; // prob direct
-    else
-      streamConsolidated << itemIndirect[2]      // prob indirect
-        << " " << itemDirect[2]; // prob direct
-    streamConsolidated << " " << (logProbFlag ? 1 : 2.718); // phrase count feature
-
-    // counts
-    if (itemIndirect.size() == 4 && itemDirect.size() == 5)
-      streamConsolidated << " ||| " << itemIndirect[3] << " " // indirect
-        << itemDirect[4]; // direct
-
-    streamConsolidated << endl;
-		
-		fileConsolidated.writeLine(streamConsolidated.str());
-		streamConsolidated.str("");
-  }
+	// consistency checks
+	if (itemsDirect != (hierarchicalFlag ? 5 : 4) || itemsIndirect != 4) {
+		cerr << "ERROR: wrong number of fields for the phrase pair: " << itemDirect[0] << " ||| " << itemDirect[1] << endl;
+		exit(1);
+	}
 	
+	// output hierarchical phrase pair (with separated labels)
+	itemDirect[0].appendTo(output);
+	output += " ||| ";
+	itemDirect[1].appendTo(output);
+	output += " ||| ";
+
+	// output alignment and probabilities
+	if (hierarchicalFlag) {
+		itemDirect[2].appendTo(output); // alignment
+		output += " ||| ";
+		itemIndirect[2].appendTo(output); // prob indirect
+		output += ' ';
+		itemDirect[3].appendTo(output); // prob direct
+	} else {
+		itemIndirect[2].appendTo(output); // prob indirect
+		output += ' ';
+		itemDirect[2].appendTo(output); // prob direct
+	}
+	output += logProbFlag ? " 1" : " 2.718"; // phrase count feature
+
+	// counts
+	if (itemsIndirect == 4 && itemsDirect == 5) {
+		output += " ||| ";
+		itemIndirect[3].appendTo(output); // indirect
+		output += ' ';
+		itemDirect[4].appendTo(output); // direct
+	}
+
+	output += '\n';
 }
 
-vector<string> splitLine(const string& ln) {
-	char line[ln.length() + 1];
-	strcpy(line, ln.c_str());
-  vector<string> items;
-	size_t start = 0, i = 0;
-  for(; line[i] != '\0'; i++)
-    if (line[i] == ' ' &&
-        line[i+1] == '|' &&
-        line[i+2] == '|' &&
-        line[i+3] == '|' &&
-        line[i+4] == ' ') {
-      if (start > i)
-				start = i; // empty item
-      items.push_back( string( line+start, i-start ) );
-      start = i+5;
-      i += 3;
-    }
-	
-	items.push_back( string( line+start, i-start ) );
+void ConsolidateJob::run() {
+	for (size_t directBegin = 0, indirectBegin = 0; directBegin < direct.size(); ) {
+		size_t directEnd = direct.find('\n', directBegin);
+		size_t indirectEnd = indirect.find('\n', indirectBegin);
+		consolidate(StringPiece(direct.data() + directBegin, directEnd - directBegin), StringPiece(indirect.data() + indirectBegin, indirectEnd - indirectBegin), output);
+		directBegin = directEnd + 1;
+		indirectBegin = indirectEnd + 1;
+	}
+}
 
-  return items;
+// writes the output of each batch once it is completed, strictly in input order
+void* consolidatedWriter(void* data) {
+	pair<OrderedWorkerPool*, Bz2LineWriter*>* writerData = static_cast<pair<OrderedWorkerPool*, Bz2LineWriter*>*>(data);
+	for (OrderedJob* job = writerData->first->next(); job != NULL; job = writerData->first->next()) {
+		writerData->second->append(static_cast<ConsolidateJob*>(job)->output);
+		delete job;
+	}
+	return NULL;
 }
@@ -0,0 +1,489 @@
+/*
+ *  extract-score.cpp
+ *  Moses Training
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ *  Extracts the phrase pairs of a word-aligned corpus and scores them straight away, without ever writing out the extract files.
+ *  The extracted lines are spread over partitions by a hash of their first phrase. Each partition is sorted with bounded memory
+ *  and scored on its own thread, so all lines for a source phrase are scored together, as when the sorted extract file is scored.
+ *  The scored lines are sorted once more on their way to the output, which gives the same tables as running
+ *  extract, sort, score (direct and inverse), sort and lexical-reordering/score one after the other.
+ *
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include "PhraseExtractor.h"
+#include "PhraseScorer.h"
+#include "SentenceAlignment.h"
+#include "../lexical-reordering/reordering_classes.h"
+
+#include "Bz2LineReader.h"
+#include "Bz2LineWriter.h"
+#include "ExternalSorter.h"
+#include "FieldSplitter.h"
+#include "Threading.h"
+
+using namespace std;
+using namespace bg_zhechev_ventsislav;
+
+// PartitionJob is a batch of consecutive sentence pairs processed by one worker thread.
+// Its output is already split into one part per partition.
+struct PartitionJob : public OrderedJob {
+	int firstSentenceID;
+	vector<string> englishStrings;
+	vector<string> foreignStrings;
+	vector<string> alignmentStrings;
+	vector<ExtractOutput> partitions;
+
+	void run();
+};
+
+// Partition holds the sorted extract lines of all source (respectively target) phrases that hash to it
+struct Partition {
+	ExternalSorter* extract;
+	ExternalSorter* extractInv;
+	ExternalSorter* extractOrientation;
+	ReorderingTable* reordering;
+	int countOfCounts[GT_MAX+1];
+	int countOfCountsInv[GT_MAX+1];
+};
+
+// SharedOutput collects the scored lines of all partitions for one output table
+struct SharedOutput {
+	string fileName;
+	Mutex mutex;
+	ExternalSorter sorter;
+
+	SharedOutput(const string& name, size_t memory);
+	//Adds the lines in the buffer and clears it
+	void add(string& lines);
+	void write();
+};
+
+const size_t extractBatchSize = 1000;
+//The scored lines of a partition are handed to the shared output in chunks of about this size
+const size_t outputChunkSize = 1 << 20;
+
+void extractPartitioned(Bz2LineReader &, Bz2LineReader &, Bz2LineReader &);
+void* partitionWriter(void*);
+void* preparePartition(void*);
+void* scorePartition(void*);
+void runOnPartitions(void* (*)(void*));
+void addLines(ExternalSorter&, const string&);
+void distribute(const string&, vector<ExtractOutput>&, string ExtractOutput::*);
+void configureScorer(PhraseScorer&, bool);
+
+PhraseExtractor extractor;
+LexicalTable lexTableF2E;
+LexicalTable lexTableE2F;
+vector<string> reorderingConfigs;
+double smoothingValue = 0.5;
+bool smoothWithCountsFlag = false;
+bool goodTuringFlag = false;
+bool logProbFlag = false;
+int negLogProb = 1;
+bool lexFlag = true;
+bool binaryLexFlag = false;
+unsigned threads = 1;
+size_t memory = 1024;
+string tempDir = ExternalSorter::defaultTempDir();
+
+vector<Partition> partitions;
+float discountFactor[GT_MAX+1];
+float discountFactorInv[GT_MAX+1];
+SharedOutput* directOutput;
+SharedOutput* inverseOutput;
+vector<SharedOutput*> reorderingOutputs;
+
+int main(int argc, char* argv[]) {
+	cerr	<< "Extract-Score v1.0 written by Ventsislav Zhechev, Autodesk Development Sàrl" << endl
+				<< "phrase extraction and scoring without intermediate extract files" << endl
+	;
+
+	if (argc < 8) {
+		cerr << "syntax: extract-score en de align lex.f2e lex.e2f phrase-table max-length [--Reordering \"type max-orientation (specification-strings)\"]* [--ReorderingTable path] [--Smoothing value] [--SmoothWithCounts] [--GoodTuring] [--LogProb] [--NegLogProb] [--NoLex] [--BinaryLex] [--Threads N] [--Memory MB] [--TempDir dir]\n";
+		exit(1);
+	}
+
+	const string fileNameE = argv[1];
+	const string fileNameF = argv[2];
+	const string fileNameA = argv[3];
+	const string fileNameLexF2E = argv[4];
+	const string fileNameLexE2F = argv[5];
+	const string fileNamePhraseTable = argv[6];
+	extractor.maxPhraseLength = atoi(argv[7]);
+	string fileNameReordering = fileNamePhraseTable + ".reordering";
+	vector<string> reorderingFileNames;
+
+	for (int i=8; i<argc; ++i) {
+		if (strcmp(argv[i], "--Reordering") == 0) {
+			if (i+1 >= argc) {
+				cerr << "extract-score: syntax error, no model information provided to the option --Reordering" << endl;
+				exit(1);
+			}
+			reorderingConfigs.push_back(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--ReorderingTable") == 0 && i+1 < argc)
+			fileNameReordering = argv[++i];
+		else if (strcmp(argv[i], "--Smoothing") == 0 && i+1 < argc)
+			smoothingValue = strtod(argv[++i], NULL);
+		else if (strcmp(argv[i], "--SmoothWithCounts") == 0)
+			smoothWithCountsFlag = true;
+		else if (strcmp(argv[i], "--GoodTuring") == 0) {
+			goodTuringFlag = true;
+			cerr << "using Good Turing discounting\n";
+		}
+		else if (strcmp(argv[i], "--LogProb") == 0) {
+			logProbFlag = true;
+			cerr << "using log-probabilities\n";
+		}
+		else if (strcmp(argv[i], "--NegLogProb") == 0) {
+			logProbFlag = true;
+			negLogProb = -1;
+			cerr << "using negative log-probabilities\n";
+		}
+		else if (strcmp(argv[i], "--NoLex") == 0) {
+			lexFlag = false;
+			cerr << "not computing lexical translation score\n";
+		}
+		else if (strcmp(argv[i], "--BinaryLex") == 0)
+			binaryLexFlag = true;
+		else if (strcmp(argv[i], "--Threads") == 0) {
+			if (i+1 >= argc) {
+				cerr << "extract-score: syntax error, no thread count provided to the option --Threads" << endl;
+				exit(1);
+			}
+			int threadCount = atoi(argv[++i]);
+			threads = threadCount > 0 ? threadCount : availableCores();
+		}
+		else if (strcmp(argv[i], "--Memory") == 0 && i+1 < argc)
+			memory = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--TempDir") == 0 && i+1 < argc)
+			tempDir = argv[++i];
+		else {
+			cerr << "extract-score: syntax error, unknown option '" << argv[i] << "'" << endl;
+			exit(1);
+		}
+	}
+
+	// the reordering models to score determine the orientation information to extract
+	for (size_t r = 0; r < reorderingConfigs.size(); ++r) {
+		istringstream is(reorderingConfigs[r]);
+		string type, orientation, specification;
+		is >> type >> orientation;
+		if (orientation == "monotonicity")
+			extractor.addModel(type + "-mono");
+		else if (orientation == "leftright")
+			extractor.addModel(type + "-mslr");
+		else
+			extractor.addModel(type + "-" + orientation);
+		while (is >> specification)
+			reorderingFileNames.push_back(fileNameReordering + "." + specification + ".bz2");
+		extractor.orientationFlag = true;
+	}
+
+	// lexical translation tables
+	if (lexFlag) {
+		lexTableF2E.load(fileNameLexF2E, binaryLexFlag);
+		lexTableE2F.load(fileNameLexE2F, binaryLexFlag);
+	}
+
+	// half of the memory goes to the partitions, the other half to the output tables
+	size_t inputMemory = (memory << 20) / 2 / (threads * (extractor.orientationFlag ? 3 : 2));
+	size_t outputMemory = (memory << 20) / 2 / (2 + reorderingFileNames.size());
+	cerr << "Extracting into " << threads << " partitions with " << memory << "MB of memory, using " << tempDir << " for temporary files…" << endl;
+
+	partitions.resize(threads);
+	for (size_t p = 0; p < partitions.size(); ++p) {
+		Partition& partition = partitions[p];
+		partition.extract = new ExternalSorter(tempDir, inputMemory);
+		partition.extractInv = new ExternalSorter(tempDir, inputMemory);
+		partition.extractOrientation = extractor.orientationFlag ? new ExternalSorter(tempDir, inputMemory) : NULL;
+		partition.reordering = NULL;
+		if (extractor.orientationFlag) {
+			partition.reordering = new ReorderingTable();
+			for (size_t r = 0; r < reorderingConfigs.size(); partition.reordering->addModels(reorderingConfigs[r++], ""));
+		}
+	}
+	directOutput = new SharedOutput(fileNamePhraseTable + ".f2e.bz2", outputMemory);
+	inverseOutput = new SharedOutput(fileNamePhraseTable + ".e2f.bz2", outputMemory);
+	for (size_t r = 0; r < reorderingFileNames.size(); ++r)
+		reorderingOutputs.push_back(new SharedOutput(reorderingFileNames[r], outputMemory));
+
+	{
+		Bz2LineReader eFile(fileNameE, Bz2LineReader::COMPRESSED, threads);
+		Bz2LineReader fFile(fileNameF, Bz2LineReader::COMPRESSED, threads);
+		Bz2LineReader aFile(fileNameA, Bz2LineReader::COMPRESSED, threads);
+		extractPartitioned(eFile, fFile, aFile);
+	}
+
+	// sort the partitions and collect the global statistics
+	cerr << "\nsorting partitions" << endl;
+	runOnPartitions(&preparePartition);
+
+	if (goodTuringFlag) {
+		int countOfCounts[GT_MAX+1];
+		int countOfCountsInv[GT_MAX+1];
+		for (size_t i = 0; i <= GT_MAX; ++i) {
+			countOfCounts[i] = countOfCountsInv[i] = 0;
+			for (size_t p = 0; p < partitions.size(); ++p) {
+				countOfCounts[i] += partitions[p].countOfCounts[i];
+				countOfCountsInv[i] += partitions[p].countOfCountsInv[i];
+			}
+		}
+		PhraseScorer::computeDiscountFactors(countOfCounts, discountFactor);
+		PhraseScorer::computeDiscountFactors(countOfCountsInv, discountFactorInv);
+	}
+
+	if (extractor.orientationFlag) {
+		if (smoothWithCountsFlag) {
+			ReorderingTable totals;
+			for (size_t r = 0; r < reorderingConfigs.size(); totals.addModels(reorderingConfigs[r++], ""));
+			for (size_t p = 0; p < partitions.size(); totals.addCounts(*partitions[p++].reordering));
+			for (size_t p = 0; p < partitions.size(); partitions[p++].reordering->createSmoothing(smoothingValue, totals));
+		} else
+			for (size_t p = 0; p < partitions.size(); partitions[p++].reordering->createConstSmoothing(smoothingValue));
+	}
+
+	cerr << "scoring partitions" << endl;
+	runOnPartitions(&scorePartition);
+
+	cerr << "\nwriting tables" << endl;
+	directOutput->write();
+	delete directOutput;
+	inverseOutput->write();
+	delete inverseOutput;
+	for (size_t r = 0; r < reorderingOutputs.size(); ++r) {
+		reorderingOutputs[r]->write();
+		delete reorderingOutputs[r];
+	}
+}
+
+// The main thread reads batches of sentence pairs and queues them for the workers.
+// A separate thread hands the output of each batch to the partitions once it is completed, in input order.
+void extractPartitioned(Bz2LineReader &eFile, Bz2LineReader &fFile, Bz2LineReader &aFile) {
+	OrderedWorkerPool pool(threads, 4 * threads);
+	Thread writer;
+	writer.start(&partitionWriter, &pool);
+
+	PartitionJob* job = NULL;
+	for (int i = 0;;) {
+		string englishString = eFile.readLine();
+		if (englishString.empty())
+			break;
+
+		if ((++i)%500000 == 0) cerr << "[extract:" << i << "]" << flush;
+		else if (i%10000 == 0) cerr << "." << flush;
+
+		if (job == NULL) {
+			job = new PartitionJob();
+			job->firstSentenceID = i;
+		}
+		job->englishStrings.push_back(englishString);
+		job->foreignStrings.push_back(fFile.readLine());
+		job->alignmentStrings.push_back(aFile.readLine());
+
+		if (job->englishStrings.size() >= extractBatchSize) {
+			pool.submit(job);
+			job = NULL;
+		}
+	}
+	if (job != NULL)
+		pool.submit(job);
+
+	pool.finish();
+	writer.join();
+}
+
+void PartitionJob::run() {
+	partitions.resize(::partitions.size());
+	ExtractOutput output;
+	for (size_t s = 0; s < englishStrings.size(); ++s) {
+		SentenceAlignment sentence;
+		if (sentence.create(englishStrings[s], foreignStrings[s], alignmentStrings[s], firstSentenceID + (int)s)) {
+			extractor.extract(sentence, output);
+			distribute(output.extract, partitions, &ExtractOutput::extract);
+			distribute(output.extractInv, partitions, &ExtractOutput::extractInv);
+			distribute(output.extractOrientation, partitions, &ExtractOutput::extractOrientation);
+			output.clear();
+		}
+	}
+}
+
+// Appends each line to the partition given by a hash (FNV-1a) of its first field
+void distribute(const string& lines, vector<ExtractOutput>& parts, string ExtractOutput::* field) {
+	for (size_t begin = 0, end; begin < lines.size(); begin = end + 1) {
+		end = lines.find('\n', begin);
+		if (end == string::npos)
+			end = lines.size();
+		StringPiece line(lines.data() + begin, end - begin);
+		size_t keyEnd = begin + line.substr(0, findFieldSeparator(line)).size();
+		unsigned hash = 2166136261u;
+		for (size_t i = begin; i < keyEnd; ++i) {
+			hash ^= (unsigned char)lines[i];
+			hash *= 16777619u;
+		}
+		(parts[hash % parts.size()].*field).append(lines, begin, end - begin + 1);
+	}
+}
+
+void* partitionWriter(void* data) {
+	OrderedWorkerPool* pool = static_cast<OrderedWorkerPool*>(data);
+	for (OrderedJob* job = pool->next(); job != NULL; job = pool->next()) {
+		vector<ExtractOutput>& parts = static_cast<PartitionJob*>(job)->partitions;
+		for (size_t p = 0; p < parts.size(); ++p) {
+			addLines(*partitions[p].extract, parts[p].extract);
+			addLines(*partitions[p].extractInv, parts[p].extractInv);
+			if (extractor.orientationFlag)
+				addLines(*partitions[p].extractOrientation, parts[p].extractOrientation);
+		}
+		delete job;
+	}
+	return NULL;
+}
+
+void addLines(ExternalSorter& sorter, const string& lines) {
+	for (size_t begin = 0, end; begin < lines.size(); begin = end + 1) {
+		end = lines.find('\n', begin);
+		if (end == string::npos)
+			end = lines.size();
+		sorter.add(StringPiece(lines.data() + begin, end - begin));
+	}
+}
+
+// Runs the given function on one thread per partition and waits for all of them
+void runOnPartitions(void* (*function)(void*)) {
+	Thread* workers = new Thread[partitions.size()];
+	for (size_t p = 0; p < partitions.size(); ++p)
+		workers[p].start(function, &partitions[p]);
+	for (size_t p = 0; p < partitions.size(); workers[p++].join());
+	delete[] workers;
+}
+
+void configureScorer(PhraseScorer& scorer, bool inverse) {
+	scorer.inverseFlag = inverse;
+	scorer.goodTuringFlag = goodTuringFlag;
+	scorer.logProbFlag = logProbFlag;
+	scorer.negLogProb = negLogProb;
+	scorer.lexFlag = lexFlag;
+}
+
+void* preparePartition(void* data) {
+	Partition& partition = *static_cast<Partition*>(data);
+	StringPiece line;
+
+	partition.extract->sort();
+	partition.extractInv->sort();
+	if (partition.extractOrientation != NULL)
+		partition.extractOrientation->sort();
+
+	// count of counts for Good Turing discounting
+	if (goodTuringFlag) {
+		PhraseScorer counter(lexTableF2E);
+		configureScorer(counter, false);
+		while (partition.extract->readLine(line))
+			counter.countLine(line);
+		counter.finishCounting();
+		partition.extract->rewind();
+		memcpy(partition.countOfCounts, counter.countOfCounts, sizeof(counter.countOfCounts));
+
+		PhraseScorer counterInv(lexTableE2F);
+		configureScorer(counterInv, true);
+		while (partition.extractInv->readLine(line))
+			counterInv.countLine(line);
+		counterInv.finishCounting();
+		partition.extractInv->rewind();
+		memcpy(partition.countOfCountsInv, counterInv.countOfCounts, sizeof(counterInv.countOfCounts));
+	}
+
+	// orientation counts for smoothing
+	if (partition.extractOrientation != NULL && smoothWithCountsFlag) {
+		while (partition.extractOrientation->readLine(line))
+			partition.reordering->count(line);
+		partition.extractOrientation->rewind();
+	}
+
+	return NULL;
+}
+
+void* scorePartition(void* data) {
+	Partition& partition = *static_cast<Partition*>(data);
+	StringPiece line;
+
+	{
+		PhraseScorer scorer(lexTableF2E);
+		configureScorer(scorer, false);
+		memcpy(scorer.discountFactor, discountFactor, sizeof(discountFactor));
+		while (partition.extract->readLine(line)) {
+			scorer.addLine(line);
+			if (scorer.output.size() >= outputChunkSize)
+				directOutput->add(scorer.output);
+		}
+		scorer.finish();
+		directOutput->add(scorer.output);
+		delete partition.extract;
+		partition.extract = NULL;
+	}
+	cerr << "." << flush;
+
+	{
+		PhraseScorer scorer(lexTableE2F);
+		configureScorer(scorer, true);
+		memcpy(scorer.discountFactor, discountFactorInv, sizeof(discountFactorInv));
+		while (partition.extractInv->readLine(line)) {
+			scorer.addLine(line);
+			if (scorer.output.size() >= outputChunkSize)
+				inverseOutput->add(scorer.output);
+		}
+		scorer.finish();
+		inverseOutput->add(scorer.output);
+		delete partition.extractInv;
+		partition.extractInv = NULL;
+	}
+	cerr << "." << flush;
+
+	if (partition.extractOrientation != NULL) {
+		ReorderingTable& table = *partition.reordering;
+		while (partition.extractOrientation->readLine(line)) {
+			table.addLine(line);
+			for (size_t m = 0; m < table.size(); ++m)
+				if (table.getModel(m).getOutput().size() >= outputChunkSize)
+					reorderingOutputs[m]->add(table.getModel(m).getOutput());
+		}
+		table.finish();
+		for (size_t m = 0; m < table.size(); ++m)
+			reorderingOutputs[m]->add(table.getModel(m).getOutput());
+		delete partition.extractOrientation;
+		partition.extractOrientation = NULL;
+		delete partition.reordering;
+		partition.reordering = NULL;
+		cerr << "." << flush;
+	}
+
+	return NULL;
+}
+
+SharedOutput::SharedOutput(const string& name, size_t memory) : fileName(name), sorter(tempDir, memory, threads) {}
+
+void SharedOutput::add(string& lines) {
+	ScopedLock lock(mutex);
+	addLines(sorter, lines);
+	lines.clear();
+}
+
+void SharedOutput::write() {
+	sorter.sort();
+	Bz2LineWriter file(fileName, Bz2LineWriter::COMPRESSED, threads);
+	StringPiece line;
+	while (sorter.readLine(line)) {
+		file.append(line);
+		file.append('\n');
+	}
+	file.close();
+}
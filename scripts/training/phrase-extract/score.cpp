@@ -9,6 +9,12 @@
   2) Performance optimisations
   3) Switched to reading and writing Bzip2-compressed data to reduce I/O operations
   4) Can be used in a pipe by supplying - for any file name, based on demand
+  5) Bzip2 files can be compressed and decompressed on several threads (--Threads)
+  6) Unsorted extract files can be sorted internally with bounded memory (--Sort), which also allows Good-Turing discounting on piped input
+  7) The phrase pairs are scored on several threads (--Threads), in chunks that start at a new source phrase; the output is identical to a single-threaded run
+  8) The lexical translation table can be cached in a binary file next to the lex file and mapped from there (--BinaryLex)
+  9) Good-Turing discounting reads the extract file only once, so it also works on piped input; the scores are kept with their raw counts in a temporary file until the discount factors are known
+  10) The direct table can be pruned while scoring, keeping the best translations of each source phrase (--TopK, --PruneWeights) and/or the significant ones (--SignificanceThreshold, --SentencePairs)
  
 
   This library is free software; you can redistribute it and/or
@@ -34,68 +40,60 @@
 #include <set>
 
 #include "tables-core.h"
+#include "PhraseScorer.h"
 
 #include "Bz2LineReader.h"
 #include "Bz2LineWriter.h"
+#include "ExternalSorter.h"
+#include "FieldSplitter.h"
+#include "Threading.h"
 
 using namespace std;
 using namespace bg_zhechev_ventsislav;
 
-// data structure for a single phrase pair
-struct PhraseAlignment {
-	int target, source;
-	float count;
-	vector< set<size_t> > alignedToT;
-	vector< set<size_t> > alignedToS;
-  
-	void create(const vector<string>&, int );
-	void addToCount(string);
-	inline void clear() { alignedToT.clear(); alignedToS.clear(); }
-	inline bool equals(const PhraseAlignment& other) { return (other.target == target && other.source == source && other.alignedToT == alignedToT && other.alignedToS == alignedToS); }
-	bool match( const PhraseAlignment& );
-};
-
-Vocabulary vcbT;
-Vocabulary vcbS;
-
-struct LexicalTable {
-  map< WORD_ID, map< WORD_ID, double > > ltable;
-  void load( char[] );
-  double permissiveLookup( WORD_ID wordS, WORD_ID wordT ) {
-		// cout << endl << vcbS.getWord( wordS ) << "-" << vcbT.getWord( wordT ) << ":";
-		map<WORD_ID, map<WORD_ID, double> >::const_iterator itS = ltable.find(wordS);
-		if (itS == ltable.end()) return 1.0;
-		map<WORD_ID, double>::const_iterator itT = itS->second.find(wordT);
-		if (itT == itS->second.end()) return 1.0;
-		// cout << ltable[ wordS ][ wordT ];
-		return itT->second;
-  }
+// ScoreJob is a chunk of consecutive lines of the sorted extract file, which holds all lines for the source phrases in it
+struct ScoreJob : public OrderedJob {
+	string lines;
+	string output;
+	string wordAlignmentOutput;
+	
+	void run();
 };
 
-vector<string> tokenize(const char[]);
+// The chunks of the extract file are cut at the first new source phrase after this many bytes
+const size_t scoreChunkSize = 1 << 20;
 
-void computeCountOfCounts(const string&);
-void processPhrasePairs(vector<PhraseAlignment>&, Bz2LineWriter&);
-PhraseAlignment* findBestAlignment(vector<PhraseAlignment*>&);
-void outputPhrasePair(vector<PhraseAlignment*>&, float, Bz2LineWriter&);
-double computeLexicalTranslation(PHRASE&, PHRASE&, PhraseAlignment*);
+template <typename LineInput> void scorePhrasePairs(LineInput&, PhraseScorer&, Bz2LineWriter&);
+template <typename LineInput> void scorePhrasePairsThreaded(LineInput&, PhraseScorer&, Bz2LineWriter&);
+void applyDiscounts(const string&, const PhraseScorer&, Bz2LineWriter&);
+void writeScores(string&, string&, Bz2LineWriter&);
+void* scoreWriter(void*);
+StringPiece sourcePhrase(const StringPiece&);
 
 ofstream wordAlignmentFile;
 
 LexicalTable lexTable;
-PhraseTable phraseTableT;
-PhraseTable phraseTableS;
 bool inverseFlag = false;
 bool hierarchicalFlag = false;
 bool wordAlignmentFlag = false;
 bool onlyDirectFlag = false;
 bool goodTuringFlag = false;
-#define GT_MAX 10
+unsigned threads = 1;
+bool sortFlag = false;
+size_t sortMemory = 1024;
+string tempDir = ExternalSorter::defaultTempDir();
 bool logProbFlag = false;
 int negLogProb = 1;
 bool lexFlag = true;
-int countOfCounts[GT_MAX+1];
-float discountFactor[GT_MAX+1];
+bool binaryLexFlag = false;
+int topK = 0;
+vector<double> pruneWeights;
+double significanceThreshold = 0.;
+double sentencePairs = 0.;
+
+// Scorers for the worker threads; each keeps its vocabularies and phrase tables between chunks
+vector<PhraseScorer*> idleScorers;
+Mutex scorerMutex;
 
 int main(int argc, char* argv[]) {
 	cerr	<< "Score v2.5 written by Philipp Koehn" << endl
@@ -104,13 +102,14 @@ int main(int argc, char* argv[]) {
 	;
 
 	if (argc < 4) {
-		cerr << "syntax: score extract lex phrase-table [--Inverse] [--Hierarchical] [--OnlyDirect] [--LogProb] [--NegLogProb] [--NoLex] [--GoodTuring] [--WordAlignment file]\n";
+		cerr << "syntax: score extract lex phrase-table [--Inverse] [--Hierarchical] [--OnlyDirect] [--LogProb] [--NegLogProb] [--NoLex] [--GoodTuring] [--BinaryLex] [--WordAlignment file] [--Threads N] [--Sort [--SortMemory MB]] [--TempDir dir] [--TopK N [--PruneWeights w1,w2]] [--SignificanceThreshold t|a+e|a-e --SentencePairs N]\n";
 		exit(1);
 	}
 	char* fileNameExtract = argv[1];
 	char* fileNameLex = argv[2];
 	char* fileNamePhraseTable = argv[3];
 	char* fileNameWordAlignment;
+	const char* significanceSpec = NULL;
 
 	for(int i=4; i<argc; ++i) {
 		if (strcmp(argv[i],"inverse") == 0 || strcmp(argv[i],"--Inverse") == 0) {
@@ -134,6 +133,10 @@ int main(int argc, char* argv[]) {
 			lexFlag = false;
 			cerr << "not computing lexical translation score\n";
 		}
+		else if (strcmp(argv[i],"--BinaryLex") == 0) {
+			binaryLexFlag = true;
+			cerr << "caching the lexical translation table in " << fileNameLex << ".bin\n";
+		}
 		else if (strcmp(argv[i],"--GoodTuring") == 0) {
 			goodTuringFlag = true;
 			cerr << "using Good Turing discounting\n";
@@ -147,25 +150,113 @@ int main(int argc, char* argv[]) {
 			negLogProb = -1;
 			cerr << "using negative log-probabilities\n";
 		}
+		else if (strcmp(argv[i],"--Threads") == 0) {
+			if (i+1 >= argc) {
+				cerr << "ERROR: no thread count provided to the option --Threads" << endl;
+				exit(1);
+			}
+			int threadCount = atoi(argv[++i]);
+			threads = threadCount > 0 ? threadCount : availableCores();
+			cerr << "using " << threads << " threads for scoring and bzip2 compression\n";
+		}
+		else if (strcmp(argv[i],"--Sort") == 0) {
+			sortFlag = true;
+			cerr << "sorting the extract file internally\n";
+		}
+		else if (strcmp(argv[i],"--SortMemory") == 0 && i+1 < argc) {
+			sortMemory = strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i],"--TempDir") == 0 && i+1 < argc) {
+			tempDir = argv[++i];
+		}
+		else if (strcmp(argv[i],"--TopK") == 0 && i+1 < argc) {
+			topK = atoi(argv[++i]);
+			cerr << "keeping the best " << topK << " translations of each source phrase\n";
+		}
+		else if (strcmp(argv[i],"--PruneWeights") == 0 && i+1 < argc) {
+			for (char* weight = strtok(argv[++i], ","); weight != NULL; weight = strtok(NULL, ","))
+				pruneWeights.push_back(atof(weight));
+		}
+		else if (strcmp(argv[i],"--SignificanceThreshold") == 0 && i+1 < argc) {
+			significanceSpec = argv[++i];
+		}
+		else if (strcmp(argv[i],"--SentencePairs") == 0 && i+1 < argc) {
+			sentencePairs = atof(argv[++i]);
+		}
 		else {
 			cerr << "ERROR: unknown option " << argv[i] << endl;
 			exit(1);
 		}
 	}
 
+	if (significanceSpec != NULL) {
+		if (sentencePairs < 1.) {
+			cerr << "ERROR: significance pruning needs the number of sentence pairs (--SentencePairs)" << endl;
+			exit(1);
+		}
+		// a pair seen once, with a source and a target phrase seen once, has the significance log N; a+e and a-e are just above and below that
+		if (strcmp(significanceSpec, "a+e") == 0)
+			significanceThreshold = log(sentencePairs) + 0.001;
+		else if (strcmp(significanceSpec, "a-e") == 0)
+			significanceThreshold = log(sentencePairs) - 0.001;
+		else if ((significanceThreshold = atof(significanceSpec)) <= 0.) {
+			cerr << "ERROR: the significance threshold has to be positive, a+e or a-e" << endl;
+			exit(1);
+		}
+		cerr << "pruning the phrase pairs with a significance below " << significanceThreshold << endl;
+	}
+	if (topK > 0 || significanceThreshold > 0.) {
+		if (inverseFlag) {
+			cerr << "ERROR: only the direct table can be pruned" << endl;
+			exit(1);
+		}
+		if (pruneWeights.size() > (lexFlag ? 2u : 1u)) {
+			cerr << "ERROR: there are more pruning weights than scores" << endl;
+			exit(1);
+		}
+	}
+
 	// lexical translation table
 	if (lexFlag)
-		lexTable.load(fileNameLex);
+		lexTable.load(fileNameLex, binaryLexFlag);
   
-	// compute count of counts for Good Turing discounting
-	if (goodTuringFlag)
-		computeCountOfCounts(fileNameExtract);
-
-	// sorted phrase extraction file
-	Bz2LineReader extractFile(fileNameExtract);
+	// unsorted extract file: sort it in memory and temporary files, and score straight from the merge
+	ExternalSorter* sorter = NULL;
+	if (sortFlag) {
+		cerr << "sorting with " << sortMemory << "MB of memory, using " << tempDir << " for temporary files\n";
+		sorter = new ExternalSorter(tempDir, sortMemory << 20, threads);
+		Bz2LineReader unsortedFile(fileNameExtract, Bz2LineReader::COMPRESSED, threads);
+		StringPiece line;
+		while (unsortedFile.readLine(line))
+			sorter->add(line);
+		sorter->sort();
+	}
+	
+	PhraseScorer scorer(lexTable);
+	scorer.inverseFlag = inverseFlag;
+	scorer.hierarchicalFlag = hierarchicalFlag;
+	scorer.wordAlignmentFlag = wordAlignmentFlag;
+	scorer.goodTuringFlag = goodTuringFlag;
+	scorer.logProbFlag = logProbFlag;
+	scorer.negLogProb = negLogProb;
+	scorer.lexFlag = lexFlag;
+	scorer.deferDiscountFlag = goodTuringFlag;
+	scorer.topK = topK;
+	scorer.pruneWeights = pruneWeights;
+	scorer.significanceThreshold = significanceThreshold;
+	scorer.sentencePairs = sentencePairs;
 
 	// output file: phrase translation table
-	Bz2LineWriter phraseTableFile(fileNamePhraseTable);
+	Bz2LineWriter phraseTableFile(fileNamePhraseTable, Bz2LineWriter::COMPRESSED, threads);
+	
+	// for Good Turing discounting the scores are first written with their raw counts as binary records to a temporary file,
+	// which becomes the phrase table once the counts of counts are known
+	string recordFileName;
+	Bz2LineWriter* scoreFile = &phraseTableFile;
+	if (goodTuringFlag) {
+		recordFileName = ExternalSorter::createTempFile(tempDir, "score-gt", ".bin");
+		scoreFile = new Bz2LineWriter(recordFileName, Bz2LineWriter::UNCOMPRESSED);
+	}
 
 	// output word alignment file
 	if (!inverseFlag && wordAlignmentFlag) {
@@ -176,405 +267,165 @@ int main(int argc, char* argv[]) {
 			exit(1);
 		}
 	}
-  
-  // loop through all extracted phrase translations
-  int lastSource = -1;
-  vector< PhraseAlignment > phrasePairsWithSameF;
-  int i=0;
-	string lastLine = "";
-	PhraseAlignment *lastPhrasePair = NULL;
-	for (string line = extractFile.readLine(); !line.empty(); line = extractFile.readLine()) {
-		if (line.empty()) break;
-		if ((++i)%10000000 == 0) cerr << "[p. score:" << i << "]" << flush;
-    else if (i % 100000 == 0) cerr << "." << flush;
-		
-		// identical to last line? just add count
-		if (lastSource >= 0 && line == lastLine) {
-			lastPhrasePair->addToCount(line);
-			continue;
-		}
-		lastLine = line;
-
-		// create new phrase pair
-		PhraseAlignment phrasePair;
-		vector<string> lineVector = tokenize(line.c_str());
-		phrasePair.create(lineVector, i);
-		
-		// only differs in count? just add count
-		if (lastPhrasePair != NULL && lastPhrasePair->equals(phrasePair)) {
-			lastPhrasePair->count += phrasePair.count;
-			phrasePair.clear();
-			continue;
-		}
-		
-		// if new source phrase, process last batch
-		if (lastSource >= 0 && lastSource != phrasePair.source) {
-			processPhrasePairs(phrasePairsWithSameF, phraseTableFile);
-			for (size_t j=0; j<phrasePairsWithSameF.size(); phrasePairsWithSameF[j++].clear());
-			phrasePairsWithSameF.clear();
-			phraseTableT.clear();
-			phraseTableS.clear();
-			// process line again, since phrase tables flushed
-			phrasePair.clear();
-			phrasePair.create(lineVector, i);
-		}
-		
-		// add phrase pairs to list, it's now the last one
-		lastSource = phrasePair.source;
-		phrasePairsWithSameF.push_back(phrasePair);
-		lastPhrasePair = &phrasePairsWithSameF[phrasePairsWithSameF.size()-1];
+	
+	if (sorter != NULL) {
+		if (threads > 1)
+			scorePhrasePairsThreaded(*sorter, scorer, *scoreFile);
+		else
+			scorePhrasePairs(*sorter, scorer, *scoreFile);
+		delete sorter;
+	} else {
+		// sorted phrase extraction file
+		Bz2LineReader extractFile(fileNameExtract, Bz2LineReader::COMPRESSED, threads);
+		if (threads > 1)
+			scorePhrasePairsThreaded(extractFile, scorer, *scoreFile);
+		else
+			scorePhrasePairs(extractFile, scorer, *scoreFile);
+	}
+	
+	if (goodTuringFlag) {
+		delete scoreFile;
+		PhraseScorer::computeDiscountFactors(scorer.countOfCounts, scorer.discountFactor);
+		applyDiscounts(recordFileName, scorer, phraseTableFile);
+		remove(recordFileName.c_str());
 	}
-	processPhrasePairs(phrasePairsWithSameF, phraseTableFile);
+	
 	if (!inverseFlag && wordAlignmentFlag)
 		wordAlignmentFile.close();
 }
 
-void computeCountOfCounts(const string& fileNameExtract) {
-	if (fileNameExtract == "-") {
-		cerr << "The ‘GoodTuring Discounting’ option may not be used with piped input!" << endl;
-		exit(9);
-	}
-
-	cerr << "computing counts of counts";
-	for (size_t i=1; i<=GT_MAX; countOfCounts[i++] = 0);
-
-	Bz2LineReader extractFile(fileNameExtract);
-
-	// loop through all extracted phrase translations
+// loop through all extracted phrase translations
+template <typename LineInput> void scorePhrasePairs(LineInput& extractFile, PhraseScorer& scorer, Bz2LineWriter& phraseTableFile) {
 	int i=0;
-	string lastLine;
-	PhraseAlignment *lastPhrasePair = NULL;
-
-	for (string line = extractFile.readLine(); !line.empty(); line = extractFile.readLine()) {
+	StringPiece line;
+	while (extractFile.readLine(line)) {
 		if (line.empty()) break;
-		if ((++i)%10000000 == 0) cerr << "[" << i << "]" << endl;
-    else if (i % 100000 == 0) cerr << "," << flush;
-		
-		// identical to last line? just add count
-		if (line == lastLine) {
-			lastPhrasePair->addToCount(line);
-			continue;			
-		}
-		lastLine = line;
-
-		// create new phrase pair
-		PhraseAlignment *phrasePair = new PhraseAlignment();
-		vector<string> lineVector = tokenize(line.c_str());
-		phrasePair->create(lineVector, i);
+		if ((++i)%10000000 == 0) cerr << "[p. score:" << i << "]" << flush;
+    else if (i % 100000 == 0) cerr << "." << flush;
 		
-		if (i == 1) {
-			lastPhrasePair = phrasePair;
-			continue;
-		}
-
-		// only differs in count? just add count
-		if (lastPhrasePair->match( *phrasePair )) {
-			lastPhrasePair->count += phrasePair->count;
-			phrasePair->clear();
-			delete(phrasePair);
-			continue;
-		}
-
-		// periodically house cleaning
-		if (phrasePair->source != lastPhrasePair->source) {
-			phraseTableT.clear(); // these would get too big
-			phraseTableS.clear(); // these would get too big
-			// process line again, since phrase tables flushed
-			phrasePair->clear();
-			phrasePair->create(lineVector, i); 
-		}
-
-		int count = lastPhrasePair->count + 0.99999;
-		if(count <= GT_MAX)
-			++countOfCounts[ count ];
-		lastPhrasePair->clear();
-		delete( lastPhrasePair );
-		lastPhrasePair = phrasePair;
-	}
-
-	discountFactor[0] = 0.01; // floor
-	cerr << "\n";
-	for(int i=1;i<GT_MAX; ++i) {
-		discountFactor[i] = ((float)i+1)/(float)i*(((float)countOfCounts[i+1]+0.1) / ((float)countOfCounts[i]+0.1));
-		cerr << "count " << i << ": " << countOfCounts[ i ] << ", discount factor: " << discountFactor[i];
-		// some smoothing...
-		if (discountFactor[i]>1) 
-			discountFactor[i] = 1;
-		if (discountFactor[i]<discountFactor[i-1])
-			discountFactor[i] = discountFactor[i-1];
-		cerr << " -> " << discountFactor[i]*i << endl;
+		scorer.addLine(line);
+		writeScores(scorer.output, scorer.wordAlignmentOutput, phraseTableFile);
 	}
+	scorer.finish();
+	writeScores(scorer.output, scorer.wordAlignmentOutput, phraseTableFile);
 }
 
-bool isNonTerminal( string &word ) 
-{
-	return (word.length()>=3 &&
-		word.substr(0,1).compare("[") == 0 && 
-		word.substr(word.length()-1,1).compare("]") == 0);
-}
-	
-void processPhrasePairs(vector<PhraseAlignment>& phrasePair, Bz2LineWriter& phraseTableFile) {
-  if (phrasePair.size() == 0) return;
-
-	// group phrase pairs based on alignments that matter
-	// (i.e. that re-arrange non-terminals)
-	vector<vector<PhraseAlignment*> > phrasePairGroup;
-	float totalSource = 0.;
-	
-	// loop through phrase pairs
-	for(size_t i=0; i<phrasePair.size(); ++i) {
-		// add to total count
-		totalSource += phrasePair[i].count;
-
-		bool matched = false;
-		// check for matches
-		for(size_t g=0; g<phrasePairGroup.size(); ++g) {
-			vector< PhraseAlignment* > &group = phrasePairGroup[g];
-			// matched? place into same group
-			if ( group[0]->match( phrasePair[i] )) {
-				group.push_back( &phrasePair[i] );
-				matched = true;
-			}
-		}
-		// not matched? create new group
-		if (!matched) {
-			vector< PhraseAlignment* > newGroup;
-			newGroup.push_back( &phrasePair[i] );
-			phrasePairGroup.push_back( newGroup );
-		}
+// The main thread cuts the extract file into chunks at source phrase boundaries and queues them for the workers.
+// A separate thread writes the scores of each chunk once it is completed, strictly in input order.
+template <typename LineInput> void scorePhrasePairsThreaded(LineInput& extractFile, PhraseScorer& scorer, Bz2LineWriter& phraseTableFile) {
+	cerr << "scoring on " << threads << " threads\n";
+	for (unsigned t = 0; t < threads; ++t) {
+		PhraseScorer* workerScorer = new PhraseScorer(lexTable);
+		workerScorer->inverseFlag = scorer.inverseFlag;
+		workerScorer->hierarchicalFlag = scorer.hierarchicalFlag;
+		workerScorer->wordAlignmentFlag = scorer.wordAlignmentFlag;
+		workerScorer->goodTuringFlag = scorer.goodTuringFlag;
+		workerScorer->logProbFlag = scorer.logProbFlag;
+		workerScorer->negLogProb = scorer.negLogProb;
+		workerScorer->lexFlag = scorer.lexFlag;
+		workerScorer->deferDiscountFlag = scorer.deferDiscountFlag;
+		workerScorer->topK = scorer.topK;
+		workerScorer->pruneWeights = scorer.pruneWeights;
+		workerScorer->significanceThreshold = scorer.significanceThreshold;
+		workerScorer->sentencePairs = scorer.sentencePairs;
+		memcpy(workerScorer->discountFactor, scorer.discountFactor, sizeof(scorer.discountFactor));
+		idleScorers.push_back(workerScorer);
 	}
 	
-	for(size_t g=0; g<phrasePairGroup.size(); ++g) {
-		vector< PhraseAlignment* > &group = phrasePairGroup[g];
-		outputPhrasePair(group, totalSource, phraseTableFile);
-	}
-}
-
-PhraseAlignment* findBestAlignment( vector< PhraseAlignment* > &phrasePair ) {
-	float bestAlignmentCount = -1.;
-	PhraseAlignment* bestAlignment;
-
-	for(size_t i=0; i<phrasePair.size(); ++i)
-		if (phrasePair[i]->count > bestAlignmentCount) {
-			bestAlignmentCount = phrasePair[i]->count;
-			bestAlignment = phrasePair[i];
-		}
+	OrderedWorkerPool pool(threads, 4 * threads);
+	pair<OrderedWorkerPool*, Bz2LineWriter*> writerData(&pool, &phraseTableFile);
+	Thread writer;
+	writer.start(&scoreWriter, &writerData);
 	
-	return bestAlignment;
-}
-
-void outputPhrasePair(vector<PhraseAlignment*> &phrasePair, float totalCount, Bz2LineWriter& phraseTableFile) {
-  if (phrasePair.size() == 0)
-		return;
-
-	PhraseAlignment *bestAlignment = findBestAlignment( phrasePair );
-
-	// compute count
-	float count = 0.;
-	for(size_t i=0; i<phrasePair.size(); count += phrasePair[i++]->count);
-
-	PHRASE phraseS = phraseTableS.getPhrase( phrasePair[0]->source );
-	PHRASE phraseT = phraseTableT.getPhrase( phrasePair[0]->target );
-
-	// labels (if hierarchical)
-
-	// source phrase (unless inverse)
-	if (!inverseFlag) {
-		for (size_t j=0; j<phraseS.size(); phraseTableFile.writeLine(vcbS.getWord(phraseS[j++]) + " "));
-		phraseTableFile.writeLine("||| ");
+	int i=0;
+	ScoreJob* job = new ScoreJob();
+	size_t lastLineStart = 0;
+	StringPiece line;
+	while (extractFile.readLine(line)) {
+		if (line.empty()) break;
+		if ((++i)%10000000 == 0) cerr << "[p. score:" << i << "]" << flush;
+    else if (i % 100000 == 0) cerr << "." << flush;
+		
+		if (job->lines.size() >= scoreChunkSize && sourcePhrase(line) != sourcePhrase(StringPiece(job->lines.data() + lastLineStart, job->lines.size() - lastLineStart - 1))) {
+			pool.submit(job);
+			job = new ScoreJob();
+		}
+		lastLineStart = job->lines.size();
+		job->lines.append(line.data(), line.size());
+		job->lines += '\n';
 	}
+	pool.submit(job);
 	
-	// target phrase
-	for (size_t j=0; j<phraseT.size(); phraseTableFile.writeLine(vcbT.getWord(phraseT[j++]) + " "));
-	phraseTableFile.writeLine("||| ");
-	
-	// source phrase (if inverse)
-	if (inverseFlag) {
-		for (size_t j=0; j<phraseS.size(); phraseTableFile.writeLine(vcbS.getWord(phraseS[j++]) + " "));
-		phraseTableFile.writeLine("||| ");
-	}
+	pool.finish();
+	writer.join();
 	
-	// alignment info for non-terminals
-	if (!inverseFlag && hierarchicalFlag) {
-    assert(phraseT.size() == bestAlignment->alignedToT.size() + 1);
-		for(size_t j = 0; j < phraseT.size() - 1; ++j)
-			if (isNonTerminal(vcbT.getWord( phraseT[j] ))) {
-        assert(bestAlignment->alignedToT[ j ].size() == 1);
-				stringstream data;
-				data << *(bestAlignment->alignedToT[j].begin()) << "-" << j << " ";
-				phraseTableFile.writeLine(data.str());
-			}
-		phraseTableFile.writeLine("||| ");
+	// collect the counts of counts of all workers
+	for (size_t s = 0; s < idleScorers.size(); ++s) {
+		for (size_t i = 0; i <= GT_MAX; ++i)
+			scorer.countOfCounts[i] += idleScorers[s]->countOfCounts[i];
+		delete idleScorers[s];
 	}
+	idleScorers.clear();
+}
 
-	// phrase translation probability
-	if (goodTuringFlag && count<GT_MAX)
-		count *= discountFactor[(int)(count+0.99999)];
-	
+void ScoreJob::run() {
+	PhraseScorer* scorer;
 	{
-		stringstream data;
-		data << (logProbFlag ? negLogProb*log(count / totalCount) : count / totalCount);
-		phraseTableFile.writeLine(data.str());
+		ScopedLock lock(scorerMutex);
+		scorer = idleScorers.back();
+		idleScorers.pop_back();
 	}
 	
-	// lexical translation probability
-	if (lexFlag) {
-		stringstream data;
-		data << " " << (logProbFlag ?
-										negLogProb*log(computeLexicalTranslation(phraseS, phraseT, bestAlignment)) :
-										computeLexicalTranslation(phraseS, phraseT, bestAlignment));
-		phraseTableFile.writeLine(data.str());
+	for (size_t begin = 0, end; begin < lines.size(); begin = end + 1) {
+		end = lines.find('\n', begin);
+		scorer->addLine(StringPiece(lines.data() + begin, end - begin));
 	}
-
-	{
-		stringstream data;
-		data << " ||| " << totalCount << endl;
-		phraseTableFile.writeLine(data.str());
-	}
-
-	// optional output of word alignments
-	if (!inverseFlag && wordAlignmentFlag) {
-		// source phrase
-		for(size_t j=0;j<phraseS.size(); wordAlignmentFile << vcbS.getWord(phraseS[j++]) << " ");
-		wordAlignmentFile << "||| ";
+	scorer->finish();
+	output.swap(scorer->output);
+	wordAlignmentOutput.swap(scorer->wordAlignmentOutput);
+	scorer->output.clear();
+	scorer->wordAlignmentOutput.clear();
 	
-		// target phrase
-		for(size_t j=0;j<phraseT.size(); wordAlignmentFile << vcbT.getWord(phraseT[j++]) << " ");
-		wordAlignmentFile << "|||";
-
-		// alignment
-		for(size_t j=0;j<bestAlignment->alignedToT.size(); ++j) {
-			const set< size_t > &aligned = bestAlignment->alignedToT[j];
-      for (set< size_t >::const_iterator p(aligned.begin()); p != aligned.end(); wordAlignmentFile << " " << *(p++) << "-" << j);
-		}
-		wordAlignmentFile << endl;
-	}
+	ScopedLock lock(scorerMutex);
+	idleScorers.push_back(scorer);
 }
 
-double computeLexicalTranslation( PHRASE &phraseS, PHRASE &phraseT, PhraseAlignment *alignment ) {
-	// lexical translation probability
-	double lexScore = 1.;
-	int null = vcbS.getWordID("NULL");
-	// all target words have to be explained
-	for (size_t ti=0; ti<alignment->alignedToT.size(); ++ti) { 
-    const set<size_t>& srcIndices = alignment->alignedToT[ti];
-		if (srcIndices.empty())
-		// explain unaligned word by NULL
-			lexScore *= lexTable.permissiveLookup(null, phraseT[ti]); 
-		else {
-		 // go through all the aligned words to compute average
-			double thisWordScore = 0.;
-      for (set<size_t>::const_iterator p(srcIndices.begin()); p != srcIndices.end(); thisWordScore += lexTable.permissiveLookup(phraseS[*(p++)], phraseT[ti]));
-			lexScore *= (thisWordScore / srcIndices.size());
-		}
+void* scoreWriter(void* data) {
+	pair<OrderedWorkerPool*, Bz2LineWriter*>& writerData = *static_cast<pair<OrderedWorkerPool*, Bz2LineWriter*>*>(data);
+	for (OrderedJob* job = writerData.first->next(); job != NULL; job = writerData.first->next()) {
+		ScoreJob* scoreJob = static_cast<ScoreJob*>(job);
+		writeScores(scoreJob->output, scoreJob->wordAlignmentOutput, *writerData.second);
+		delete job;
 	}
-	return lexScore;
+	return NULL;
 }
 
-void PhraseAlignment::addToCount(string line) {
-	unsigned short items = 1;
-	while (line.find("|||") != string::npos) {
-		line = line.substr(line.find("|||") + 3);
-		++items;
-	}
-	if (items == 3) // no specified counts -> counts as one
-		count += 1.;
-	else
-		count += strtof(line.c_str(), NULL);
+// The source phrase of an extract line: everything before the first |||
+StringPiece sourcePhrase(const StringPiece& line) {
+	return line.substr(0, findFieldSeparator(line));
 }
 
-// read in a phrase pair and store it
-void PhraseAlignment::create(const vector<string>& token, int lineID) {
-	int item = 1;
-	PHRASE phraseS, phraseT;
-	for (size_t j=0; j<token.size(); ++j) {
-		if (token[j] == "|||")
-			item++;
-		else if (item == 1) // source phrase
-			phraseS.push_back( vcbS.storeIfNew( token[j] ) );
-		else if (item == 2) // target phrase
-			phraseT.push_back( vcbT.storeIfNew( token[j] ) );
-		else if (item == 3) { // alignment
-			int s = strtol(token[j].substr(0, token[j].find("-")).c_str(), NULL, 10);
-			int t = strtol(token[j].substr(token[j].find("-") + 1).c_str(), NULL, 10);
-			if (t >= phraseT.size() || s >= phraseS.size()) {
-				cerr << "WARNING: phrase pair " << lineID 
-						 << " has alignment point (" << s << ", " << t 
-						 << ") out of bounds (" << phraseS.size() << ", " << phraseT.size() << ")\n";
-			} else {
-				// first alignment point? -> initialize
-				if (alignedToT.size() == 0) {
-          assert(alignedToS.size() == 0);
-          size_t numTgtSymbols = (hierarchicalFlag ? phraseT.size()-1 : phraseT.size());
-          alignedToT.resize(numTgtSymbols);
-          size_t numSrcSymbols = (hierarchicalFlag ? phraseS.size()-1 : phraseS.size());
-          alignedToS.resize(numSrcSymbols);
-					source = phraseTableS.storeIfNew( phraseS );
-					target = phraseTableT.storeIfNew( phraseT );
-				}
-				// add alignment point
-				alignedToT[t].insert( s );
-				alignedToS[s].insert( t );
-			}
-		} else if (item == 4) // count
-			count = strtof(token[j].c_str(), NULL);
+void writeScores(string& output, string& wordAlignmentOutput, Bz2LineWriter& phraseTableFile) {
+	if (!output.empty()) {
+		phraseTableFile.append(output);
+		output.clear();
 	}
-	if (item == 3)
-		count = 1.0;
-	if (item < 3 || item > 4) {
-		cerr << "ERROR: faulty line " << lineID << ": ";
-		for(vector<string>::const_iterator i = token.begin(); i != token.end(); cerr << *(i++) << " ");
-		cerr << endl;
+	if (!wordAlignmentOutput.empty()) {
+		wordAlignmentFile << wordAlignmentOutput;
+		wordAlignmentOutput.clear();
 	}
 }
 
-// check if two word alignments between a phrase pairs "match"
-// i.e. they do not differ in the alignment of non-termimals
-bool PhraseAlignment::match( const PhraseAlignment& other )
-{
-	if (other.target != target || other.source != source) return false;
-	if (!hierarchicalFlag) return true;
-
-	PHRASE phraseT = phraseTableT.getPhrase( target );
-
-  assert(phraseT.size() == alignedToT.size() + 1);
-  assert(alignedToT.size() == other.alignedToT.size());
-
-	// loop over all words (note: 0 = left hand side of rule)
-	for(size_t i=0;i<phraseT.size()-1;++i)
-		if (isNonTerminal( vcbT.getWord( phraseT[i] ) )) {
-			if (alignedToT[i].size() != 1 ||
-			    other.alignedToT[i].size() != 1 ||
-		    	    *(alignedToT[i].begin()) != *(other.alignedToT[i].begin()))
-				return false;
+// Turns the records with raw counts into the phrase table, applying the Good Turing discount factors
+void applyDiscounts(const string& recordFileName, const PhraseScorer& scorer, Bz2LineWriter& phraseTableFile) {
+	cerr << "applying Good Turing discounts\n";
+	ifstream recordFile(recordFileName.c_str(), ios::binary);
+	string lines, head;
+	while (scorer.appendDiscounted(recordFile, head, lines)) {
+		if (lines.size() >= scoreChunkSize) {
+			phraseTableFile.append(lines);
+			lines.clear();
 		}
-
-	return true;
-}
-
-
-void LexicalTable::load(char *fileName) {
-  cerr << "Loading lexical translation table from " << fileName;
-	Bz2LineReader inFile(fileName, Bz2LineReader::UNCOMPRESSED);
-	
-	int i = 0;
-	for (string line = inFile.readLine(); !line.empty(); line = inFile.readLine()) {
-		if (line.empty())
-			break;
-    if (++i%100000 == 0) cerr << "." << flush;
-		
-    vector<string> token = tokenize(line.c_str());
-    if (token.size() != 3) {
-      cerr << "line " << i << " “" << line << "” in " << fileName 
-			     << " has wrong number of tokens (" << token.size() << "), skipping:\n"
-			     << token.size() << " " << token[0] << " " << line << endl;
-      continue;
-    }
-  
-    WORD_ID wordT = vcbT.storeIfNew( token[0] );
-    WORD_ID wordS = vcbS.storeIfNew( token[1] );
-    ltable[ wordS ][ wordT ] = strtod(token[2].c_str(), NULL);
-  }
-  cerr << endl;
+	}
+	phraseTableFile.append(lines);
 }
-
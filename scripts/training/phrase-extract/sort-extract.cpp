@@ -0,0 +1,75 @@
+/*
+ *  sort-extract.cpp
+ *  Moses Training
+ *
+ *  © 2012 Autodesk Development Sàrl. All rights reserved.
+ *
+ *  Sorts extract files in byte order—the order that LC_ALL=C sort produces and score expects—with bounded memory.
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+
+#include "Bz2LineReader.h"
+#include "Bz2LineWriter.h"
+#include "ExternalSorter.h"
+
+using namespace std;
+using namespace bg_zhechev_ventsislav;
+
+int main(int argc, char* argv[]) {
+	cerr	<< "Sort-Extract v1.0 written by Ventsislav Zhechev, Autodesk Development Sàrl" << endl
+				<< "sorts extracted phrase pairs" << endl
+	;
+	
+	if (argc < 3) {
+		cerr << "syntax: sort-extract input output [--Threads N] [--Memory MB] [--TempDir dir]\n";
+		exit(1);
+	}
+	const string fileNameInput = argv[1];
+	const string fileNameOutput = argv[2];
+	
+	unsigned threads = 1;
+	size_t memory = 1024;
+	string tempDir = ExternalSorter::defaultTempDir();
+	for (int i = 3; i < argc; ++i) {
+		if (strcmp(argv[i], "--Threads") == 0 && i+1 < argc) {
+			int threadCount = atoi(argv[++i]);
+			threads = threadCount > 0 ? threadCount : availableCores();
+		} else if (strcmp(argv[i], "--Memory") == 0 && i+1 < argc) {
+			memory = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--TempDir") == 0 && i+1 < argc) {
+			tempDir = argv[++i];
+		} else {
+			cerr << "ERROR: unknown option or missing value " << argv[i] << endl;
+			exit(1);
+		}
+	}
+	cerr << "sorting with " << memory << "MB of memory on " << threads << " threads, using " << tempDir << " for temporary files" << endl;
+	
+	ExternalSorter sorter(tempDir, memory << 20, threads);
+	{
+		Bz2LineReader inputFile(fileNameInput, Bz2LineReader::COMPRESSED, threads);
+		StringPiece line;
+		for (unsigned i = 1; inputFile.readLine(line); ++i) {
+			if (i % 10000000 == 0) cerr << "[sort:" << i << "]" << flush;
+			else if (i % 100000 == 0) cerr << "." << flush;
+			sorter.add(line);
+		}
+	}
+	sorter.sort();
+	cerr << endl;
+	
+	Bz2LineWriter outputFile(fileNameOutput, Bz2LineWriter::COMPRESSED, threads);
+	StringPiece line;
+	while (sorter.readLine(line)) {
+		outputFile.append(line);
+		outputFile.append('\n');
+	}
+	outputFile.close();
+	
+	return 0;
+}
@@ -12,11 +12,15 @@
 
 // as in beamdecoder/tables.cpp
 vector<string> tokenize( const char* input ) {
+  return tokenize(bg_zhechev_ventsislav::StringPiece(input));
+}
+
+vector<string> tokenize( const bg_zhechev_ventsislav::StringPiece& input ) {
   vector< string > token;
   bool betweenWords = true;
-  int start=0;
-  int i=0;
-  for(; input[i] != '\0'; i++) {
+  size_t start=0;
+  size_t i=0;
+  for(; i < input.size(); i++) {
     bool isSpace = (input[i] == ' ' || input[i] == '\t');
 
     if (!isSpace && betweenWords) {
@@ -24,59 +28,15 @@ vector<string> tokenize( const char* input ) {
       betweenWords = false;
     }
     else if (isSpace && !betweenWords) {
-      token.push_back( string( input+start, i-start ) );
+      token.push_back( string( input.data()+start, i-start ) );
       betweenWords = true;
     }
   }
   if (!betweenWords)
-    token.push_back( string( input+start, i-start ) );
+    token.push_back( string( input.data()+start, i-start ) );
   return token;
 }
 
-WORD_ID Vocabulary::storeIfNew(const WORD& word) {
-  map<WORD, WORD_ID>::iterator i = lookup.find(word);
-  
-  if (i != lookup.end())
-    return i->second;
-
-  WORD_ID id = vocab.size();
-  vocab.push_back(word);
-	lookup.insert(i, make_pair(word, id));
-  return id;  
-}
-
-WORD_ID Vocabulary::getWordID(const WORD& word) {
-  map<WORD, WORD_ID>::const_iterator i = lookup.find(word);
-  if (i == lookup.end())
-    return 0;
-	else
-		return i->second;
-}
-
-PHRASE_ID PhraseTable::storeIfNew(const PHRASE& phrase) {
-  map<PHRASE, PHRASE_ID>::iterator i = lookup.find(phrase);
-  if(i != lookup.end())
-    return i->second;
-
-  PHRASE_ID id  = phraseTable.size();
-  phraseTable.push_back(phrase);
-	lookup.insert(i, make_pair(phrase, id));
-  return id;
-}
-
-PHRASE_ID PhraseTable::getPhraseID(const PHRASE& phrase) {
-  map<PHRASE, PHRASE_ID>::const_iterator i = lookup.find(phrase);
-  if(i == lookup.end())
-    return 0;
-	else
-		return i->second;
-}
-
-void PhraseTable::clear() {
-  lookup.clear();
-  phraseTable.clear();
-}
-
 void DTable::init() {
   for(int i = -10; i<10; ++i)
     dtable[i] = -abs(i);
@@ -13,35 +13,147 @@
 #include <string>
 #include <queue>
 #include <map>
+#include <vector>
+#include <algorithm>
+#include <cstring>
 #include <cmath>
 
+#include "StringPiece.h"
+
 using namespace std;
 
 extern vector<string> tokenize( const char*);
+extern vector<string> tokenize( const bg_zhechev_ventsislav::StringPiece&);
 
 typedef string WORD;
 typedef unsigned int WORD_ID;
 
+typedef vector< WORD_ID > PHRASE;
+typedef unsigned int PHRASE_ID;
+
+// Marks a free slot in the hash table of a SequenceTable
+const unsigned NO_SEQUENCE = unsigned(-1);
+
+// SequenceTable interns sequences of T (the characters of a word, the word IDs of a phrase).
+// All sequences are stored back to back in one array and are found through an open-addressing hash table of their IDs.
+template <typename T> class SequenceTable {
+	vector<T> items;
+	vector<size_t> starts;
+	vector<unsigned> hashes;
+	vector<unsigned> slots;
+
+	static inline unsigned hash(const T* sequence, size_t length) {
+		// FNV-1a over the bytes of the sequence
+		const unsigned char* byte = reinterpret_cast<const unsigned char*>(sequence);
+		unsigned result = 2166136261u;
+		for (size_t i = 0; i < length * sizeof(T); ++i) {
+			result ^= byte[i];
+			result *= 16777619u;
+		}
+		return result;
+	}
+
+	inline bool equals(unsigned id, const T* sequence, size_t length) const {
+		return starts[id+1] - starts[id] == length && (length == 0 || memcmp(&items[starts[id]], sequence, length * sizeof(T)) == 0);
+	}
+
+	//The slot that holds the sequence, or the free slot where it belongs
+	inline size_t findSlot(const T* sequence, size_t length, unsigned sequenceHash) const {
+		size_t mask = slots.size() - 1;
+		size_t slot = sequenceHash & mask;
+		while (slots[slot] != NO_SEQUENCE && (hashes[slots[slot]] != sequenceHash || !equals(slots[slot], sequence, length)))
+			slot = (slot + 1) & mask;
+		return slot;
+	}
+
+	void rehash(size_t slotCount) {
+		slots.assign(slotCount, NO_SEQUENCE);
+		for (unsigned id = 0; id < hashes.size(); ++id) {
+			size_t slot = hashes[id] & (slotCount - 1);
+			while (slots[slot] != NO_SEQUENCE)
+				slot = (slot + 1) & (slotCount - 1);
+			slots[slot] = id;
+		}
+	}
+public:
+	static const size_t minimumSlots = 64;
+
+	SequenceTable() : starts(1, 0), slots(minimumSlots, NO_SEQUENCE) {}
+
+	unsigned storeIfNew(const T* sequence, size_t length) {
+		unsigned sequenceHash = hash(sequence, length);
+		size_t slot = findSlot(sequence, length, sequenceHash);
+		if (slots[slot] != NO_SEQUENCE)
+			return slots[slot];
+
+		unsigned id = hashes.size();
+		items.insert(items.end(), sequence, sequence + length);
+		starts.push_back(items.size());
+		hashes.push_back(sequenceHash);
+		//Keep the table at most half full
+		if (2 * hashes.size() > slots.size())
+			rehash(2 * slots.size());
+		else
+			slots[slot] = id;
+		return id;
+	}
+
+	//Returns NO_SEQUENCE for unknown sequences
+	inline unsigned find(const T* sequence, size_t length) const {
+		return slots[findSlot(sequence, length, hash(sequence, length))];
+	}
+
+	//The sequence is only valid until the next sequence is stored
+	inline const T* get(unsigned id) const { return items.empty() ? NULL : &items[0] + starts[id]; }
+	inline size_t length(unsigned id) const { return starts[id+1] - starts[id]; }
+	inline size_t size() const { return hashes.size(); }
+
+	void clear() {
+		items.clear();
+		starts.resize(1);
+		hashes.clear();
+		//Give back the memory of an exceptionally large table
+		if (slots.size() > minimumSlots)
+			slots.assign(minimumSlots, NO_SEQUENCE);
+		else
+			fill(slots.begin(), slots.end(), NO_SEQUENCE);
+	}
+};
+
 class Vocabulary {
+	SequenceTable<char> words;
  public:
-  map<WORD, WORD_ID>  lookup;
-  vector< WORD > vocab;
-  WORD_ID storeIfNew( const WORD& );
-  WORD_ID getWordID( const WORD& );
-  inline WORD &getWord( WORD_ID id ) { return vocab[ id ]; }
+  inline WORD_ID storeIfNew( const bg_zhechev_ventsislav::StringPiece& word ) { return words.storeIfNew(word.data(), word.size()); }
+  inline WORD_ID getWordID( const bg_zhechev_ventsislav::StringPiece& word ) const {
+		WORD_ID id = words.find(word.data(), word.size());
+		return id == NO_SEQUENCE ? 0 : id;
+	}
+	//The word is only valid until the next new word is stored
+  inline bg_zhechev_ventsislav::StringPiece getWord( WORD_ID id ) const { return bg_zhechev_ventsislav::StringPiece(words.get(id), words.length(id)); }
+	inline size_t size() const { return words.size(); }
 };
 
-typedef vector< WORD_ID > PHRASE;
-typedef unsigned int PHRASE_ID;
+// PhraseView is a phrase stored in a PhraseTable; it is only valid until the next new phrase is stored
+class PhraseView {
+	const WORD_ID* words;
+	size_t length;
+ public:
+	PhraseView(const WORD_ID* w, size_t l) : words(w), length(l) {}
+	inline size_t size() const { return length; }
+	inline WORD_ID operator[](size_t i) const { return words[i]; }
+};
 
 class PhraseTable {
+	SequenceTable<WORD_ID> phrases;
  public:
-  map< PHRASE, PHRASE_ID > lookup;
-  vector< PHRASE > phraseTable;
-  PHRASE_ID storeIfNew( const PHRASE& );
-  PHRASE_ID getPhraseID( const PHRASE& );
-  void clear();
-  inline PHRASE &getPhrase( const PHRASE_ID id ) { return phraseTable[ id ]; }
+  inline PHRASE_ID storeIfNew( const PHRASE& phrase ) { return phrases.storeIfNew(phrase.empty() ? NULL : &phrase[0], phrase.size()); }
+  inline PHRASE_ID getPhraseID( const PHRASE& phrase ) const {
+		PHRASE_ID id = phrases.find(phrase.empty() ? NULL : &phrase[0], phrase.size());
+		return id == NO_SEQUENCE ? 0 : id;
+	}
+  inline void clear() { phrases.clear(); }
+  inline PhraseView getPhrase( const PHRASE_ID id ) const { return PhraseView(phrases.get(id), phrases.length(id)); }
+	inline size_t size() const { return phrases.size(); }
 };
 
 typedef vector< pair< PHRASE_ID, double > > PHRASEPROBVEC;
@@ -3,28 +3,26 @@
  *			©2011 Autodesk Development Sàrl
  *			Last modified by Ventsislav Zhechev on 11 Nov 2011
  *			ChangeLog:
+ *			v2.1
+ *			Removed the restriction on sentence length; the alignment matrices are sized for each sentence pair.
+ *			The input is parsed with a buffered tokenizer and the sentence pairs are symmetrised in batches on several threads (-t), with the output in input order.
  *			v2.0
  *			Removed the restriction on source/target token length.
  *
  */
 
-#include <cassert>
-#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <string>
-#include <list>
 #include <vector>
-#include <set>
 #include <algorithm>
-#include <cstring>
 #include "cmd.h"
+#include "../phrase-extract/Threading.h"
 
 using namespace std;
-
-#define MAX_M 200     //maximum length of source strings
-#define MAX_N 200     //maximum length of target strings 
+using namespace bg_zhechev_ventsislav;
 
 #define UNION                      1
 #define INTERSECT                  2
@@ -64,153 +62,246 @@ static Enum_T BoolEnum [] = {
 
 // global variables and constants
 
-int* fa; //counters of covered foreign positions
-int* ea; //counters of covered english positions
-int** A; //alignment matrix with information symmetric/direct/inverse alignments
-
 int verbose=0;
 
-//read an alignment pair from the input stream. 
+//Sentence pairs are symmetrised in batches of this size
+static const size_t batchSize = 4096;
+
+
+//Reads whitespace-separated tokens from a file through a large buffer, without any per-token allocation
+class TokenReader {
+	FILE* file;
+	vector<char> buffer;
+	size_t position;
+	size_t end;
+	bool finished;
+	
+	//Moves the unread data to the front of the buffer and fills the rest; returns false if nothing could be added
+	bool refill() {
+		if (finished)
+			return false;
+		if (position > 0) {
+			memmove(&buffer[0], &buffer[position], end - position);
+			end -= position;
+			position = 0;
+		}
+		if (end == buffer.size())
+			buffer.resize(2 * buffer.size());
+		size_t read = fread(&buffer[end], 1, buffer.size() - end, file);
+		end += read;
+		if (read == 0)
+			finished = true;
+		return read > 0;
+	}
+	
+	static inline bool isSpace(char c) { return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f' || c == '\v'; }
+public:
+	TokenReader(FILE* f) : file(f), buffer(1 << 20), position(0), end(0), finished(false) {}
+	
+	//Points token to the next token, which stays valid until the next call
+	bool next(const char*& token, size_t& length) {
+		while (true) {
+			for (; position < end && isSpace(buffer[position]); ++position);
+			if (position < end)
+				break;
+			if (!refill())
+				return false;
+		}
+		size_t tokenEnd = position;
+		while (true) {
+			for (; tokenEnd < end && !isSpace(buffer[tokenEnd]); ++tokenEnd);
+			if (tokenEnd < end)
+				break;
+			size_t offset = tokenEnd - position;
+			if (!refill())
+				break;
+			tokenEnd = position + offset;
+		}
+		token = &buffer[position];
+		length = tokenEnd - position;
+		position = tokenEnd;
+		return true;
+	}
+	
+	inline bool skip() {
+		const char* token;
+		size_t length;
+		return next(token, length);
+	}
+	
+	//Reads a (non-negative) number; returns false at the end of the input or if the token is not a number
+	bool nextNumber(int& number) {
+		const char* token;
+		size_t length;
+		if (!next(token, length))
+			return false;
+		number = 0;
+		for (size_t i = 0; i < length; ++i) {
+			if (token[i] < '0' || token[i] > '9')
+				return false;
+			number = 10 * number + (token[i] - '0');
+		}
+		return length > 0;
+	}
+};
+
+static void badInput(int sentence) {
+	cerr << "symal: malformed input for sentence pair " << sentence << "!!!" << endl;
+	exit(1);
+}
+
+//read an alignment pair from the input stream and append it to data as n, b[0..n], m, a[0..m]
 
 int lc = 0;
 
-int getals(fstream& inp,int& m, int *a,int& n, int *b)
+int getals(TokenReader& inp, vector<int>& data)
 {
-  char dummy[10];
-	string w;
-  int i,j,freq;
-  if (inp >> freq){
-    ++lc;
-    //target sentence
-    inp >> n; assert(n<MAX_N);
-    for (i=1;i<=n;i++){ 
-      inp >> w;
-    }
-    
-    inp >> dummy; //# separator
-    // inverse alignment
-    for (i=1;i<=n;i++) inp >> b[i];
-
-    //source sentence
-    inp >> m; assert(m<MAX_M);
-    for (j=1;j<=m;j++){
-      inp >> w;
-    }
-    
-    inp >> dummy; //# separator
+  int i,j,freq,m,n,value;
+  if (!inp.nextNumber(freq))
+    return 0;
+  ++lc;
+  
+  //target sentence
+  if (!inp.nextNumber(n)) badInput(lc);
+  for (i=1;i<=n;i++)
+    if (!inp.skip()) badInput(lc);
+  if (!inp.skip()) badInput(lc); //# separator
+  // inverse alignment
+  size_t inverse = data.size() + 1;
+  data.push_back(n);
+  data.push_back(0);
+  for (i=1;i<=n;i++) {
+    if (!inp.nextNumber(value)) badInput(lc);
+    data.push_back(value);
+  }
+  
+  //source sentence
+  if (!inp.nextNumber(m)) badInput(lc);
+  for (j=1;j<=m;j++)
+    if (!inp.skip()) badInput(lc);
+  if (!inp.skip()) badInput(lc); //# separator
+  // direct alignment
+  data.push_back(m);
+  data.push_back(0);
+  for (j=1;j<=m;j++) {
+    if (!inp.nextNumber(value) || value > n) badInput(lc);
+    data.push_back(value);
+  }
+  
+  //check inverse alignemnt
+  for (i=1;i<=n;i++)
+    if (data[inverse+i] > m) badInput(lc);
+  
+  return 1;
+}
 
-    // direct alignment
-    for (j=1;j<=m;j++) {
-      inp >> a[j];
-      assert(0<=a[j] && a[j]<=n);
-    }
 
-    //check inverse alignemnt
-    for (i=1;i<=n;i++)
-      assert(0<=b[i] && b[i]<=m);
-    
-    return 1;
+static inline void appendNumber(string& out, int number) {
+  char digits[12];
+  int length = 0;
+  do {
+    digits[length++] = '0' + number % 10;
+    number /= 10;
+  } while (number > 0);
+  while (length > 0)
+    out += digits[--length];
+}
 
-  }
+//appends the point as source-target with 0-based positions
+static inline void appendPoint(string& out, int j, int i) {
+  appendNumber(out, j-1);
+  out += '-';
+  appendNumber(out, i-1);
+  out += ' ';
+}
+
+//fix the last " "
+static inline void endLine(string& out, size_t lineStart) {
+  if (out.size() == lineStart)
+    out += '\n';
   else
-    return 0;
-};
+    out[out.size()-1] = '\n';
+}
 
 
 //compute union alignment
-int prunionalignment(fstream& out,int m,int *a,int n,int* b){
+int prunionalignment(string& out,int m,const int *a,int n,const int* b){
   
-  ostringstream sout;
+  size_t lineStart = out.size();
   
   for (int j=1;j<=m;j++)
     if (a[j]) 
-      sout << j-1 << "-" << a[j]-1 << " ";
+      appendPoint(out, j, a[j]);
 
   for (int i=1;i<=n;i++)
     if (b[i] && a[b[i]]!=i)
-      sout << b[i]-1 <<  "-" << i-1 << " ";
-
-  //fix the last " "
-  string str = sout.str();
-  if (str.length() == 0)
-    str = "\n";
-  else
-    str.replace(str.length()-1,1,"\n");
+      appendPoint(out, b[i], i);
 
-  out << str;
-         out.flush();
- 
+  endLine(out, lineStart);
 	return 1;
 }
 
 
 //Compute intersection alignment
 
-int printersect(fstream& out,int m,int *a,int n,int* b){
+int printersect(string& out,int m,const int *a,int n,const int* b){
 
-  ostringstream sout;
+  size_t lineStart = out.size();
 
   for (int j=1;j<=m;j++)
     if (a[j] && b[a[j]]==j)
-      sout << j-1 << "-" << a[j]-1 << " ";
-
-  //fix the last " "
-  string str = sout.str();
-  if (str.length() == 0)
-    str = "\n";
-  else
-    str.replace(str.length()-1,1,"\n");
-
-  out << str;
-         out.flush();
+      appendPoint(out, j, a[j]);
 
-        return 1;
+  endLine(out, lineStart);
+  return 1;
 }
 
 //Compute target-to-source alignment
 
-int printtgttosrc(fstream& out,int m,int *a,int n,int* b){
+int printtgttosrc(string& out,int m,const int *a,int n,const int* b){
   
-  ostringstream sout;
+  size_t lineStart = out.size();
 
   for (int i=1;i<=n;i++)
     if (b[i])
-        sout << b[i]-1 << "-" << i-1 << " ";
-
-  //fix the last " "
-  string str = sout.str();
-  if (str.length() == 0)
-    str = "\n";
-  else
-    str.replace(str.length()-1,1,"\n");
-
-  out << str;
-         out.flush();
+      appendPoint(out, b[i], i);
 
+  endLine(out, lineStart);
 	return 1;
 }
 
 //Compute source-to-target alignment
 
-int printsrctotgt(fstream& out,int m,int *a,int n,int* b){
+int printsrctotgt(string& out,int m,const int *a,int n,const int* b){
 
-  ostringstream sout;
+  size_t lineStart = out.size();
 
   for (int j=1;j<=m;j++)
     if (a[j])
-        sout << j-1 << "-" << a[j]-1 << " ";
+      appendPoint(out, j, a[j]);
 
-  //fix the last " "
-  string str = sout.str();
-  if (str.length() == 0)
-    str = "\n";
-  else
-    str.replace(str.length()-1,1,"\n");
+  endLine(out, lineStart);
+  return 1;
+}
+
+//Buffers for the grow alignment, sized for the longest sentence pair seen so far and reused by one thread at a time
+struct GrowBuffers {
+  vector<int> fa; //counters of covered foreign positions
+  vector<int> ea; //counters of covered english positions
+  //alignment matrix with information symmetric/direct/inverse alignments, (n+1) rows of (m+1) entries
+  vector<signed char> A;
+  //points of the union alignment, sorted by english and then foreign position
+  vector<pair<int,int> > unionalignment;
+};
 
-  out << str;
-         out.flush();
+vector<GrowBuffers*> idleBuffers;
+Mutex buffersMutex;
 
-        return 1;
+//Next column after j in row i of the matrix that holds a point of the symmetric alignment, or 0.
+//The row is read as it is now, so points added to the right of j are found, just as a set iterator finds elements inserted after it.
+static inline int nextPoint(const signed char* row, int j, int m) {
+  const void* found = memchr(row + j + 1, 2, m - j);
+  return found == NULL ? 0 : (int)(static_cast<const signed char*>(found) - row);
 }
 
 //Compute Grow Diagonal Alignment
@@ -219,174 +310,172 @@ int printsrctotgt(fstream& out,int m,int *a,int n,int* b){
 //to represent the grow alignment as the unionalignment of a
 //directed and inverted alignment
 
-int printgrow(fstream& out,int m,int *a,int n,int* b, bool diagonal=false,bool final=false,bool bothuncovered=false){
-   
-   ostringstream sout;
-   
-   vector <pair <int,int> > neighbors; //neighbors
-   
-   pair <int,int> entry;
-   
-   neighbors.push_back(make_pair(-1,-0));
-   neighbors.push_back(make_pair(0,-1));
-   neighbors.push_back(make_pair(1,0));
-   neighbors.push_back(make_pair(0,1));
-   
-   
-   if (diagonal){
-      neighbors.push_back(make_pair(-1,-1));
-      neighbors.push_back(make_pair(-1,1));
-      neighbors.push_back(make_pair(1,-1));
-      neighbors.push_back(make_pair(1,1));    
-   }
+int printgrow(string& out,int m,const int *a,int n,const int* b, GrowBuffers& buffers, bool diagonal=false,bool final=false,bool bothuncovered=false){
    
+   static const int neighbors[8][2] = {{-1,0}, {0,-1}, {1,0}, {0,1}, {-1,-1}, {-1,1}, {1,-1}, {1,1}};
+   const int neighborCount = diagonal ? 8 : 4;
    
    int i,j,o;
    
-   
    //covered foreign and english positions 
-   
-    memset(fa,0,(m+1)*sizeof(int));
-    memset(ea,0,(n+1)*sizeof(int));
+   vector<int>& fa = buffers.fa;
+   vector<int>& ea = buffers.ea;
+   fa.assign(m+1, 0);
+   ea.assign(n+1, 0);
    
    //matrix to quickly check if one point is in the symmetric
-   //alignment (value=2), direct alignment (=1) and inverse alignment   
- 
-   for (int i=1;i<=n;i++) memset(A[i],0,(m+1)*sizeof(int));
+   //alignment (value=2), direct alignment (=-1) and inverse alignment (=1);
+   //the points with value 2 form the current (symmetric) alignment
+   const int width = m+1;
+   buffers.A.assign((size_t)(n+1) * width, 0);
+   signed char* A = &buffers.A[0];
    
-   set <pair <int,int> > currentpoints; //symmetric alignment
-   set <pair <int,int> > unionalignment; //union alignment
-   
-   pair <int,int> point; //variable to store points
-   set<pair <int,int> >::const_iterator k; //iterator over sets
+   vector<pair<int,int> >& unionalignment = buffers.unionalignment;
+   unionalignment.clear();
    
    //fill in the alignments
    for (j=1;j<=m;j++){
       if (a[j]){
-         unionalignment.insert(make_pair(a[j],j));
+         unionalignment.push_back(make_pair(a[j],j));
          if (b[a[j]]==j){ 
             fa[j]=1;ea[a[j]]=1;
-            A[a[j]][j]=2;   
-            currentpoints.insert(make_pair(a[j],j));
+            A[a[j]*width+j]=2;   
          }         
          else 
-            A[a[j]][j]=-1;
+            A[a[j]*width+j]=-1;
       }
    }
    
    for (i=1;i<=n;i++) 
       if (b[i] && a[b[i]]!=i){ //not intersection
-         unionalignment.insert(make_pair(i,b[i])); 
-         A[i][b[i]]=1;
+         unionalignment.push_back(make_pair(i,b[i])); 
+         A[i*width+b[i]]=1;
       } 
-         
-             
+   sort(unionalignment.begin(), unionalignment.end());
+   
    int added=1;
    
    while (added){
       added=0;
-      ///scan the current alignment
-      for (k=currentpoints.begin();k!=currentpoints.end();k++){
-         //cout << "{"<< (k->second)-1 << "-" << (k->first)-1 << "}";
-         for (o=0;o<neighbors.size();o++){
-            //cout << "go over check all neighbors\n";
-            point.first=k->first+neighbors[o].first;      
-            point.second=k->second+neighbors[o].second; 
-            //cout << point.second-1 << " " << point.first-1 << "\n";
-            //check if neighbor is inside 'matrix'
-            if (point.first>0 && point.first <=n && point.second>0 && point.second<=m)
-               //check if neighbor is in the unionalignment alignment
-               if (b[point.first]==point.second || a[point.second]==point.first){
-                  //cout << "In unionalignment ";cout.flush();
-                  //check if it connects at least one uncovered word
-                  if (!(ea[point.first] && fa[point.second]))
-                  {
-                     //insert point in currentpoints!
-                     currentpoints.insert(point);
-                     A[point.first][point.second]=2;
-                     ea[point.first]=1; fa[point.second]=1;
-                     added=1;
-                     //cout << "added grow: " << point.second-1 << "-" << point.first-1 << "\n";cout.flush();
+      ///scan the current alignment in the order of a set of (english, foreign) points
+      for (i=1;i<=n;i++)
+         for (j=nextPoint(A+i*width,0,m);j;j=nextPoint(A+i*width,j,m))
+            for (o=0;o<neighborCount;o++){
+               int pi=i+neighbors[o][0];
+               int pj=j+neighbors[o][1];
+               //check if neighbor is inside 'matrix'
+               if (pi>0 && pi<=n && pj>0 && pj<=m)
+                  //check if neighbor is in the unionalignment alignment
+                  if (b[pi]==pj || a[pj]==pi){
+                     //check if it connects at least one uncovered word
+                     if (!(ea[pi] && fa[pj]))
+                     {
+                        //insert point in the current alignment!
+                        A[pi*width+pj]=2;
+                        ea[pi]=1; fa[pj]=1;
+                        added=1;
+                     }
                   }
-               }
-         }
-      }
+            }
    }
       
-      if (final){
-         for (k=unionalignment.begin();k!=unionalignment.end();k++)
-            if (A[k->first][k->second]==1)
-            {            
-               point.first=k->first;point.second=k->second;
+   if (final){
+      //first the points of the inverse alignment, then those of the direct one
+      for (int value=1;value>=-1;value-=2)
+         for (size_t k=0;k<unionalignment.size();k++){
+            int pi=unionalignment[k].first;
+            int pj=unionalignment[k].second;
+            if (A[pi*width+pj]==value)
                //one of the two words is not covered yet
-               //cout << "{" << point.second-1 << "-" << point.first-1 << "} ";
-               if ((bothuncovered &&  !ea[point.first] && !fa[point.second]) ||
-                  (!bothuncovered && !(ea[point.first] && fa[point.second])))
+               if ((bothuncovered &&  !ea[pi] && !fa[pj]) ||
+                   (!bothuncovered && !(ea[pi] && fa[pj])))
                {
                   //add it!
-                  currentpoints.insert(point);
-                  A[point.first][point.second]=2;
+                  A[pi*width+pj]=2;
                   //keep track of new covered positions                
-                  ea[point.first]=1;fa[point.second]=1;
-                  
-                  //added=1;
-                  //cout << "added final: " << point.second-1 << "-" << point.first-1 << "\n";
+                  ea[pi]=1;fa[pj]=1;
                }
-            }
-               
-               for (k=unionalignment.begin();k!=unionalignment.end();k++)
-                  if (A[k->first][k->second]==-1)
-                  {            
-                     point.first=k->first;point.second=k->second;
-                     //one of the two words is not covered yet
-                     //cout << "{" << point.second-1 << "-" << point.first-1 << "} ";
-                     if ((bothuncovered &&  !ea[point.first] && !fa[point.second]) ||
-                         (!bothuncovered && !(ea[point.first] && fa[point.second])))
-                     {
-                        //add it!
-                        currentpoints.insert(point);
-                        A[point.first][point.second]=2;
-                        //keep track of new covered positions                
-                        ea[point.first]=1;fa[point.second]=1;
-                        
-                        //added=1;
-                        //cout << "added final: " << point.second-1 << "-" << point.first-1 << "\n";
-                     }
-                  }
-      }      
-         
-             
-         for (k=currentpoints.begin();k!=currentpoints.end();k++)
-            sout << k->second-1 << "-" << k->first-1 << " ";
-         
-         
-         //fix the last " "
-         string str = sout.str();  
-	 if (str.length() == 0)
-	   str = "\n";
-	 else
-	   str.replace(str.length()-1,1,"\n");
-         
-         out << str;
-         out.flush();
-         return 1;
-         
-         return 1;
+         }
+   }
+   
+   size_t lineStart = out.size();
+   for (i=1;i<=n;i++)
+      for (j=nextPoint(A+i*width,0,m);j;j=nextPoint(A+i*width,j,m))
+         appendPoint(out, j, i);
+   endLine(out, lineStart);
+   return 1;
 }
 
 
+//A batch of sentence pairs, stored one after the other as n, b[0..n], m, a[0..m]
+struct SymalJob : public OrderedJob {
+  vector<int> data;
+  size_t sentences;
+  string output;
+  
+  SymalJob() : sentences(0) {}
+  void run();
+};
+
+int alignment=0;   
+int diagonal=false;
+int final=false;
+int bothuncovered=false;
+
+void SymalJob::run() {
+  GrowBuffers* buffers = NULL;
+  if (alignment == GROW) {
+    ScopedLock lock(buffersMutex);
+    buffers = idleBuffers.back();
+    idleBuffers.pop_back();
+  }
+  
+  for (size_t p = 0; p < data.size(); ) {
+    int n = data[p];
+    const int* b = &data[p+1];
+    int m = data[p+n+2];
+    const int* a = &data[p+n+3];
+    p += (n+2) + (m+2);
+    switch (alignment){
+      case UNION: prunionalignment(output,m,a,n,b); break;
+      case INTERSECT: printersect(output,m,a,n,b); break;
+      case GROW: printgrow(output,m,a,n,b,*buffers,diagonal,final,bothuncovered); break;
+      case TGTTOSRC: printtgttosrc(output,m,a,n,b); break;
+      case SRCTOTGT: printsrctotgt(output,m,a,n,b); break;
+    }
+  }
+  
+  if (buffers != NULL) {
+    ScopedLock lock(buffersMutex);
+    idleBuffers.push_back(buffers);
+  }
+}
+
+static void writeOutput(FILE* out, const string& output) {
+  if (!output.empty() && fwrite(output.data(), 1, output.size(), out) != output.size()) {
+    cerr << "symal: could not write the output!!!" << endl;
+    exit(1);
+  }
+}
+
+void* outputWriter(void* data) {
+  pair<OrderedWorkerPool*, FILE*>* writerData = static_cast<pair<OrderedWorkerPool*, FILE*>*>(data);
+  for (OrderedJob* job = writerData->first->next(); job != NULL; job = writerData->first->next()) {
+    writeOutput(writerData->second, static_cast<SymalJob*>(job)->output);
+    delete job;
+  }
+  return NULL;
+}
+
 
 //Main file here
 
 
 int main(int argc, char** argv){
 	
-int alignment=0;   
 char* input="/dev/stdin";
 char* output="/dev/stdout";
-int diagonal=false;
-int final=false;
-int bothuncovered=false;
+int threads=1;
 
 	
 	DeclareParams("a", CMDENUMTYPE,  &alignment, AlignEnum,
@@ -399,6 +488,8 @@ int bothuncovered=false;
                  "both", CMDENUMTYPE,  &bothuncovered, BoolEnum,  
                  "i", CMDSTRINGTYPE, &input,
                  "o", CMDSTRINGTYPE, &output,
+                 "t", CMDINTTYPE, &threads,
+                 "threads", CMDINTTYPE, &threads,
                  "v", CMDENUMTYPE,  &verbose, BoolEnum,
                  "verbose", CMDENUMTYPE,  &verbose, BoolEnum,
 
@@ -407,87 +498,111 @@ int bothuncovered=false;
 	GetParams(&argc, &argv, (char*) NULL);
    
    if (alignment==0){
-      cerr << "usage: symal [-i=<inputfile>] [-o=<outputfile>] -a=[u|i|g] -d=[yes|no] -b=[yes|no] -f=[yes|no] \n"
-      << "Input file or std must be in .bal format (see script giza2bal.pl).\n";
+      cerr << "usage: symal [-i=<inputfile>] [-o=<outputfile>] -a=[u|i|g] -d=[yes|no] -b=[yes|no] -f=[yes|no] [-t=<threads>]\n"
+      << "Input file or std must be in .bal format (see script giza2bal.pl).\n"
+      << "With -t=0 all available cores are used.\n";
          
       exit(1);
         
    }
+   
+   if (threads <= 0)
+      threads = availableCores();
 
-	fstream inp(input,ios::in);
-   fstream out(output,ios::out);
+	FILE* inp = fopen(input, "r");
+   FILE* out = fopen(output, "w");
 
-	if (!inp.is_open()){
+	if (inp == NULL){
 		cerr << "cannot open " << input << "\n";
 		exit(1);
 	}
    
-   if (!out.is_open()){
+   if (out == NULL){
 		cerr << "cannot open " << output << "\n";
 		exit(1);
 	}
    
-
-  int a[MAX_M],b[MAX_N],m,n;
-  fa=new int[MAX_M+1];
-  ea=new int[MAX_N+1];
- 
-      
-  int sents = 0;
-  A=new int *[MAX_N+1]; 
-  for (int i=1;i<=MAX_N;i++) A[i]=new int[MAX_M+1];
-      
 	switch (alignment){
 		case UNION:
          cerr << "symal: computing union alignment\n";
-			while(getals(inp,m,a,n,b)) {
-                          prunionalignment(out,m,a,n,b);
-                          sents++;
-                        }
-                        cerr << "Sents: " << sents << endl;
 			break;
 		case INTERSECT:
           cerr << "symal: computing intersect alignment\n";
-			while(getals(inp,m,a,n,b)) {
-                          printersect(out,m,a,n,b);
-                          sents++;
-                        }
-                        cerr << "Sents: " << sents << endl;
 			break;
       case GROW:
      cerr << "symal: computing grow alignment: diagonal ("
          << diagonal << ") final ("<< final << ")" 
          <<  "both-uncovered (" << bothuncovered <<")\n"; 
-         
-         while(getals(inp,m,a,n,b)) 
-               printgrow(out,m,a,n,b,diagonal,final,bothuncovered);
-         
          break;
       case TGTTOSRC:
         cerr << "symal: computing target-to-source alignment\n";
-                                     
-         while(getals(inp,m,a,n,b)){ 
-                  printtgttosrc(out,m,a,n,b);
-                  sents++;           
-               }                     
-               cerr << "Sents: " << sents << endl;
           break;                     
       case SRCTOTGT:
         cerr << "symal: computing source-to-target alignment\n";
-         
-         while(getals(inp,m,a,n,b)){
-                  printsrctotgt(out,m,a,n,b);
-                  sents++;
-               }
-               cerr << "Sents: " << sents << endl;
           break;
 		default:
 			exit(1);
 	}
+   if (threads > 1)
+      cerr << "symal: using " << threads << " threads\n";
+   
+   //One set of grow buffers for each thread that may be symmetrising at the same time
+   for (int t = 0; t < threads; ++t)
+      idleBuffers.push_back(new GrowBuffers());
+   
+   //The main thread reads batches of sentence pairs; with more than one thread they are symmetrised on a pool of workers
+   //and a separate thread writes the output of each batch once it is completed, strictly in input order
+   OrderedWorkerPool* pool = NULL;
+   Thread writer;
+   pair<OrderedWorkerPool*, FILE*> writerData(NULL, out);
+   if (threads > 1) {
+      pool = new OrderedWorkerPool(threads, 4 * threads);
+      writerData.first = pool;
+      writer.start(&outputWriter, &writerData);
+   }
    
-   delete [] fa; delete [] ea; 
-   for (int i=1;i<=MAX_N;i++) delete [] A[i];
-   delete [] A;
+   TokenReader reader(inp);
+   int sents = 0;
+   SymalJob* job = NULL;
+   while (true) {
+      if (job == NULL)
+         job = new SymalJob();
+      bool more = getals(reader, job->data);
+      if (more) {
+         ++sents;
+         ++job->sentences;
+      }
+      if (job->sentences >= batchSize || (!more && job->sentences > 0)) {
+         if (pool != NULL)
+            pool->submit(job);
+         else {
+            job->run();
+            writeOutput(out, job->output);
+            delete job;
+         }
+         job = NULL;
+      }
+      if (!more)
+         break;
+   }
+   delete job;
+   
+   if (pool != NULL) {
+      pool->finish();
+      writer.join();
+      delete pool;
+   }
+   
+   if (alignment != GROW)
+      cerr << "Sents: " << sents << endl;
+   
+   for (size_t t = 0; t < idleBuffers.size(); ++t)
+      delete idleBuffers[t];
+   fclose(inp);
+   if (fclose(out) != 0) {
+      cerr << "symal: could not write the output!!!" << endl;
+      exit(1);
+   }
    
    exit(0);
 }